@@ -0,0 +1,328 @@
+#include "adaptive.h"
+#include "locate.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Adaptive query execution.
+ * Patterns are searched in batches, each split over the active workers of a
+ *  pool, which run a shared-suffix batch search and locate on their slice.
+ *  Worker threads beyond the active ones return right away, so they sleep
+ *  on the pool instead of spinning.
+ * Time and energy are sampled at the end of every window of the configured
+ *  length, and a hill climbing controller moves the worker count and batch
+ *  size towards the best score: queries per joule, or queries per second
+ *  within the power budget. Each window measures one setting. A move that
+ *  improves the score is kept and tried again, and one that does not is
+ *  undone and the next move tried. Once no move helps, the current setting
+ *  is measured again, so a lucky window does not pin it forever, and load
+ *  changes on shared nodes are followed.
+ */
+
+typedef enum adaptive_move {
+  MORE_THREADS,
+  FEWER_THREADS,
+  LARGER_BATCH,
+  SMALLER_BATCH,
+  MOVE_COUNT,
+} adaptive_move;
+
+static const char *move_names[] = {"more_threads", "fewer_threads",
+                                   "larger_batch", "smaller_batch"};
+
+struct fm_adaptive {
+  fm_index *fm;
+  fm_adaptive_config config;
+  fm_locate_pool *pool;
+  unsigned long *matches; // Per worker.
+  int has_energy;
+  unsigned threads;
+  unsigned batch_sz;
+  // Start of the current window.
+  double window_time;
+  double window_package;
+  double window_dram;
+  unsigned long window_queries;
+  // Controller state: whether the window measures the current setting or a
+  //  move from it, the score of the current setting, and the move tried
+  //  with the number of moves that failed in a row.
+  int measuring;
+  double score;
+  unsigned move;
+  unsigned tried;
+  double start_time;
+  double start_package;
+  double start_dram;
+  fm_adaptive_stats stats;
+};
+
+typedef struct batch_job {
+  fm_index *fm;
+  char *patterns;
+  unsigned pattern_count;
+  size_t pattern_sz;
+  unsigned threads;
+  unsigned long *matches;
+  int failed;
+} batch_job;
+
+static double Now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Read the energy counters, and stop using them after an error. Return 0
+//  without energy readings.
+static int ReadEnergy(fm_adaptive *a, double *package, double *dram) {
+  *package = *dram = 0.;
+  if (a->has_energy &&
+      a->config.read_energy(a->config.energy_arg, package, dram) != 0) {
+    a->has_energy = 0;
+    // Scores change meaning, so the current setting is measured again.
+    a->measuring = 1;
+    *package = *dram = 0.;
+  }
+  return a->has_energy;
+}
+
+static void SearchSlice(void *arg, unsigned id) {
+  batch_job *job = arg;
+  if (id >= job->threads)
+    return;
+  unsigned first = (unsigned long)job->pattern_count * id / job->threads;
+  unsigned last = (unsigned long)job->pattern_count * (id + 1) / job->threads;
+  unsigned count = last - first;
+  job->matches[id] = 0;
+  if (!count)
+    return;
+
+  ranges_t *starts = malloc(count * sizeof(ranges_t));
+  ranges_t *ends = malloc(count * sizeof(ranges_t));
+  unsigned long *offsets = NULL, *positions = NULL;
+  if (!starts || !ends ||
+      !FMIndexFindMatchRangeBatch(job->fm,
+                                  &job->patterns[first * job->pattern_sz],
+                                  count, job->pattern_sz, starts, ends, NULL,
+                                  NULL) ||
+      !FMIndexFindRangeIndicesBatch(job->fm, starts, ends, count, &offsets,
+                                    &positions))
+    __atomic_store_n(&job->failed, 1, __ATOMIC_RELAXED);
+  else
+    job->matches[id] = offsets[count];
+
+  free(starts);
+  free(ends);
+  free(offsets);
+  free(positions);
+}
+
+// Apply the move to the setting. Return 0 if it would leave the bounds.
+static int Step(fm_adaptive *a, unsigned move) {
+  switch (move) {
+  case MORE_THREADS:
+    if (a->threads == a->config.max_threads)
+      return 0;
+    ++a->threads;
+    return 1;
+  case FEWER_THREADS:
+    if (a->threads == 1)
+      return 0;
+    --a->threads;
+    return 1;
+  case LARGER_BATCH:
+    if (a->batch_sz > a->config.max_batch / 2)
+      return 0;
+    a->batch_sz *= 2;
+    return 1;
+  case SMALLER_BATCH:
+    if (a->batch_sz / 2 < a->config.min_batch)
+      return 0;
+    a->batch_sz /= 2;
+    return 1;
+  }
+  return 0;
+}
+
+/* Score of a window, higher is better. Settings over the power budget score
+ *  below all settings within it, and lower power ranks higher among them.
+ */
+static double Score(fm_adaptive *a, double qps, double qpj, double watts) {
+  if (!a->has_energy)
+    return qps;
+  if (a->config.goal == FM_ADAPTIVE_MIN_ENERGY)
+    return qpj;
+  if (a->config.power_budget > 0. && watts > a->config.power_budget)
+    return -watts;
+  return qps;
+}
+
+// Evaluate the window ending now, pick the setting of the next window and
+//  log the decision.
+static void CloseWindow(fm_adaptive *a, double now) {
+  double package, dram;
+  ReadEnergy(a, &package, &dram);
+  double seconds = now - a->window_time;
+  double joules = (package - a->window_package) + (dram - a->window_dram);
+  double watts = (seconds > 0.) ? joules / seconds : 0.;
+  double qps = (seconds > 0.) ? a->window_queries / seconds : 0.;
+  double qpj = (joules > 0.) ? a->window_queries / joules : 0.;
+  double score = Score(a, qps, qpj, watts);
+  unsigned threads = a->threads, batch_sz = a->batch_sz;
+
+  const char *decision;
+  double margin = (a->score < 0. ? -a->score : a->score) * FM_ADAPTIVE_MIN_GAIN;
+  if (a->measuring) {
+    decision = "measure";
+    a->score = score;
+    a->tried = 0;
+  } else if (score > a->score + margin) {
+    decision = "accept";
+    a->score = score;
+    a->tried = 0;
+    ++a->stats.moves;
+  } else {
+    decision = "reject";
+    // Moves come in pairs, so the opposite of a move undoes it.
+    Step(a, a->move ^ 1);
+    a->move = (a->move + 1) % MOVE_COUNT;
+    ++a->tried;
+  }
+
+  // An accepted move is tried again, and otherwise the next one within the
+  //  bounds, until all failed in a row.
+  a->measuring = 1;
+  for (; a->tried < MOVE_COUNT; ++a->tried) {
+    if (Step(a, a->move)) {
+      a->measuring = 0;
+      break;
+    }
+    a->move = (a->move + 1) % MOVE_COUNT;
+  }
+
+  if (a->config.log) {
+    fprintf(a->config.log,
+            "%lu\t%u\t%u\t%lu\t%.6f\t%.6f\t%.6f\t%.3f\t%.1f\t%.3f\t%s\t%s\n",
+            a->stats.windows, threads, batch_sz, a->window_queries, seconds,
+            package - a->window_package, dram - a->window_dram, watts, qps,
+            qpj, decision, (a->measuring) ? "-" : move_names[a->move]);
+    fflush(a->config.log);
+  }
+
+  ++a->stats.windows;
+  a->window_time = now;
+  a->window_package = package;
+  a->window_dram = dram;
+  a->window_queries = 0;
+}
+
+/* Create an adaptive search of the index with the given configuration.
+ * Return NULL on memory allocation or thread creation error.
+ */
+fm_adaptive *FMAdaptiveCreate(fm_index *fm, fm_adaptive_config *config) {
+  fm_adaptive *a = calloc(1, sizeof(fm_adaptive));
+  if (!a)
+    return NULL;
+  a->fm = fm;
+  a->config = *config;
+  fm_adaptive_config *c = &a->config;
+  if (!c->max_threads)
+    c->max_threads = sysconf(_SC_NPROCESSORS_ONLN);
+  if (!c->min_batch)
+    c->min_batch = 1;
+  if (c->max_batch < c->min_batch)
+    c->max_batch = c->min_batch;
+  if (c->interval <= 0.)
+    c->interval = 0.1;
+
+  if (!(a->pool = FMLocatePoolCreate(c->max_threads)) ||
+      !(a->matches = calloc(c->max_threads, sizeof(unsigned long)))) {
+    FMAdaptiveFree(a);
+    return NULL;
+  }
+
+  // Start with all workers and a batch size halfway between the bounds.
+  a->threads = c->max_threads;
+  unsigned doublings = 0;
+  while ((unsigned long)c->min_batch << (doublings + 1) <= c->max_batch)
+    ++doublings;
+  a->batch_sz = c->min_batch << (doublings / 2);
+
+  a->has_energy = c->read_energy != NULL;
+  ReadEnergy(a, &a->start_package, &a->start_dram);
+  a->start_time = a->window_time = Now();
+  a->window_package = a->start_package;
+  a->window_dram = a->start_dram;
+  a->measuring = 1;
+
+  if (c->log)
+    fprintf(c->log, "window\tthreads\tbatch\tqueries\tseconds\tpackage_j\t"
+                    "dram_j\twatts\tqueries_per_s\tqueries_per_j\tdecision\t"
+                    "next_move\n");
+  return a;
+}
+
+void FMAdaptiveFree(fm_adaptive *adaptive) {
+  if (adaptive->pool)
+    FMLocatePoolFree(adaptive->pool);
+  free(adaptive->matches);
+  free(adaptive);
+}
+
+/* Search and locate the patterns, adapting the setting between batches.
+ *  Windows and the controller state carry over between calls.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMAdaptiveSearch(fm_adaptive *adaptive, char *patterns,
+                     unsigned pattern_count, size_t pattern_sz) {
+  fm_adaptive *a = adaptive;
+  for (unsigned next = 0; next < pattern_count;) {
+    unsigned count = pattern_count - next;
+    if (count > a->batch_sz)
+      count = a->batch_sz;
+    batch_job job = {a->fm,      &patterns[(size_t)next * pattern_sz],
+                     count,      pattern_sz,
+                     a->threads, a->matches,
+                     0};
+    FM_TRACE_BEGIN(span);
+    if (job.threads > 1)
+      FMLocatePoolRun(a->pool, &SearchSlice, &job);
+    else
+      SearchSlice(&job, 0);
+    if (job.failed)
+      return 0;
+
+    unsigned long matches = 0;
+    for (unsigned i = 0; i < job.threads; ++i)
+      matches += a->matches[i];
+    FM_TRACE_END(span, "adaptive batch", 0, matches);
+    a->stats.matches += matches;
+    a->stats.queries += count;
+    a->window_queries += count;
+    next += count;
+
+    double now = Now();
+    if (now - a->window_time >= a->config.interval)
+      CloseWindow(a, now);
+  }
+  return 1;
+}
+
+/* Get the totals since the adaptive search was created and its current
+ *  setting. Seconds are wall-clock time, including time between searches.
+ */
+void FMAdaptiveGetStats(fm_adaptive *adaptive, fm_adaptive_stats *stats) {
+  fm_adaptive *a = adaptive;
+  *stats = a->stats;
+  double package, dram;
+  if (ReadEnergy(a, &package, &dram)) {
+    stats->package_joules = package - a->start_package;
+    stats->dram_joules = dram - a->start_dram;
+  }
+  stats->seconds = Now() - a->start_time;
+  stats->threads = a->threads;
+  stats->batch_sz = a->batch_sz;
+}
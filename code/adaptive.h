@@ -0,0 +1,66 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+
+#include "fmindex.h"
+
+// A move is kept only if it improves the score by at least this fraction,
+//  so measurement noise does not make the controller wander.
+#define FM_ADAPTIVE_MIN_GAIN 0.02
+
+typedef enum fm_adaptive_goal {
+  // Most queries per joule of package and DRAM energy.
+  FM_ADAPTIVE_MIN_ENERGY,
+  // Most queries per second, within the power budget if there is one.
+  FM_ADAPTIVE_MAX_THROUGHPUT,
+} fm_adaptive_goal;
+
+typedef struct fm_adaptive_config {
+  fm_adaptive_goal goal;
+  // Watts allowed with FM_ADAPTIVE_MAX_THROUGHPUT, 0 for no limit.
+  double power_budget;
+  // Worker threads including the calling thread, 0 for all processors.
+  unsigned max_threads;
+  // Bounds of the number of patterns searched per batch, which is kept at a
+  //  power of two times min_batch.
+  unsigned min_batch;
+  unsigned max_batch;
+  // Seconds per measurement window.
+  double interval;
+  // Energy source, returning 0 on success, see rapl_read. Without one,
+  //  both goals maximize throughput.
+  int (*read_energy)(void *arg, double *package_joules, double *dram_joules);
+  void *energy_arg;
+  // Every window is logged here as a line of tab-separated values, if not
+  //  NULL.
+  FILE *log;
+} fm_adaptive_config;
+
+typedef struct fm_adaptive_stats {
+  unsigned long queries;
+  unsigned long matches;
+  unsigned long windows;
+  unsigned long moves;
+  double seconds;
+  double package_joules;
+  double dram_joules;
+  // Setting at the end.
+  unsigned threads;
+  unsigned batch_sz;
+} fm_adaptive_stats;
+
+typedef struct fm_adaptive fm_adaptive;
+
+fm_adaptive *FMAdaptiveCreate(fm_index *fm, fm_adaptive_config *config);
+void FMAdaptiveFree(fm_adaptive *adaptive);
+int FMAdaptiveSearch(fm_adaptive *adaptive, char *patterns,
+                     unsigned pattern_count, size_t pattern_sz);
+void FMAdaptiveGetStats(fm_adaptive *adaptive, fm_adaptive_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
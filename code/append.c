@@ -0,0 +1,57 @@
+#include "fmindex.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+  if (argc < 3) {
+    printf("Usage: $ %s <FMINDEXFILE> <INPUTFILE>...\n", argv[0]);
+    printf("Append the input files to the indexed text, as new documents if "
+           "the index\nholds a collection. The index file is replaced "
+           "atomically.\n");
+    return 1;
+  }
+
+  fm_index *index = FMIndexReadFromFile(argv[1], 0);
+  if (!index) {
+    printf("Could not read FM-index from file.\n");
+    return 1;
+  }
+  if (index->reverse || index->lcp) {
+    printf("Cannot append to an FM-index with a reverse index or LCP array, "
+           "construct it again.\n");
+    return 1;
+  }
+
+  for (int i = 2; i < argc; ++i) {
+    char *s = ReadFile(argv[i]);
+    if (!s)
+      return 1;
+    if (index->doc_starts && strchr(s, FM_DOCUMENT_SEPARATOR)) {
+      printf("File %s contains the document separator.\n", argv[i]);
+      return 1;
+    }
+    for (size_t j = 0; index->qgram_filter && s[j] != '\0'; ++j)
+      if (index->alphabet_map[(unsigned char)s[j]] < 0) {
+        printf("File %s has characters outside the alphabet of the q-gram "
+               "filter, construct the index again.\n",
+               argv[i]);
+        return 1;
+      }
+
+    if (!FMIndexAppend(index, s)) {
+      printf("Failed to append %s.\n", argv[i]);
+      return 1;
+    }
+    free(s);
+  }
+
+  if (!FMIndexDumpToFile(index, argv[1])) {
+    printf("Failed to write FM-index to file.\n");
+    return 1;
+  }
+
+  FMIndexFree(index);
+  return 0;
+}
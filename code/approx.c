@@ -0,0 +1,297 @@
+#include "approx.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Approximate matching with search schemes (Kucherov et al., 2016).
+ * The pattern is split into parts, and each scheme searches the parts in a
+ *  given order with lower and upper bounds on the accumulated errors after
+ *  each part. The schemes together cover every distribution of at most k
+ *  errors over the parts, while the tight bounds on the first parts prune
+ *  most of the search space early. Because parts are not searched from left
+ *  to right only, a bidirectional index is needed to extend the match on
+ *  both sides.
+ */
+
+#define MAX_PARTS 8
+
+typedef struct search_scheme {
+  unsigned order[MAX_PARTS];
+  unsigned lower[MAX_PARTS];
+  unsigned upper[MAX_PARTS];
+} search_scheme;
+
+// Optimal schemes for one and two errors, with parts numbered from 0.
+static const search_scheme schemes_k1[] = {
+    {{0, 1}, {0, 0}, {0, 1}},
+    {{1, 0}, {0, 0}, {0, 1}},
+};
+static const search_scheme schemes_k2[] = {
+    {{0, 1, 2}, {0, 0, 0}, {0, 2, 2}},
+    {{2, 1, 0}, {0, 0, 0}, {0, 1, 2}},
+    {{1, 0, 2}, {0, 0, 1}, {0, 1, 2}},
+};
+
+// A match in both the forward and the reverse index. Both ranges have the
+//  same size.
+typedef struct bi_range {
+  ranges_t start;
+  ranges_t end;
+  ranges_t rev_start;
+} bi_range;
+
+typedef struct approx_search {
+  fm_index *fm;
+  int edits;
+  // Per search step: pattern position, direction and error bounds.
+  size_t *positions;
+  int *left;
+  unsigned *lower;
+  unsigned *upper;
+  size_t steps;
+  char *pattern;
+  fm_approx_match *matches;
+  size_t match_count;
+  size_t match_capacity;
+  int failed;
+} approx_search;
+
+/* Extend the match with every character of the alphabet, to the left using
+ *  the forward index or to the right using the reverse index.
+ * The extended ranges for all characters are written to out.
+ */
+static void ExtendAll(fm_index *fm, bi_range r, int left, bi_range *out) {
+  fm_index *index = (left) ? fm : fm->reverse;
+  ranges_t start = (left) ? r.start : r.rev_start;
+  ranges_t end = start + (r.end - r.start);
+  ranges_t other_start = (left) ? r.rev_start : r.start;
+
+  // Occurrences of smaller characters shift the range in the other index.
+  ranges_t smaller = 0;
+  for (size_t c = 0; c < fm->alphabet_sz; ++c) {
+    ranges_t lo = FMIndexOcc(index, c, start), hi = FMIndexOcc(index, c, end);
+    ranges_t new_start = fm->ranges[2 * c] + lo;
+    ranges_t new_end = fm->ranges[2 * c] + hi;
+    if (left) {
+      out[c].start = new_start;
+      out[c].end = new_end;
+      out[c].rev_start = other_start + smaller;
+    } else {
+      out[c].rev_start = new_start;
+      out[c].start = other_start + smaller;
+      out[c].end = other_start + smaller + (new_end - new_start);
+    }
+    smaller += hi - lo;
+  }
+}
+
+static void RecordMatch(approx_search *search, bi_range r, unsigned errors) {
+  if (search->match_count == search->match_capacity) {
+    size_t capacity = (search->match_capacity) ? 2 * search->match_capacity : 16;
+    fm_approx_match *matches =
+        realloc(search->matches, capacity * sizeof(fm_approx_match));
+    if (!matches) {
+      search->failed = 1;
+      return;
+    }
+    search->matches = matches;
+    search->match_capacity = capacity;
+  }
+
+  fm_approx_match *m = &search->matches[search->match_count++];
+  m->start = r.start;
+  m->end = r.end;
+  m->errors = errors;
+}
+
+/* Depth-first search over the remaining steps of a scheme.
+ * matched is the number of text characters matched so far, used to forbid
+ *  deletions before the first and after the last pattern character.
+ */
+static void SearchStep(approx_search *search, bi_range r, size_t step,
+                       unsigned errors, size_t matched) {
+  if (search->failed)
+    return;
+  if (step == search->steps) {
+    if (matched)
+      RecordMatch(search, r, errors);
+    return;
+  }
+
+  fm_index *fm = search->fm;
+  int left = search->left[step];
+  unsigned upper = search->upper[step];
+  unsigned lower = search->lower[step];
+  int want = fm->alphabet_map[(unsigned char)search->pattern[search->positions[step]]];
+
+  bi_range extended[fm->alphabet_sz];
+  // Without errors to spare only the pattern character itself can match.
+  if (errors == upper) {
+    if (want <= 0 || errors < lower)
+      return;
+    ExtendAll(fm, r, left, extended);
+    if (extended[want].end > extended[want].start)
+      SearchStep(search, extended[want], step + 1, errors, matched + 1);
+    return;
+  }
+
+  ExtendAll(fm, r, left, extended);
+  // Character 0 is the dollar sign, which never matches.
+  for (int c = 1; c < (int)fm->alphabet_sz; ++c) {
+    if (extended[c].end == extended[c].start)
+      continue;
+    unsigned e = errors + (c != want);
+    if (e >= lower)
+      SearchStep(search, extended[c], step + 1, e, matched + 1);
+
+    // Deletion: the text has an extra character before this pattern
+    //  character.
+    if (search->edits && matched && c != want)
+      SearchStep(search, extended[c], step, errors + 1, matched + 1);
+  }
+
+  // Insertion: the pattern character is missing from the text.
+  if (search->edits && matched && errors + 1 >= lower)
+    SearchStep(search, r, step + 1, errors + 1, matched);
+}
+
+static int CompareMatch(const void *a, const void *b) {
+  const fm_approx_match *m = a, *n = b;
+  if (m->start != n->start)
+    return (m->start < n->start) ? -1 : 1;
+  if (m->end != n->end)
+    return (m->end < n->end) ? -1 : 1;
+  return (m->errors > n->errors) - (m->errors < n->errors);
+}
+
+/* Lay out a scheme as a sequence of single-character search steps.
+ * The first part is searched to the left, the following parts in the
+ *  direction in which they lie relative to the parts already searched.
+ */
+static void PlanScheme(approx_search *search, const search_scheme *scheme,
+                       size_t *bounds, unsigned parts) {
+  size_t step = 0;
+  unsigned lowest = scheme->order[0], highest = scheme->order[0];
+
+  for (unsigned i = 0; i < parts; ++i) {
+    unsigned part = scheme->order[i];
+    int left = (i == 0 || part < lowest);
+    if (part < lowest)
+      lowest = part;
+    if (part > highest)
+      highest = part;
+
+    for (size_t j = 0; j < bounds[part + 1] - bounds[part]; ++j) {
+      size_t pos = (left) ? bounds[part + 1] - 1 - j : bounds[part] + j;
+      search->positions[step] = pos;
+      search->left[step] = left;
+      search->upper[step] = scheme->upper[i];
+      // The lower bound only applies once the part is complete.
+      search->lower[step] =
+          (j + 1 == bounds[part + 1] - bounds[part]) ? scheme->lower[i] : 0;
+      ++step;
+    }
+  }
+  search->steps = step;
+}
+
+/* Find all ranges in the F column of strings within max_errors of the
+ *  pattern, counting mismatches or, if edits is non-zero, edit operations.
+ * The index must have been constructed with a reverse index.
+ * On success *matches holds a newly allocated array of *match_count distinct
+ *  ranges, each with the lowest number of errors it was found with.
+ * Return 0 on memory allocation error or if the index is not bidirectional.
+ */
+int FMIndexApproxSearch(fm_index *fm, char *pattern, size_t pattern_sz,
+                        unsigned max_errors, int edits,
+                        fm_approx_match **matches, size_t *match_count) {
+  *matches = NULL;
+  *match_count = 0;
+  if (!fm->reverse || !pattern_sz)
+    return 0;
+
+  // Use the optimal schemes where known, and otherwise the pigeonhole
+  //  schemes: one part without errors followed by all others.
+  const search_scheme *schemes;
+  unsigned scheme_count, parts = max_errors + 1;
+  search_scheme pigeonhole[MAX_PARTS];
+  if (max_errors == 0) {
+    pigeonhole[0] = (search_scheme){{0}, {0}, {0}};
+    schemes = pigeonhole;
+    scheme_count = 1;
+  } else if (max_errors == 1) {
+    schemes = schemes_k1;
+    scheme_count = 2;
+  } else if (max_errors == 2) {
+    schemes = schemes_k2;
+    scheme_count = 3;
+  } else {
+    if (parts > MAX_PARTS)
+      return 0;
+    for (unsigned i = 0; i < parts; ++i) {
+      unsigned n = 0;
+      for (unsigned p = i; p < parts; ++p)
+        pigeonhole[i].order[n++] = p;
+      for (unsigned p = i; p > 0; --p)
+        pigeonhole[i].order[n++] = p - 1;
+      for (unsigned j = 0; j < parts; ++j) {
+        pigeonhole[i].lower[j] = 0;
+        pigeonhole[i].upper[j] = (j) ? max_errors : 0;
+      }
+    }
+    schemes = pigeonhole;
+    scheme_count = parts;
+  }
+
+  // Patterns shorter than the number of parts are searched as one part.
+  if (pattern_sz < parts) {
+    pigeonhole[0] = (search_scheme){{0}, {0}, {max_errors}};
+    schemes = pigeonhole;
+    scheme_count = 1;
+    parts = 1;
+  }
+
+  size_t bounds[MAX_PARTS + 1];
+  for (unsigned i = 0; i <= parts; ++i)
+    bounds[i] = pattern_sz * i / parts;
+
+  approx_search search = {0};
+  search.fm = fm;
+  search.edits = edits;
+  search.pattern = pattern;
+  search.positions = malloc(pattern_sz * sizeof(size_t));
+  search.left = malloc(pattern_sz * sizeof(int));
+  search.lower = malloc(pattern_sz * sizeof(unsigned));
+  search.upper = malloc(pattern_sz * sizeof(unsigned));
+  if (!search.positions || !search.left || !search.lower || !search.upper)
+    search.failed = 1;
+
+  bi_range all = {0, fm->bwt_sz, 0};
+  for (unsigned i = 0; i < scheme_count && !search.failed; ++i) {
+    PlanScheme(&search, &schemes[i], bounds, parts);
+    SearchStep(&search, all, 0, 0, 0);
+  }
+
+  free(search.positions);
+  free(search.left);
+  free(search.lower);
+  free(search.upper);
+  if (search.failed) {
+    free(search.matches);
+    return 0;
+  }
+
+  // Different schemes and alignments can find the same range.
+  if (search.match_count)
+    qsort(search.matches, search.match_count, sizeof(fm_approx_match),
+          &CompareMatch);
+  size_t n = 0;
+  for (size_t i = 0; i < search.match_count; ++i)
+    if (!n || search.matches[i].start != search.matches[n - 1].start ||
+        search.matches[i].end != search.matches[n - 1].end)
+      search.matches[n++] = search.matches[i];
+
+  *matches = search.matches;
+  *match_count = n;
+  return 1;
+}
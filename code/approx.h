@@ -0,0 +1,21 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+
+typedef struct fm_approx_match {
+  ranges_t start;
+  ranges_t end;
+  unsigned errors;
+} fm_approx_match;
+
+int FMIndexApproxSearch(fm_index *fm, char *pattern, size_t pattern_sz,
+                        unsigned max_errors, int edits,
+                        fm_approx_match **matches, size_t *match_count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,481 @@
+#include "backend.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Chunked host pipeline and a CPU stand-in for the FPGA kernels.
+ * The pipeline keeps every slot of a backend busy: chunks of patterns are
+ *  staged into free slots and submitted, and whenever the oldest chunk
+ *  completes its results are copied out and the slot is refilled with the
+ *  next chunk. Staging and readback of one slot thus overlap with the
+ *  computation of the others.
+ * The CPU backend runs the work groups of submitted chunks on a pool of
+ *  threads, in submission order. The unopt and memory kernels are a single
+ *  work item looping over all patterns of a chunk, so a chunk is one work
+ *  group. The ndrange and final kernels use a work item per pattern, so a
+ *  chunk is split into work groups of local_size patterns.
+ * With replicas, workers are pinned to NUMA nodes and search the replica of
+ *  their own node.
+ */
+
+#define MAX_ALPHABET_SZ 256
+
+typedef struct cpu_slot {
+  char *patterns;
+  unsigned pattern_count;
+  unsigned long *out;
+  unsigned group_count;
+  unsigned next_group;
+  unsigned groups_done;
+  int busy;
+  double start_time;
+  double end_time;
+} cpu_slot;
+
+typedef struct cpu_backend {
+  fm_index *fm;
+  fm_replicas *replicas;
+  fm_kernel_variant variant;
+  unsigned pattern_sz;
+  unsigned out_sz;
+  unsigned local_size;
+  pthread_t *threads;
+  unsigned thread_count;
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+  cpu_slot *slots;
+  unsigned slot_count;
+  unsigned *queue; // Slots with work groups left, in submission order.
+  unsigned queue_head;
+  unsigned queue_len;
+  int stop;
+} cpu_backend;
+
+typedef struct cpu_worker {
+  cpu_backend *backend;
+  unsigned node;
+} cpu_worker;
+
+static double WallTime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Linear alphabet search like the kernels, which assume c occurs in it.
+static int StringIndex(const char *alphabet, size_t alphabet_sz, char c) {
+  for (size_t i = 0; i < alphabet_sz; ++i)
+    if (alphabet[i] == c)
+      return i;
+  return -1;
+}
+
+/* Backward search of one pattern as done by a kernel work item, with the
+ *  given (global or private) copies of the alphabet and character ranges.
+ *  Matches beyond the out_sz slot are dropped instead of overflowing it.
+ */
+static void SearchPattern(cpu_backend *b, fm_index *fm, const char *alphabet,
+                          const ranges_t *ranges, const char *pattern,
+                          unsigned long *out) {
+  int p_idx = b->pattern_sz - 1;
+  int alphabet_idx = StringIndex(alphabet, fm->alphabet_sz, pattern[p_idx]);
+  unsigned start = 0, end = 0;
+  if (alphabet_idx >= 0) {
+    start = ranges[2 * alphabet_idx];
+    end = ranges[2 * alphabet_idx + 1];
+  }
+
+  p_idx -= 1;
+  while (p_idx >= 0 && end > 1) {
+    alphabet_idx = StringIndex(alphabet, fm->alphabet_sz, pattern[p_idx]);
+    if (alphabet_idx < 0) {
+      start = end = 0;
+      break;
+    }
+    unsigned range_start = ranges[2 * alphabet_idx];
+    start = range_start + FMIndexRank(fm, start - 1, alphabet_idx);
+    end = range_start + FMIndexRank(fm, end - 1, alphabet_idx);
+    p_idx -= 1;
+  }
+
+  unsigned long match_count = (end > start) ? end - start : 0;
+  out[0] = match_count;
+  if (match_count > b->out_sz - 1)
+    match_count = b->out_sz - 1;
+  for (unsigned long j = 0; j < match_count; ++j)
+    out[j + 1] = FMIndexSA(fm, start + j);
+}
+
+static void RunGroup(cpu_backend *b, fm_index *fm, cpu_slot *slot,
+                     unsigned group) {
+  char alphabet[MAX_ALPHABET_SZ];
+  ranges_t ranges[2 * MAX_ALPHABET_SZ];
+
+  switch (b->variant) {
+  case FM_KERNEL_UNOPT:
+    for (unsigned i = 0; i < slot->pattern_count; ++i)
+      SearchPattern(b, fm, fm->alphabet, fm->ranges,
+                    &slot->patterns[i * b->pattern_sz],
+                    &slot->out[i * b->out_sz]);
+    break;
+  case FM_KERNEL_MEMORY: {
+    // Private copies of the alphabet and ranges, and of each pattern.
+    char pattern[b->pattern_sz];
+    memcpy(alphabet, fm->alphabet, fm->alphabet_sz);
+    memcpy(ranges, fm->ranges, 2 * fm->alphabet_sz * sizeof(ranges_t));
+    for (unsigned i = 0; i < slot->pattern_count; ++i) {
+      memcpy(pattern, &slot->patterns[i * b->pattern_sz], b->pattern_sz);
+      SearchPattern(b, fm, alphabet, ranges, pattern,
+                    &slot->out[i * b->out_sz]);
+    }
+    break;
+  }
+  case FM_KERNEL_NDRANGE:
+  case FM_KERNEL_FINAL: {
+    unsigned first = group * b->local_size;
+    unsigned count = slot->pattern_count - first;
+    if (count > b->local_size)
+      count = b->local_size;
+
+    if (b->variant == FM_KERNEL_NDRANGE) {
+      for (unsigned i = first; i < first + count; ++i)
+        SearchPattern(b, fm, fm->alphabet, fm->ranges,
+                      &slot->patterns[i * b->pattern_sz],
+                      &slot->out[i * b->out_sz]);
+      break;
+    }
+
+    // Local copy of the patterns of the work group, and private copies of
+    //  the alphabet and ranges in every work item.
+    char local[count * b->pattern_sz];
+    memcpy(local, &slot->patterns[first * b->pattern_sz],
+           count * b->pattern_sz);
+    for (unsigned i = 0; i < count; ++i) {
+      memcpy(alphabet, fm->alphabet, fm->alphabet_sz);
+      memcpy(ranges, fm->ranges, 2 * fm->alphabet_sz * sizeof(ranges_t));
+      SearchPattern(b, fm, alphabet, ranges, &local[i * b->pattern_sz],
+                    &slot->out[(first + i) * b->out_sz]);
+    }
+    break;
+  }
+  }
+}
+
+static void *CPUWorker(void *arg) {
+  cpu_worker *worker = arg;
+  cpu_backend *b = worker->backend;
+  fm_index *fm = b->fm;
+  if (b->replicas) {
+    FMReplicasPinThread(b->replicas, worker->node);
+    fm = b->replicas->replicas[worker->node];
+  }
+  free(worker);
+  FM_TRACE_THREAD("pipeline worker");
+
+  pthread_mutex_lock(&b->lock);
+  for (;;) {
+    while (!b->queue_len && !b->stop)
+      pthread_cond_wait(&b->work_cond, &b->lock);
+    if (b->stop)
+      break;
+
+    unsigned slot_idx = b->queue[b->queue_head];
+    cpu_slot *slot = &b->slots[slot_idx];
+    unsigned group = slot->next_group++;
+    if (slot->next_group == slot->group_count) {
+      b->queue_head = (b->queue_head + 1) % b->slot_count;
+      --b->queue_len;
+    }
+    if (group == 0)
+      slot->start_time = WallTime();
+    pthread_mutex_unlock(&b->lock);
+
+    FM_TRACE_BEGIN(span);
+    RunGroup(b, fm, slot, group);
+    FM_TRACE_END(span, "kernel group", 0, 0);
+
+    pthread_mutex_lock(&b->lock);
+    if (++slot->groups_done == slot->group_count) {
+      slot->end_time = WallTime();
+      slot->busy = 0;
+      pthread_cond_broadcast(&b->done_cond);
+    }
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  return NULL;
+}
+
+static int CPUSubmit(fm_backend *backend, unsigned slot_idx, char *patterns,
+                     unsigned pattern_count, unsigned long *out) {
+  cpu_backend *b = backend->state;
+  cpu_slot *slot = &b->slots[slot_idx];
+
+  pthread_mutex_lock(&b->lock);
+  if (slot->busy) {
+    pthread_mutex_unlock(&b->lock);
+    return 0;
+  }
+
+  slot->patterns = patterns;
+  slot->pattern_count = pattern_count;
+  slot->out = out;
+  slot->group_count = 1;
+  if (b->variant == FM_KERNEL_NDRANGE || b->variant == FM_KERNEL_FINAL)
+    slot->group_count = (pattern_count + b->local_size - 1) / b->local_size;
+  slot->next_group = 0;
+  slot->groups_done = 0;
+  slot->start_time = slot->end_time = WallTime();
+
+  if (slot->group_count) {
+    slot->busy = 1;
+    b->queue[(b->queue_head + b->queue_len) % b->slot_count] = slot_idx;
+    ++b->queue_len;
+    pthread_cond_broadcast(&b->work_cond);
+  }
+  pthread_mutex_unlock(&b->lock);
+
+  return 1;
+}
+
+static int CPUWait(fm_backend *backend, unsigned slot_idx,
+                   double *device_time) {
+  cpu_backend *b = backend->state;
+  cpu_slot *slot = &b->slots[slot_idx];
+
+  pthread_mutex_lock(&b->lock);
+  while (slot->busy)
+    pthread_cond_wait(&b->done_cond, &b->lock);
+  *device_time = slot->end_time - slot->start_time;
+  pthread_mutex_unlock(&b->lock);
+
+  return 1;
+}
+
+static void CPUFree(fm_backend *backend) {
+  cpu_backend *b = backend->state;
+
+  pthread_mutex_lock(&b->lock);
+  b->stop = 1;
+  pthread_cond_broadcast(&b->work_cond);
+  pthread_mutex_unlock(&b->lock);
+  for (unsigned i = 0; i < b->thread_count; ++i)
+    pthread_join(b->threads[i], NULL);
+
+  pthread_mutex_destroy(&b->lock);
+  pthread_cond_destroy(&b->work_cond);
+  pthread_cond_destroy(&b->done_cond);
+  free(b->threads);
+  free(b->slots);
+  free(b->queue);
+  free(b);
+  free(backend);
+}
+
+static fm_backend *CreateCPU(fm_index *fm, fm_replicas *replicas,
+                             fm_kernel_variant variant, unsigned thread_count,
+                             unsigned slot_count, unsigned pattern_sz,
+                             unsigned out_sz, unsigned local_size) {
+  if (!thread_count || !slot_count || !out_sz || !local_size ||
+      fm->alphabet_sz > MAX_ALPHABET_SZ)
+    return NULL;
+
+  fm_backend *backend = calloc(1, sizeof(fm_backend));
+  cpu_backend *b = calloc(1, sizeof(cpu_backend));
+  if (!backend || !b) {
+    free(backend);
+    free(b);
+    return NULL;
+  }
+
+  b->fm = fm;
+  b->replicas = replicas;
+  b->variant = variant;
+  b->pattern_sz = pattern_sz;
+  b->out_sz = out_sz;
+  b->local_size = local_size;
+  pthread_mutex_init(&b->lock, NULL);
+  pthread_cond_init(&b->work_cond, NULL);
+  pthread_cond_init(&b->done_cond, NULL);
+
+  backend->name = "cpu";
+  backend->slot_count = slot_count;
+  backend->state = b;
+  backend->submit = CPUSubmit;
+  backend->wait = CPUWait;
+  backend->free = CPUFree;
+
+  // The queue holds every slot at most once.
+  b->slot_count = slot_count;
+  if (!(b->slots = calloc(slot_count, sizeof(cpu_slot))) ||
+      !(b->queue = calloc(slot_count, sizeof(unsigned))) ||
+      !(b->threads = calloc(thread_count, sizeof(pthread_t)))) {
+    CPUFree(backend);
+    return NULL;
+  }
+
+  for (unsigned i = 0; i < thread_count; ++i) {
+    cpu_worker *worker = malloc(sizeof(cpu_worker));
+    if (!worker) {
+      CPUFree(backend);
+      return NULL;
+    }
+    worker->backend = b;
+    worker->node =
+        (replicas) ? FMReplicasNodeOf(replicas, i, thread_count) : 0;
+    if (pthread_create(&b->threads[i], NULL, &CPUWorker, worker) != 0) {
+      free(worker);
+      CPUFree(backend);
+      return NULL;
+    }
+    ++b->thread_count;
+  }
+
+  return backend;
+}
+
+/* Create a backend that runs the given kernel variant on thread_count
+ *  threads, with slot_count chunks in flight. Patterns are pattern_sz
+ *  characters, every pattern gets out_sz output entries (like the kernel
+ *  argument of the same name), and the ndrange and final kernels use work
+ *  groups of local_size patterns.
+ * Return NULL on memory allocation or thread creation error.
+ */
+fm_backend *FMBackendCreateCPU(fm_index *fm, fm_kernel_variant variant,
+                               unsigned thread_count, unsigned slot_count,
+                               unsigned pattern_sz, unsigned out_sz,
+                               unsigned local_size) {
+  return CreateCPU(fm, NULL, variant, thread_count, slot_count, pattern_sz,
+                   out_sz, local_size);
+}
+
+/* Same as FMBackendCreateCPU, with the threads spread evenly over the nodes
+ *  of the replicas, pinned to their node and searching its replica.
+ */
+fm_backend *FMBackendCreateCPUReplicated(fm_replicas *replicas,
+                                         fm_kernel_variant variant,
+                                         unsigned thread_count,
+                                         unsigned slot_count,
+                                         unsigned pattern_sz, unsigned out_sz,
+                                         unsigned local_size) {
+  return CreateCPU(replicas->index, replicas, variant, thread_count,
+                   slot_count, pattern_sz, out_sz, local_size);
+}
+
+// Set variant to the kernel with the given file name. Return 0 if unknown.
+int FMKernelVariantFromName(const char *name, fm_kernel_variant *variant) {
+  const char *names[] = {"unopt", "memory", "ndrange", "final"};
+  for (unsigned i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+    if (strcmp(name, names[i]) == 0) {
+      *variant = i;
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Search all patterns on the backend in chunks of chunk_sz patterns, keeping
+ *  all slots of the backend busy. Results are written to out in the kernel
+ *  layout of out_sz entries per pattern, and timings to stats if not NULL.
+ * Return 0 on memory allocation or backend error, 1 otherwise.
+ */
+int FMPipelineRun(fm_backend *backend, char *patterns, unsigned pattern_count,
+                  unsigned pattern_sz, unsigned out_sz, unsigned chunk_sz,
+                  unsigned long *out, fm_pipeline_stats *stats) {
+  unsigned slot_count = backend->slot_count;
+  char **slot_patterns = calloc(slot_count, sizeof(char *));
+  unsigned long **slot_out = calloc(slot_count, sizeof(unsigned long *));
+  unsigned *slot_first = calloc(slot_count, sizeof(unsigned));
+  unsigned *slot_count_in = calloc(slot_count, sizeof(unsigned));
+  fm_pipeline_stats s = {0};
+  int ret = 0;
+
+  if (!slot_patterns || !slot_out || !slot_first || !slot_count_in ||
+      !chunk_sz)
+    goto cleanup;
+  for (unsigned i = 0; i < slot_count; ++i) {
+    if (!(slot_patterns[i] = malloc((size_t)chunk_sz * pattern_sz)) ||
+        !(slot_out[i] = malloc((size_t)chunk_sz * out_sz *
+                               sizeof(unsigned long))))
+      goto cleanup;
+  }
+
+  double start_time = WallTime(), t;
+  unsigned next = 0, in_flight = 0;
+
+  // Fill every slot, then refill slots in submission order as they finish.
+  for (unsigned slot = 0; next < pattern_count || in_flight;) {
+    if (slot_count_in[slot]) {
+      double device_time;
+      FM_TRACE_BEGIN(wait_span);
+      t = WallTime();
+      if (!backend->wait(backend, slot, &device_time))
+        goto cleanup;
+      s.wait_time += WallTime() - t;
+      s.compute_time += device_time;
+      FM_TRACE_END(wait_span, "pipeline wait", 0, 0);
+
+      FM_TRACE_BEGIN(readback_span);
+      t = WallTime();
+      memcpy(&out[(size_t)slot_first[slot] * out_sz], slot_out[slot],
+             (size_t)slot_count_in[slot] * out_sz * sizeof(unsigned long));
+      s.readback_time += WallTime() - t;
+      FM_TRACE_END(readback_span, "readback", 0, slot_count_in[slot]);
+      slot_count_in[slot] = 0;
+      --in_flight;
+    }
+
+    if (next < pattern_count) {
+      unsigned count = pattern_count - next;
+      if (count > chunk_sz)
+        count = chunk_sz;
+
+      FM_TRACE_BEGIN(transfer_span);
+      t = WallTime();
+      memcpy(slot_patterns[slot], &patterns[(size_t)next * pattern_sz],
+             (size_t)count * pattern_sz);
+      s.transfer_time += WallTime() - t;
+      FM_TRACE_END(transfer_span, "transfer", 0, count);
+
+      if (!backend->submit(backend, slot, slot_patterns[slot], count,
+                           slot_out[slot]))
+        goto cleanup;
+      slot_first[slot] = next;
+      slot_count_in[slot] = count;
+      next += count;
+      ++in_flight;
+      ++s.chunk_count;
+    }
+
+    slot = (slot + 1) % slot_count;
+  }
+
+  s.wall_time = WallTime() - start_time;
+  if (stats)
+    *stats = s;
+  ret = 1;
+
+cleanup:
+  // Chunks still in flight after an error must finish before their staging
+  //  buffers are freed.
+  for (unsigned i = 0; slot_count_in && i < slot_count; ++i) {
+    double device_time;
+    if (slot_count_in[i])
+      backend->wait(backend, i, &device_time);
+  }
+  for (unsigned i = 0; i < slot_count; ++i) {
+    if (slot_patterns)
+      free(slot_patterns[i]);
+    if (slot_out)
+      free(slot_out[i]);
+  }
+  free(slot_patterns);
+  free(slot_out);
+  free(slot_first);
+  free(slot_count_in);
+  return ret;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+#include "replicas.h"
+
+// Variants of the FPGA kernels in fpga/, which the CPU backend mimics.
+typedef enum fm_kernel_variant {
+  FM_KERNEL_UNOPT,
+  FM_KERNEL_MEMORY,
+  FM_KERNEL_NDRANGE,
+  FM_KERNEL_FINAL,
+} fm_kernel_variant;
+
+/* Device that searches chunks of equally sized patterns.
+ * Every chunk is written in the kernel output layout: slot i of out_sz
+ *  entries holds the match count of pattern i followed by its positions.
+ * A device has a fixed number of slots, each holding one chunk in flight.
+ *  submit starts a chunk in a free slot without waiting for it, and wait
+ *  blocks until the chunk in a slot is done and sets the time the chunk
+ *  spent in the device. Both return 0 on error.
+ */
+typedef struct fm_backend fm_backend;
+struct fm_backend {
+  const char *name;
+  unsigned slot_count;
+  void *state;
+  int (*submit)(fm_backend *backend, unsigned slot, char *patterns,
+                unsigned pattern_count, unsigned long *out);
+  int (*wait)(fm_backend *backend, unsigned slot, double *device_time);
+  void (*free)(fm_backend *backend);
+};
+
+typedef struct fm_pipeline_stats {
+  double wall_time;     // Total time of the pipeline.
+  double transfer_time; // Time spent staging chunks into slots.
+  double compute_time;  // Sum of the time chunks spent in the device.
+  double readback_time; // Time spent copying results out of slots.
+  double wait_time;     // Time the host was blocked on the device.
+  unsigned chunk_count;
+} fm_pipeline_stats;
+
+fm_backend *FMBackendCreateCPU(fm_index *fm, fm_kernel_variant variant,
+                               unsigned thread_count, unsigned slot_count,
+                               unsigned pattern_sz, unsigned out_sz,
+                               unsigned local_size);
+fm_backend *FMBackendCreateCPUReplicated(fm_replicas *replicas,
+                                         fm_kernel_variant variant,
+                                         unsigned thread_count,
+                                         unsigned slot_count,
+                                         unsigned pattern_sz, unsigned out_sz,
+                                         unsigned local_size);
+int FMKernelVariantFromName(const char *name, fm_kernel_variant *variant);
+
+int FMPipelineRun(fm_backend *backend, char *patterns, unsigned pattern_count,
+                  unsigned pattern_sz, unsigned out_sz, unsigned chunk_sz,
+                  unsigned long *out, fm_pipeline_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,8 +1,16 @@
 #define _GNU_SOURCE
 
+#include "adaptive.h"
+#include "approx.h"
+#include "backend.h"
 #include "fmindex.h"
+#include "hits.h"
+#include "locate.h"
 #include "rapl.h"
+#include "rlindex.h"
+#include "trace.h"
 #include "util.h"
+#include "wildcard.h"
 
 #include <stdio.h>
 #include <stdlib.h>
@@ -14,14 +22,40 @@
 unsigned pattern_count, pattern_sz, max_match_count;
 char *patterns;
 fm_index *fm;
-float total_time;
+rl_index *rl;
+float total_time, locate_time;
 unsigned long total_matches = 0;
 unsigned long *match_indices;
+unsigned long lf_steps = 0, lf_steps_saved = 0;
+#define APPROX_MAX_ERRORS 2
+float approx_qps[APPROX_MAX_ERRORS + 1];
+fm_locate_pool *locate_pool;
+double *locate_latency[2];
+ranges_t *locate_hits;
+fm_backend *backend;
+fm_replicas *replicas;
+fm_pipeline_stats pipeline_stats;
+unsigned pipeline_chunk_sz = 4096;
+unsigned wildcard_count = 2;
+size_t wildcard_max_nodes = 0;
+float expansion_time;
+unsigned long wildcard_nodes, expansion_count, wildcard_truncated;
+size_t hits_chunk_sz = FM_HITS_CHUNK_SZ;
+float raw_time;
+unsigned long encoded_bytes, text_bytes;
+fm_adaptive_config adaptive_config = {FM_ADAPTIVE_MIN_ENERGY, 0., 0, 64, 65536,
+                                      0.1, NULL, NULL, NULL};
+unsigned adaptive_passes = 10;
+fm_adaptive_stats adaptive_stats;
+float single_symbol_time;
+// Work group size of the ndrange and final kernels (LOCAL_SIZE in final.cl).
+#define PIPELINE_LOCAL_SIZE 300
 
 static void benchmark(void) {
   float time1 = 0., time2 = 0.;
   float start_time, end_time;
   for (unsigned i = 0; i < pattern_count; ++i) {
+    FM_TRACE_PATTERN(i);
     ranges_t start, end;
     start_time = (float)clock() / CLOCKS_PER_SEC;
     FMIndexFindMatchRange(fm, &patterns[i * pattern_sz], pattern_sz, &start,
@@ -38,19 +72,581 @@ static void benchmark(void) {
   }
 
   total_time = time1 + time2;
+  locate_time = time2;
+}
+
+// Search all patterns as a single batch, sharing LF steps of common suffixes.
+static void benchmark_batch(void) {
+  float time1 = 0., time2 = 0.;
+  float start_time, end_time;
+  ranges_t *starts = calloc(pattern_count, sizeof(ranges_t));
+  ranges_t *ends = calloc(pattern_count, sizeof(ranges_t));
+  if (!starts || !ends) {
+    fprintf(stderr, "Failed to allocate memory for batch ranges.\n");
+    exit(1);
+  }
+
+  start_time = (float)clock() / CLOCKS_PER_SEC;
+  if (!FMIndexFindMatchRangeBatch(fm, patterns, pattern_count, pattern_sz,
+                                  starts, ends, &lf_steps, &lf_steps_saved)) {
+    fprintf(stderr, "Failed to allocate memory for batch search.\n");
+    exit(1);
+  }
+  end_time = (float)clock() / CLOCKS_PER_SEC;
+  time1 += end_time - start_time;
+
+  // Matches of all patterns are written densely after a prefix sum of the
+  //  match counts, instead of into a worst-case sized slot per pattern.
+  unsigned long *offsets, *positions;
+  start_time = (float)clock() / CLOCKS_PER_SEC;
+  if (!FMIndexFindRangeIndicesBatch(fm, starts, ends, pattern_count, &offsets,
+                                    &positions)) {
+    fprintf(stderr, "Failed to allocate memory for batch matches.\n");
+    exit(1);
+  }
+  end_time = (float)clock() / CLOCKS_PER_SEC;
+  time2 += end_time - start_time;
+
+  total_matches += offsets[pattern_count];
+  free(offsets);
+  free(positions);
+
+  total_time = time1 + time2;
+  free(starts);
+  free(ends);
+}
+
+// Search all patterns stepping over pairs of characters, and then again
+//  with single characters on the same index, which must find the same
+//  ranges. Empty ranges may be placed differently, as each path stops at
+//  its own point once the range is empty. Both searches run once untimed
+//  first, so neither is timed on a cold cache.
+static void benchmark_pairs(void) {
+  float start_time, end_time;
+  ranges_t *starts = calloc(2 * pattern_count, sizeof(ranges_t));
+  ranges_t *ends = calloc(2 * pattern_count, sizeof(ranges_t));
+  if (!starts || !ends) {
+    fprintf(stderr, "Failed to allocate memory for pair ranges.\n");
+    exit(1);
+  }
+
+  fm_pair_occ *pair_occ = fm->pair_occ;
+  float times[2];
+  for (unsigned pass = 0; pass < 4; ++pass) {
+    fm->pair_occ = (pass % 2 == 0) ? pair_occ : NULL;
+    ranges_t *s = &starts[pass % 2 * pattern_count];
+    ranges_t *e = &ends[pass % 2 * pattern_count];
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    for (unsigned i = 0; i < pattern_count; ++i) {
+      FM_TRACE_PATTERN(i);
+      FMIndexFindMatchRange(fm, &patterns[i * pattern_sz], pattern_sz, &s[i],
+                            &e[i]);
+    }
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    times[pass % 2] = end_time - start_time;
+  }
+  fm->pair_occ = pair_occ;
+
+  for (unsigned i = 0; i < pattern_count; ++i) {
+    ranges_t count = ends[i] - starts[i];
+    if (count != ends[pattern_count + i] - starts[pattern_count + i] ||
+        (count && starts[i] != starts[pattern_count + i])) {
+      fprintf(stderr, "Pair and single character search differ on pattern "
+                      "%u.\n",
+              i);
+      exit(1);
+    }
+    total_matches += count;
+  }
+
+  total_time = times[0];
+  single_symbol_time = times[1];
+  free(starts);
+  free(ends);
+}
+
+// Find the documents holding each pattern instead of its positions.
+static void benchmark_documents(void) {
+  float time1 = 0., time2 = 0.;
+  float start_time, end_time;
+  for (unsigned i = 0; i < pattern_count; ++i) {
+    FM_TRACE_PATTERN(i);
+    ranges_t start, end;
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    FMIndexFindMatchRange(fm, &patterns[i * pattern_sz], pattern_sz, &start,
+                          &end);
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    time1 += end_time - start_time;
+
+    fm_document *documents;
+    size_t document_count;
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    if (!FMIndexListDocuments(fm, start, end, &documents, &document_count)) {
+      fprintf(stderr, "Failed to list documents.\n");
+      exit(1);
+    }
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    time2 += end_time - start_time;
+
+    total_matches += document_count;
+    free(documents);
+  }
+
+  total_time = time1 + time2;
+}
+
+// Same as benchmark, on a run-length compressed index.
+static void benchmark_rl(void) {
+  float time1 = 0., time2 = 0.;
+  float start_time, end_time;
+  for (unsigned i = 0; i < pattern_count; ++i) {
+    ranges_t start, end;
+    sa_t toehold;
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    RLIndexFindMatchRange(rl, &patterns[i * pattern_sz], pattern_sz, &start,
+                          &end, &toehold);
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    time1 += end_time - start_time;
+
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    RLIndexFindRangeIndices(rl, start, end, toehold, &match_indices);
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    time2 += end_time - start_time;
+
+    total_matches += end - start;
+  }
+
+  total_time = time1 + time2;
+}
+
+static double WallTime(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* Locate the matches of each pattern on the calling thread in suffix order,
+ *  and with the thread pool in text order. Wall-clock latencies are kept per
+ *  pattern, since CPU time adds up the time of all threads.
+ */
+static void benchmark_locate(void) {
+  double start_time = WallTime();
+  for (unsigned i = 0; i < pattern_count; ++i) {
+    FM_TRACE_PATTERN(i);
+    ranges_t start, end;
+    FMIndexFindMatchRange(fm, &patterns[i * pattern_sz], pattern_sz, &start,
+                          &end);
+
+    double t0 = WallTime();
+    FMIndexFindRangeIndices(fm, start, end, &match_indices);
+    double t1 = WallTime();
+    unsigned long *positions;
+    size_t position_count;
+    if (!FMIndexLocate(fm, locate_pool, &start, &end, 1, 1, &positions,
+                       &position_count)) {
+      fprintf(stderr, "Failed to allocate memory for locate.\n");
+      exit(1);
+    }
+    double t2 = WallTime();
+    free(positions);
+
+    locate_latency[0][i] = t1 - t0;
+    locate_latency[1][i] = t2 - t1;
+    locate_hits[i] = end - start;
+    total_matches += end - start;
+  }
+  total_time = WallTime() - start_time;
+}
+
+/* Search all patterns in chunks on the CPU stand-in for the FPGA kernels,
+ *  with several chunks in flight.
+ */
+static void benchmark_pipeline(void) {
+  unsigned long *out =
+      malloc((size_t)pattern_count * (max_match_count + 1) *
+             sizeof(unsigned long));
+  if (!out || !FMPipelineRun(backend, patterns, pattern_count, pattern_sz,
+                             max_match_count + 1, pipeline_chunk_sz, out,
+                             &pipeline_stats)) {
+    fprintf(stderr, "Pipeline failed.\n");
+    exit(1);
+  }
+
+  for (unsigned i = 0; i < pattern_count; ++i)
+    total_matches += out[(size_t)i * (max_match_count + 1)];
+  total_time = pipeline_stats.wall_time;
+  free(out);
+}
+
+// Search all patterns with up to 0, 1 and 2 mismatches using search schemes.
+static void benchmark_approx(void) {
+  float start_time, end_time;
+  total_time = 0.;
+
+  for (unsigned k = 0; k <= APPROX_MAX_ERRORS; ++k) {
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    for (unsigned i = 0; i < pattern_count; ++i) {
+      FM_TRACE_PATTERN(i);
+      fm_approx_match *matches;
+      size_t match_count;
+      if (!FMIndexApproxSearch(fm, &patterns[i * pattern_sz], pattern_sz, k, 0,
+                               &matches, &match_count)) {
+        fprintf(stderr, "Approximate search failed.\n");
+        exit(1);
+      }
+      for (size_t j = 0; j < match_count; ++j)
+        total_matches += matches[j].end - matches[j].start;
+      free(matches);
+    }
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+
+    approx_qps[k] = pattern_count / (end_time - start_time);
+    total_time += end_time - start_time;
+  }
+}
+
+// Search every instantiation of the pattern from position pos on separately.
+static void SearchExpansions(fm_pattern *pattern, size_t pos, char *s,
+                             unsigned long *matches) {
+  if (pos == pattern->length) {
+    ranges_t start, end;
+    FMIndexFindMatchRange(fm, s, pattern->length, &start, &end);
+    *matches += end - start;
+    ++expansion_count;
+    return;
+  }
+  for (size_t c = 0; c < fm->alphabet_sz; ++c) {
+    if (FMPatternHas(pattern, pos, c)) {
+      s[pos] = fm->alphabet[c];
+      SearchExpansions(pattern, pos + 1, s, matches);
+    }
+  }
+}
+
+// Replace wildcard_count evenly spaced positions of every pattern with
+//  wildcards, and search it with the pruned traversal and by searching every
+//  expansion separately.
+static void benchmark_wildcard(void) {
+  char query[2 * pattern_sz + 1], expansion[pattern_sz];
+  unsigned long expansion_matches = 0;
+  float start_time, end_time;
+  total_time = expansion_time = 0.;
+
+  for (unsigned i = 0; i < pattern_count; ++i) {
+    FM_TRACE_PATTERN(i);
+    char *p = &patterns[i * pattern_sz];
+    size_t len = 0;
+    for (size_t j = 0, w = 0; j < pattern_sz; ++j) {
+      if (w < wildcard_count &&
+          j == (2 * w + 1) * pattern_sz / (2 * wildcard_count)) {
+        query[len++] = '?';
+        ++w;
+        continue;
+      }
+      if (p[j] == '?' || p[j] == '[' || p[j] == '\\')
+        query[len++] = '\\';
+      query[len++] = p[j];
+    }
+    query[len] = '\0';
+
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    fm_pattern pattern;
+    fm_pattern_range *ranges;
+    size_t range_count, nodes;
+    int ret = 0;
+    if (FMPatternParse(fm, query, &pattern))
+      ret = FMIndexPatternSearch(fm, &pattern, wildcard_max_nodes, &ranges,
+                                 &range_count, &nodes);
+    if (!ret) {
+      fprintf(stderr, "Wildcard search failed.\n");
+      exit(1);
+    }
+    for (size_t j = 0; j < range_count; ++j)
+      total_matches += ranges[j].end - ranges[j].start;
+    free(ranges);
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    total_time += end_time - start_time;
+    wildcard_nodes += nodes;
+    wildcard_truncated += (ret < 0);
+
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    SearchExpansions(&pattern, 0, expansion, &expansion_matches);
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    expansion_time += end_time - start_time;
+    FMPatternFree(&pattern);
+  }
+
+  if (!wildcard_truncated && expansion_matches != total_matches) {
+    fprintf(stderr, "Wildcard search found %lu matches, expansion %lu.\n",
+            total_matches, expansion_matches);
+    exit(1);
+  }
+}
+
+typedef struct hit_sink {
+  uint8_t *data;
+  size_t sz;
+  size_t capacity;
+} hit_sink;
+
+static int AppendHits(void *arg, const uint8_t *data, size_t sz) {
+  hit_sink *sink = arg;
+  if (sink->sz + sz > sink->capacity) {
+    size_t capacity = 2 * (sink->sz + sz);
+    uint8_t *p = realloc(sink->data, capacity);
+    if (!p)
+      return 0;
+    sink->data = p;
+    sink->capacity = capacity;
+  }
+  memcpy(sink->data + sink->sz, data, sz);
+  sink->sz += sz;
+  return 1;
+}
+
+// Number of characters printf("%lu ") takes for the position.
+static unsigned TextBytes(unsigned long pos) {
+  unsigned digits = 1;
+  for (; pos >= 10; pos /= 10)
+    ++digits;
+  return digits + 1;
+}
+
+/* Hand the positions of every pattern to a consumer, once as raw unsigned
+ *  longs and once as a compressed stream located, encoded and decoded chunk
+ *  by chunk. The times include locating.
+ */
+static void benchmark_hits(void) {
+  hit_sink sink = {0};
+  unsigned long *raw = malloc(max_match_count * sizeof(unsigned long));
+  unsigned long *decoded = NULL;
+  size_t capacity = 0;
+  float start_time, end_time;
+  total_time = raw_time = 0.;
+
+  for (unsigned i = 0; i < pattern_count; ++i) {
+    FM_TRACE_PATTERN(i);
+    ranges_t start, end;
+    FMIndexFindMatchRange(fm, &patterns[i * pattern_sz], pattern_sz, &start,
+                          &end);
+    total_matches += end - start;
+
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    FMIndexFindRangeIndices(fm, start, end, &match_indices);
+    memcpy(raw, match_indices, (end - start) * sizeof(unsigned long));
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    raw_time += end_time - start_time;
+    for (ranges_t j = 0; j < end - start; ++j)
+      text_bytes += TextBytes(raw[j]);
+
+    start_time = (float)clock() / CLOCKS_PER_SEC;
+    sink.sz = 0;
+    if (!FMIndexLocateEncoded(fm, start, end, hits_chunk_sz, &AppendHits,
+                              &sink)) {
+      fprintf(stderr, "Encoding hits failed.\n");
+      exit(1);
+    }
+    size_t pos = 0, count, decoded_count = 0, used;
+    do {
+      if (!(used = FMHitsDecode(sink.data + pos, sink.sz - pos, &decoded,
+                                &count, &capacity))) {
+        fprintf(stderr, "Decoding hits failed.\n");
+        exit(1);
+      }
+      pos += used;
+      decoded_count += count;
+    } while (count);
+    end_time = (float)clock() / CLOCKS_PER_SEC;
+    total_time += end_time - start_time;
+    encoded_bytes += sink.sz;
+
+    if (decoded_count != end - start) {
+      fprintf(stderr, "Decoded %lu of %u hits.\n", decoded_count,
+              end - start);
+      exit(1);
+    }
+  }
+
+  free(raw);
+  free(decoded);
+  free(sink.data);
+}
+
+static int ReadRapl(void *arg, double *package_joules, double *dram_joules) {
+  return rapl_read(arg, package_joules, dram_joules);
+}
+
+/* Search all patterns adaptive_passes times, letting the adaptive search
+ *  tune the worker count and batch size from the energy counters.
+ */
+static void benchmark_adaptive(void) {
+  static rapl_counters counters;
+  if (rapl_open(&counters) == 0) {
+    adaptive_config.read_energy = ReadRapl;
+    adaptive_config.energy_arg = &counters;
+  } else
+    fprintf(stderr, "No RAPL energy counters, maximizing throughput.\n");
+
+  fm_adaptive *adaptive = FMAdaptiveCreate(fm, &adaptive_config);
+  if (!adaptive) {
+    fprintf(stderr, "Failed to create adaptive search.\n");
+    exit(1);
+  }
+  for (unsigned pass = 0; pass < adaptive_passes; ++pass) {
+    if (!FMAdaptiveSearch(adaptive, patterns, pattern_count, pattern_sz)) {
+      fprintf(stderr, "Adaptive search failed.\n");
+      exit(1);
+    }
+  }
+  FMAdaptiveGetStats(adaptive, &adaptive_stats);
+  FMAdaptiveFree(adaptive);
+
+  total_matches = adaptive_stats.matches;
+  total_time = adaptive_stats.seconds;
 }
 
 int main(int argc, char **argv) {
   if (argc < 3) {
-    fprintf(stderr, "Usage: $ %s <FMFILE> <TESTFILE>\n", argv[0]);
+    fprintf(stderr, "Usage: $ %s <FMFILE> <TESTFILE> [MODE]\n", argv[0]);
+    fprintf(stderr,
+            "       $ %s <FMFILE> <TESTFILE> pipeline [KERNEL] [CHUNKSIZE] "
+            "[SLOTS]\n",
+            argv[0]);
+    fprintf(stderr,
+            "       $ %s <FMFILE> <TESTFILE> numa [NODES] [INTERLEAVE]\n",
+            argv[0]);
+    fprintf(stderr,
+            "       $ %s <FMFILE> <TESTFILE> wildcard [WILDCARDS] "
+            "[MAXNODES]\n",
+            argv[0]);
+    fprintf(stderr, "       $ %s <FMFILE> <TESTFILE> hits [CHUNKSIZE]\n",
+            argv[0]);
+    fprintf(stderr,
+            "       $ %s <FMFILE> <TESTFILE> adaptive [GOAL] [WATTS] "
+            "[PASSES] [LOGFILE]\n",
+            argv[0]);
+    fprintf(stderr,
+            "MODE is one of: single (default), batch, filter, approx, rl, "
+            "documents, packed, hybrid, locate, pipeline, numa, wildcard, "
+            "hits,\nadaptive, pairs\n");
+    fprintf(stderr, "The rl mode expects an index built with construct -R.\n");
+    fprintf(stderr, "The pipeline mode runs the unopt, memory, ndrange or "
+                    "final (default) kernel\non the CPU, with chunks of 4096 "
+                    "patterns in 2 slots by default.\n");
+    fprintf(stderr, "The numa mode runs the pipeline with threads pinned to "
+                    "NODES (default all)\nnodes, each searching a replica "
+                    "on its node, or an interleaved index if\nINTERLEAVE is "
+                    "1. Nodes beyond those of the machine are simulated.\n");
+    fprintf(stderr, "The hybrid mode searches with hybrid occurrence "
+                    "structures instead of the\nrank matrix and prints their "
+                    "space next to that of the rank matrix.\n");
+    fprintf(stderr, "The locate mode prints the number of matches and the "
+                    "inline and parallel\nsorted locate latency of each "
+                    "pattern, see plot_locate.py.\n");
+    fprintf(stderr, "The wildcard mode replaces WILDCARDS (default 2) "
+                    "positions of each pattern\nwith wildcards and compares "
+                    "the pruned search, exploring at most MAXNODES\nnodes "
+                    "(default unlimited), with searching every expansion.\n");
+    fprintf(stderr, "The hits mode compares handing over located positions "
+                    "as unsigned longs\nwith compressed streams encoded in "
+                    "chunks of CHUNKSIZE (default 65536)\npositions.\n");
+    fprintf(stderr, "The adaptive mode searches the patterns PASSES (default "
+                    "10) times, tuning\nthe worker count and batch size "
+                    "towards GOAL, which is energy (default) for\nthe most "
+                    "queries per joule or throughput for the most queries "
+                    "per second\nwithin WATTS (default unlimited). Each "
+                    "window is logged to LOGFILE\n(default standard "
+                    "error).\n");
+    fprintf(stderr, "The pairs mode compares search stepping over pairs of "
+                    "characters, stored\nby construct -2 or built on load, "
+                    "with single character steps.\n");
+    fprintf(stderr, "With FM_TRACE_FILE set, a Chrome trace of the run is "
+                    "written to that file,\nif built with make TRACE=1.\n");
+    return 1;
+  }
+
+  // Trace from the index load on.
+  FM_TRACE_THREAD("main");
+  char *trace_file = getenv("FM_TRACE_FILE");
+  if (trace_file && !FMTraceStart()) {
+    fprintf(stderr, "Tracing needs a build with make TRACE=1.\n");
     return 1;
   }
 
-  fm = FMIndexReadFromFile(argv[1], 0);
-  if (!fm) {
+  char *mode = (argc > 3) ? argv[3] : "single";
+  void (*func)(void);
+  if (strcmp(mode, "single") == 0)
+    func = benchmark;
+  else if (strcmp(mode, "batch") == 0)
+    func = benchmark_batch;
+  else if (strcmp(mode, "filter") == 0 || strcmp(mode, "packed") == 0 ||
+           strcmp(mode, "hybrid") == 0)
+    func = benchmark;
+  else if (strcmp(mode, "approx") == 0)
+    func = benchmark_approx;
+  else if (strcmp(mode, "rl") == 0)
+    func = benchmark_rl;
+  else if (strcmp(mode, "documents") == 0)
+    func = benchmark_documents;
+  else if (strcmp(mode, "locate") == 0)
+    func = benchmark_locate;
+  else if (strcmp(mode, "pipeline") == 0 || strcmp(mode, "numa") == 0)
+    func = benchmark_pipeline;
+  else if (strcmp(mode, "wildcard") == 0)
+    func = benchmark_wildcard;
+  else if (strcmp(mode, "hits") == 0)
+    func = benchmark_hits;
+  else if (strcmp(mode, "adaptive") == 0)
+    func = benchmark_adaptive;
+  else if (strcmp(mode, "pairs") == 0)
+    func = benchmark_pairs;
+  else {
+    fprintf(stderr, "Unknown benchmark mode \"%s\".\n", mode);
+    return 1;
+  }
+
+  if (func == benchmark_rl)
+    rl = RLIndexReadFromFile(argv[1]);
+  else
+    fm = FMIndexReadFromFile(argv[1], 0);
+  if (!fm && !rl) {
     fprintf(stderr, "Failed to read FM-index from file.\n");
     return 1;
   }
+  if (func == benchmark_approx && !fm->reverse) {
+    fprintf(stderr, "Approximate search needs an index built with -r.\n");
+    return 1;
+  }
+  if (func == benchmark_documents && !fm->doc_starts) {
+    fprintf(stderr, "Document listing needs an index of multiple files.\n");
+    return 1;
+  }
+
+  // Bytes per character of the dense rank matrix and of the bitvectors and
+  //  Elias-Fano lists replacing it, and the number of bitvectors.
+  double dense_bpc = 0., bitvector_bpc = 0., elias_fano_bpc = 0.;
+  unsigned bitvector_count = 0;
+  if (strcmp(mode, "hybrid") == 0) {
+    dense_bpc = (double)fm->alphabet_sz * sizeof(ranks_t);
+    if (!FMIndexBuildHybridOcc(fm)) {
+      fprintf(stderr, "Failed to build hybrid occurrence structures.\n");
+      return 1;
+    }
+    for (size_t c = 0; c < fm->alphabet_sz; ++c) {
+      double bpc = (double)FMOccSymbolBytes(fm->occ, c) / fm->bwt_sz;
+      if (fm->occ->symbols[c].kind == FM_OCC_BITVECTOR) {
+        bitvector_bpc += bpc;
+        ++bitvector_count;
+      } else
+        elias_fano_bpc += bpc;
+    }
+  }
+
+  if (func == benchmark_pairs && !fm->pair_occ && !FMIndexBuildPairOcc(fm)) {
+    fprintf(stderr, "Failed to build pair occurrences, the alphabet may be "
+                    "too large.\n");
+    return 1;
+  }
 
   if (!(LoadTestData(argv[2], &patterns, &pattern_count, &pattern_sz,
                      &max_match_count, 0))) {
@@ -64,16 +660,191 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  if (strcmp(mode, "numa") == 0) {
+    unsigned nodes = FMReplicasNodeCount();
+    if (argc > 4)
+      nodes = atoi(argv[4]);
+    int interleave = (argc > 5) ? atoi(argv[5]) : 0;
+    replicas = FMReplicasCreate(fm, nodes, interleave);
+    if (!replicas) {
+      fprintf(stderr, "Failed to replicate FM-index.\n");
+      return 1;
+    }
+    backend = FMBackendCreateCPUReplicated(
+        replicas, FM_KERNEL_FINAL, sysconf(_SC_NPROCESSORS_ONLN), 2,
+        pattern_sz, max_match_count + 1, PIPELINE_LOCAL_SIZE);
+    if (!backend) {
+      fprintf(stderr, "Failed to create CPU backend.\n");
+      return 1;
+    }
+  } else if (func == benchmark_pipeline) {
+    fm_kernel_variant variant = FM_KERNEL_FINAL;
+    if (argc > 4 && !FMKernelVariantFromName(argv[4], &variant)) {
+      fprintf(stderr, "Unknown kernel \"%s\".\n", argv[4]);
+      return 1;
+    }
+    if (argc > 5)
+      pipeline_chunk_sz = atoi(argv[5]);
+    unsigned slots = (argc > 6) ? atoi(argv[6]) : 2;
+    backend = FMBackendCreateCPU(fm, variant, sysconf(_SC_NPROCESSORS_ONLN),
+                                 slots, pattern_sz, max_match_count + 1,
+                                 PIPELINE_LOCAL_SIZE);
+    if (!backend || !pipeline_chunk_sz) {
+      fprintf(stderr, "Failed to create CPU backend.\n");
+      return 1;
+    }
+  }
+
+  if (func == benchmark_wildcard) {
+    if (argc > 4)
+      wildcard_count = atoi(argv[4]);
+    if (argc > 5)
+      wildcard_max_nodes = strtoul(argv[5], NULL, 10);
+  }
+
+  if (func == benchmark_hits && argc > 4 &&
+      !(hits_chunk_sz = strtoul(argv[4], NULL, 10))) {
+    fprintf(stderr, "Invalid chunk size.\n");
+    return 1;
+  }
+
+  if (func == benchmark_adaptive) {
+    if (argc > 4 && strcmp(argv[4], "throughput") == 0)
+      adaptive_config.goal = FM_ADAPTIVE_MAX_THROUGHPUT;
+    else if (argc > 4 && strcmp(argv[4], "energy") != 0) {
+      fprintf(stderr, "Unknown goal \"%s\".\n", argv[4]);
+      return 1;
+    }
+    if (argc > 5)
+      adaptive_config.power_budget = atof(argv[5]);
+    if (argc > 6)
+      adaptive_passes = atoi(argv[6]);
+    adaptive_config.log = stderr;
+    if (argc > 7 && !(adaptive_config.log = fopen(argv[7], "w"))) {
+      fprintf(stderr, "Could not open log file.\n");
+      return 1;
+    }
+  }
+
+  if (func == benchmark_locate) {
+    locate_latency[0] = calloc(pattern_count, sizeof(double));
+    locate_latency[1] = calloc(pattern_count, sizeof(double));
+    locate_hits = calloc(pattern_count, sizeof(ranges_t));
+    locate_pool = FMLocatePoolCreate(sysconf(_SC_NPROCESSORS_ONLN));
+    if (!locate_latency[0] || !locate_latency[1] || !locate_hits ||
+        !locate_pool) {
+      fprintf(stderr, "Failed to set up parallel locate.\n");
+      return 1;
+    }
+  }
+
   double total_joules;
-  if (rapl_sysfs(benchmark, &total_joules) != 0) {
+  if (func == benchmark_adaptive) {
+    // The adaptive search samples RAPL itself and runs without it, so its
+    //  package energy is reported in the microjoules of rapl_sysfs.
+    func();
+    total_joules = adaptive_stats.package_joules * 1e6;
+  } else if (rapl_sysfs(func, &total_joules) != 0) {
     fprintf(stderr, "Failed to get energy consumption\n");
     return 1;
   }
 
-  printf("%a %a %lu\n", total_time, total_joules, total_matches);
+  if (func == benchmark_batch) {
+    // Fraction of LF steps that were shared with another pattern.
+    unsigned long total_steps = lf_steps + lf_steps_saved;
+    double saved = total_steps ? (double)lf_steps_saved / total_steps : 0.;
+    printf("%a %a %lu %a\n", total_time, total_joules, total_matches, saved);
+  } else if (strcmp(mode, "filter") == 0) {
+    // Fraction of patterns rejected without rank lookups. Compare against an
+    //  index built without a q-gram filter to see the effect on total_time.
+    unsigned long rejected = 0;
+    for (unsigned i = 0; i < pattern_count; ++i)
+      rejected += FMIndexQGramFilterRejects(fm, &patterns[i * pattern_sz],
+                                            pattern_sz);
+    printf("%a %a %lu %a\n", total_time, total_joules, total_matches,
+           (double)rejected / pattern_count);
+  } else if (strcmp(mode, "packed") == 0) {
+    // Index bytes per text character and located matches per second. Compare
+    //  an index built with construct -p against one built without.
+    double bytes_per_char = (double)FMIndexSize(fm) / fm->bwt_sz;
+    double locate_rate = locate_time > 0 ? total_matches / locate_time : 0.;
+    printf("%a %a %lu %a %a\n", total_time, total_joules, total_matches,
+           bytes_per_char, locate_rate);
+  } else if (strcmp(mode, "hybrid") == 0) {
+    // Compare total_time against the single mode on the same index.
+    printf("%a %a %lu %a %a %a %u\n", total_time, total_joules, total_matches,
+           dense_bpc, bitvector_bpc, elias_fano_bpc, bitvector_count);
+  } else if (func == benchmark_locate) {
+    for (unsigned i = 0; i < pattern_count; ++i)
+      printf("%u %a %a\n", locate_hits[i], locate_latency[0][i],
+             locate_latency[1][i]);
+    FMLocatePoolFree(locate_pool);
+    free(locate_latency[0]);
+    free(locate_latency[1]);
+    free(locate_hits);
+  } else if (func == benchmark_pipeline) {
+    // Overlap is the sum of the stage times over the wall time, which is 1
+    //  when transfer, compute and readback run strictly one after another.
+    fm_pipeline_stats *ps = &pipeline_stats;
+    double stages = ps->transfer_time + ps->compute_time + ps->readback_time;
+    printf("%a %a %lu %a %a\n", total_time, total_joules, total_matches,
+           stages / ps->wall_time, ps->wait_time / ps->wall_time);
+    backend->free(backend);
+    if (replicas)
+      FMReplicasFree(replicas);
+  } else if (func == benchmark_wildcard) {
+    // Time of searching all expansions, nodes explored and expansions per
+    //  pattern, and patterns whose search hit the node limit.
+    printf("%a %a %lu %a %a %a %lu\n", total_time, total_joules, total_matches,
+           expansion_time, (double)wildcard_nodes / pattern_count,
+           (double)expansion_count / pattern_count, wildcard_truncated);
+  } else if (func == benchmark_hits) {
+    // total_time is that of the compressed stream. Bytes per hit of the
+    //  stream and of printing positions as text, against 8 for raw ones.
+    printf("%a %a %lu %a %a %a\n", total_time, total_joules, total_matches,
+           raw_time, total_matches ? (double)encoded_bytes / total_matches : 0.,
+           total_matches ? (double)text_bytes / total_matches : 0.);
+  } else if (func == benchmark_adaptive) {
+    // Queries per joule of package and DRAM energy over the whole run, and
+    //  the worker count and batch size the search ended with.
+    fm_adaptive_stats *as = &adaptive_stats;
+    double joules = as->package_joules + as->dram_joules;
+    printf("%a %a %lu %a %lu %u %u\n", total_time, total_joules,
+           total_matches, joules > 0. ? as->queries / joules : 0., as->moves,
+           as->threads, as->batch_sz);
+    if (adaptive_config.log != stderr)
+      fclose(adaptive_config.log);
+  } else if (func == benchmark_pairs) {
+    // total_time searches with pair steps and is compared against single
+    //  steps; the joules cover both. Bytes per character of the pair
+    //  occurrences and of the whole index with them.
+    printf("%a %a %lu %a %a %a\n", total_time, total_joules, total_matches,
+           single_symbol_time,
+           (double)FMPairOccSize(fm->pair_occ) / fm->bwt_sz,
+           (double)FMIndexSize(fm) / fm->bwt_sz);
+  } else if (func == benchmark_approx) {
+    // Queries per second for each number of allowed mismatches.
+    printf("%a %a %lu", total_time, total_joules, total_matches);
+    for (unsigned k = 0; k <= APPROX_MAX_ERRORS; ++k)
+      printf(" %a", approx_qps[k]);
+    printf("\n");
+  } else
+    printf("%a %a %lu\n", total_time, total_joules, total_matches);
+
+  if (trace_file) {
+    FMTraceStop();
+    if (!FMTraceWrite(trace_file)) {
+      fprintf(stderr, "Failed to write trace.\n");
+      return 1;
+    }
+    FMTraceFree();
+  }
 
   free(match_indices);
   free(patterns);
-  FMIndexFree(fm);
+  if (fm)
+    FMIndexFree(fm);
+  if (rl)
+    RLIndexFree(rl);
   return 0;
 }
@@ -0,0 +1,60 @@
+import argparse
+import subprocess
+import time
+
+
+def main(repeats, dir, filenames, sizes, appendsize):
+    for filename in filenames:
+        with open(f"{dir}/{filename}", "rb") as f:
+            text = f.read()
+        resultfilename = f"{dir}/{filename}.append{appendsize}.result"
+        with open(resultfilename, "w") as resultfile:
+            for size in sizes:
+                if size + appendsize > len(text):
+                    print(f"{filename} is too small for {size} + {appendsize} characters")
+                    break
+                for n in range(repeats):
+                    print(f"{filename} {size} {n+1}/{repeats}")
+                    append, rebuild = benchmark(dir, text, size, appendsize)
+                    resultfile.write(f"{size} {append} {rebuild}\n")
+
+
+def run(args):
+    start = time.perf_counter()
+    proc = subprocess.run(args, universal_newlines=True, stdout=subprocess.PIPE)
+    if proc.returncode != 0:
+        print(f"Error running {' '.join(args)}: {proc.stdout.strip()}")
+        exit(1)
+    return time.perf_counter() - start
+
+
+def benchmark(dir, text, size, appendsize):
+    # The first size characters are indexed, and the next appendsize
+    #  characters are appended to that index or indexed together with it.
+    basefilename = f"{dir}/append.base"
+    newfilename = f"{dir}/append.new"
+    fullfilename = f"{dir}/append.full"
+    with open(basefilename, "wb") as f:
+        f.write(text[:size])
+    with open(newfilename, "wb") as f:
+        f.write(text[size:size + appendsize])
+    with open(fullfilename, "wb") as f:
+        f.write(text[:size + appendsize])
+
+    run(["./construct", basefilename, f"{basefilename}.fm"])
+    append = run(["./append", f"{basefilename}.fm", newfilename])
+    rebuild = run(["./construct", fullfilename, f"{fullfilename}.fm"])
+    return append, rebuild
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Compare appending text to an FM-index with constructing it again. "
+                                                 "Every line of the result file holds the corpus size and both times in seconds.")
+    parser.add_argument("-n", "--repeats", help="number of times to repeat each experiment", type=int, required=True)
+    parser.add_argument("-d", "--dir", help="directory containing the texts", required=True)
+    parser.add_argument("-f", "--files", help="texts to take the corpora from", nargs="+", default=[], required=True)
+    parser.add_argument("-s", "--sizes", help="sizes of the indexed corpus in characters", type=int, nargs="+", required=True)
+    parser.add_argument("-a", "--append-size", help="number of characters to append", type=int, default=4096)
+    args = parser.parse_args()
+
+    main(args.repeats, args.dir, args.files, args.sizes, args.append_size)
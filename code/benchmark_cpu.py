@@ -1,24 +1,85 @@
 import argparse
+import glob
 import subprocess
 import os
+import time
 
+# Modes that can be measured in-process through the fmpy module (make python).
+INPROCESS_MODES = ["single", "batch"]
 
-def main(repeats, count, maxmatches, lengths, dir, filenames):
+
+def main(repeats, count, maxmatches, lengths, dir, filenames, mode, modeargs, misses, fromindex, inprocess):
     for filename in filenames:
+        # In-process measurements load each index once for all experiments.
+        index = None
+        if inprocess:
+            import fmpy
+            index = fmpy.Index(f"{dir}/{filename}.fm")
         for length in lengths:
-            benchmark(repeats, count, maxmatches, length, dir, filename)
+            for miss in misses:
+                benchmark(repeats, count, maxmatches, length, dir, filename, mode, modeargs, miss, fromindex, index)
+
+
+def read_test_data(testfilename):
+    import numpy as np
+    with open(testfilename, "rb") as testfile:
+        lines = testfile.read().split(b"\n")
+    count, length = int(lines[1]), int(lines[2])
+    patterns = b"".join(line[:length] for line in lines[3:3 + count])
+    return np.frombuffer(patterns, dtype=np.uint8).reshape(count, length)
+
+
+def read_package_energy():
+    """Package energy in microjoules summed over all packages like ./benchmark, or None without RAPL."""
+    total = 0
+    zones = glob.glob("/sys/class/powercap/intel-rapl/intel-rapl:*/") + glob.glob("/sys/class/powercap/intel-rapl/intel-rapl:*/intel-rapl:*/")
+    for zone in zones:
+        try:
+            with open(f"{zone}name") as name, open(f"{zone}energy_uj") as energy:
+                if name.read().startswith("package-"):
+                    total += int(energy.read())
+        except OSError:
+            return None
+    return total if zones else None
+
+
+def benchmark_inprocess(index, testfilename, mode, resultfile):
+    """Search and locate the test patterns like ./benchmark and write its result line: CPU time, package energy and matches, and for batch the fraction of LF steps saved."""
+    patterns = read_test_data(testfilename)
+    energy_before = read_package_energy()
+    start = time.process_time()
+    offsets, _ = index.locate(patterns, batch=(mode == "batch"))
+    seconds = time.process_time() - start
+    energy_after = read_package_energy()
+    if energy_before is None or energy_after is None:
+        print(">RAPL energy counters are not available, recording 0 joules")
+        joules = 0.
+    else:
+        joules = float(energy_after - energy_before)
+    result = f"{seconds.hex()} {joules.hex()} {int(offsets[-1])}"
+    if mode == "batch":
+        total_steps = index.lf_steps + index.lf_steps_saved
+        saved = index.lf_steps_saved / total_steps if total_steps else 0.
+        result += f" {saved.hex()}"
+    resultfile.write(result + "\n")
 
 
-def benchmark(repeats, count, maxmatches, length, dir, filename):
+def benchmark(repeats, count, maxmatches, length, dir, filename, mode, modeargs, miss, fromindex, index):
     testfilename = f"{dir}/{filename}.cpu{length}.test"
     fmfilename = f"{dir}/{filename}.fm"
-    textfilename = f"{dir}/{filename}"
-    resultfilename = f"{dir}/{filename}.cpu{length}.result"
+    # Patterns can be sampled from indices built with inverse suffix array samples.
+    textfilename = "-" if fromindex else f"{dir}/{filename}"
+    # Keep the original result file names for the default mode.
+    modesuffix = "" if mode == "single" else f".{mode}"
+    modesuffix += "".join(f".{arg}" for arg in modeargs)
+    misssuffix = "" if miss == 0 else f".miss{miss}"
+    resultfilename = f"{dir}/{filename}.cpu{length}{modesuffix}{misssuffix}.result"
 
-    gentestargs = ["./generate_test_data", textfilename, fmfilename, testfilename, str(count), str(length), str(maxmatches)]
-    benchmarkargs = ["./benchmark", fmfilename, testfilename]
+    gentestargs = ["./generate_test_data", textfilename, fmfilename, testfilename, str(count), str(length), str(maxmatches), str(miss)]
+    benchmarkargs = ["./benchmark", fmfilename, testfilename, mode] + modeargs
     print(" ".join(gentestargs))
-    print(" ".join(benchmarkargs))
+    if index is None:
+        print(" ".join(benchmarkargs))
 
     # Remove result file if it already exists.
     try:
@@ -41,6 +102,9 @@ def benchmark(repeats, count, maxmatches, length, dir, filename):
 
         # Create result file.
         with open(resultfilename, "a") as resultfile:
+            if index is not None:
+                benchmark_inprocess(index, testfilename, mode, resultfile)
+                continue
             benchmarkproc = subprocess.Popen(benchmarkargs, stdout=resultfile, universal_newlines=True, stderr=subprocess.PIPE)
             _, stderr = benchmarkproc.communicate()
             if stderr:
@@ -59,6 +123,13 @@ if __name__ == "__main__":
     parser.add_argument("-l", "--lengths", help="length of the patterns", type=int, nargs="+", default=[], required=True)
     parser.add_argument("-d", "--dir", help="directory containing FM-indices and original texts (with the same name)", required=True)
     parser.add_argument("-f", "--files", help="FM-index files to benchmark", nargs="+", default=[], required=True)
+    parser.add_argument("--mode", help="benchmark mode passed to ./benchmark", default="single")
+    parser.add_argument("--mode-args", help="extra arguments of the benchmark mode, e.g. the node count of the numa mode", nargs="+", default=[])
+    parser.add_argument("--misses", help="percentages of patterns that do not occur", type=int, nargs="+", default=[0])
+    parser.add_argument("--from-index", help="sample patterns from the FM-indices instead of the original texts", action="store_true")
+    parser.add_argument("--in-process", help=f"measure through the fmpy module instead of ./benchmark, loading each index once (modes {', '.join(INPROCESS_MODES)})", action="store_true")
     args = parser.parse_args()
+    if args.in_process and (args.mode not in INPROCESS_MODES or args.mode_args):
+        parser.error(f"--in-process supports the modes {', '.join(INPROCESS_MODES)} without arguments")
 
-    main(args.repeats, args.count, args.maxmatches, args.lengths, args.dir, args.files)
+    main(args.repeats, args.count, args.maxmatches, args.lengths, args.dir, args.files, args.mode, args.mode_args, args.misses, args.from_index, args.in_process)
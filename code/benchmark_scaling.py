@@ -0,0 +1,74 @@
+import argparse
+import os
+import shlex
+import subprocess
+import time
+
+
+def main(repeats, count, maxmatches, length, dir, sizes, generatorargs, constructargs, mode, modeargs, seed):
+    # Name the result after the corpus parameters so different corpora do not mix.
+    suffix = "".join(f".{arg.lstrip('-')}" for arg in generatorargs + constructargs)
+    modesuffix = "" if mode == "single" else f".{mode}"
+    modesuffix += "".join(f".{arg}" for arg in modeargs)
+    resultfilename = f"{dir}/scaling{suffix}.cpu{length}{modesuffix}.result"
+    with open(resultfilename, "w") as resultfile:
+        for size in sizes:
+            textfilename = f"{dir}/scaling{suffix}.{size}"
+            fmfilename = f"{textfilename}.fm"
+            testfilename = f"{textfilename}.cpu{length}.test"
+            print(f"{size}: generating corpus")
+            run(["./generate_corpus", "-S", str(seed)] + generatorargs + [str(size), textfilename])
+            print(f"{size}: constructing index")
+            construct_time, construct_rss, _ = run(["./construct"] + constructargs + [textfilename, fmfilename])
+            index_sz = os.path.getsize(fmfilename)
+
+            for n in range(repeats):
+                print(f"{size}: {n+1}/{repeats}")
+                run(["./generate_test_data", textfilename, fmfilename, testfilename, str(count), str(length), str(maxmatches)])
+                _, benchmark_rss, stdout = run(["./benchmark", fmfilename, testfilename, mode] + modeargs)
+                # The benchmark prints the time, joules and matches first.
+                benchmark_time, joules, matches = stdout.split()[:3]
+                resultfile.write(f"{size} {index_sz} {construct_time.hex()} {construct_rss} "
+                                 f"{benchmark_rss} {count} {benchmark_time} {joules} {matches}\n")
+                resultfile.flush()
+
+            os.remove(textfilename)
+            os.remove(fmfilename)
+            os.remove(testfilename)
+
+
+def run(args):
+    # Wait for the process directly to get its own peak memory instead of the
+    #  maximum over all children so far.
+    start = time.perf_counter()
+    proc = subprocess.Popen(args, universal_newlines=True, stdout=subprocess.PIPE)
+    stdout = proc.stdout.read()
+    _, status, rusage = os.wait4(proc.pid, 0)
+    proc.returncode = os.waitstatus_to_exitcode(status)
+    elapsed = time.perf_counter() - start
+    if proc.returncode != 0:
+        print(f"Error running {' '.join(args)}: {stdout.strip()}")
+        exit(1)
+    return elapsed, rusage.ru_maxrss, stdout
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description="Measure construction and query performance on synthetic corpora of growing size. "
+                                                 "Every line of the result file holds the corpus size, the index size in bytes, "
+                                                 "the construction time, the peak memory of construction and benchmark in KiB, "
+                                                 "the number of patterns, and the time, joules and matches printed by ./benchmark.")
+    parser.add_argument("-n", "--repeats", help="number of times to repeat the benchmark for each size", type=int, required=True)
+    parser.add_argument("-c", "--count", help="number of patterns", type=int, required=True)
+    parser.add_argument("-m", "--maxmatches", help="maximum number of matches per pattern", type=int, required=True)
+    parser.add_argument("-l", "--length", help="length of the patterns", type=int, required=True)
+    parser.add_argument("-d", "--dir", help="directory to write corpora, indices and results to", required=True)
+    parser.add_argument("-s", "--sizes", help="corpus sizes in characters", type=int, nargs="+", required=True)
+    parser.add_argument("--generator-args", help="options of ./generate_corpus, e.g. --generator-args='-a 20 -z 1.2'", default="")
+    parser.add_argument("--construct-args", help="options of ./construct, e.g. --construct-args=-p", default="")
+    parser.add_argument("--mode", help="benchmark mode passed to ./benchmark", default="single")
+    parser.add_argument("--mode-args", help="extra arguments of the benchmark mode", nargs="+", default=[])
+    parser.add_argument("--seed", help="seed of the corpus generator", type=int, default=1)
+    args = parser.parse_args()
+
+    main(args.repeats, args.count, args.maxmatches, args.length, args.dir, args.sizes, shlex.split(args.generator_args),
+         shlex.split(args.construct_args), args.mode, args.mode_args, args.seed)
@@ -0,0 +1,331 @@
+#include "compress.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Block compression of the large index arrays.
+ * An array is split into blocks that are compressed independently, so they
+ *  can be decompressed in parallel straight into the final array. The codec
+ *  is made for index arrays rather than general data, and is much faster to
+ *  decode than general purpose compressors:
+ *  - Byte arrays like the BWT store the distinct bytes of each block and
+ *    then every byte as its index among them, bit-packed. A DNA BWT takes 3
+ *    bits per character.
+ *  - Arrays of 32-bit words with a stride store the first stride entries
+ *    and then every entry as the difference to the entry stride before it,
+ *    bit-packed with the width of the largest difference. The rows of the
+ *    rank matrix differ by at most 1 in every column, so it takes about one
+ *    bit per entry. Without a stride the entries themselves are packed,
+ *    which saves the unused high bits of suffix array entries.
+ * On disk an array is its size, element size, stride, block size and block
+ *  count, the offset of every block in the payload plus the payload size,
+ *  and the payload.
+ */
+
+static unsigned decompress_threads;
+
+// Use this many threads to decompress, or all processors if 0.
+void FMCompressSetThreads(unsigned thread_count) {
+  decompress_threads = thread_count;
+}
+
+static unsigned BitWidth(uint64_t v) {
+  return (v) ? 64 - __builtin_clzll(v) : 0;
+}
+
+static size_t PackedBytes(size_t count, unsigned width) {
+  return ((count * width + 63) / 64) * sizeof(uint64_t);
+}
+
+// Pack count values of the given width into out, which must hold
+//  PackedBytes(count, width) bytes.
+static void Pack(uint8_t *out, const uint32_t *values, size_t count,
+                 unsigned width) {
+  uint64_t word = 0;
+  unsigned used = 0;
+  for (size_t i = 0; i < count; ++i) {
+    word |= (uint64_t)values[i] << used;
+    used += width;
+    if (used >= 64) {
+      memcpy(out, &word, sizeof(word));
+      out += sizeof(word);
+      used -= 64;
+      word = (used) ? (uint64_t)values[i] >> (width - used) : 0;
+    }
+  }
+  if (used)
+    memcpy(out, &word, sizeof(word));
+}
+
+/* Return the value with the given index of a packed array. Values are at
+ *  most 32 bits wide, so one unaligned load at the byte holding the first bit
+ *  covers them; compressed data is read with 8 bytes of padding for this.
+ */
+static inline uint32_t Unpack(const uint8_t *in, size_t i, unsigned width) {
+  size_t bit = i * width;
+  uint64_t v;
+  memcpy(&v, in + bit / 8, sizeof(v));
+  return (v >> (bit % 8)) & ((1UL << width) - 1);
+}
+
+// Largest compressed size of a block of count entries.
+static size_t BlockBound(size_t count, unsigned element_sz, size_t stride) {
+  if (element_sz == 1)
+    return 2 + 256 + 1 + PackedBytes(count, 8);
+  return 1 + stride * sizeof(uint32_t) + PackedBytes(count, 32);
+}
+
+/* Compress a block into out, using tmp for count 32-bit values.
+ * Return the compressed size.
+ */
+static size_t CompressBlock(const void *data, size_t count,
+                            unsigned element_sz, size_t stride, uint8_t *out,
+                            uint32_t *tmp) {
+  size_t n, packed_count;
+  unsigned width;
+  if (element_sz == 1) {
+    const uint8_t *bytes = data;
+    short map[256];
+    uint8_t present[256] = {0};
+    for (size_t i = 0; i < count; ++i)
+      present[bytes[i]] = 1;
+    uint16_t symbol_count = 0;
+    for (unsigned c = 0; c < 256; ++c)
+      if (present[c]) {
+        map[c] = symbol_count;
+        out[2 + symbol_count++] = c;
+      }
+    memcpy(out, &symbol_count, sizeof(symbol_count));
+    n = 2 + symbol_count;
+    out[n++] = width = BitWidth(symbol_count - 1);
+    for (size_t i = 0; i < count; ++i)
+      tmp[i] = map[bytes[i]];
+    packed_count = count;
+  } else {
+    const uint32_t *words = data;
+    size_t base = (stride < count) ? stride : count;
+    memcpy(out + 1, words, base * sizeof(uint32_t));
+    n = 1 + base * sizeof(uint32_t);
+    // Differences wrap around for decreasing entries, which stays correct
+    //  but takes the full width.
+    uint32_t all = 0;
+    for (size_t i = base; i < count; ++i)
+      all |= tmp[i - base] = words[i] - ((stride) ? words[i - stride] : 0);
+    out[0] = width = BitWidth(all);
+    packed_count = count - base;
+  }
+
+  Pack(out + n, tmp, packed_count, width);
+  return n + PackedBytes(packed_count, width);
+}
+
+/* Decompress a block of in_sz bytes into count entries of data.
+ * Return 0 if the block is corrupt, 1 otherwise.
+ */
+static int DecompressBlock(const uint8_t *in, size_t in_sz, void *data,
+                           size_t count, unsigned element_sz, size_t stride) {
+  if (element_sz == 1) {
+    uint8_t *bytes = data;
+    uint16_t symbol_count;
+    if (in_sz < 3)
+      return 0;
+    memcpy(&symbol_count, in, sizeof(symbol_count));
+    if (!symbol_count || symbol_count > 256 || in_sz < 3 + (size_t)symbol_count)
+      return 0;
+    const uint8_t *symbols = in + 2;
+    unsigned width = in[2 + symbol_count];
+    const uint8_t *packed = in + 3 + symbol_count;
+    if (width != BitWidth(symbol_count - 1) ||
+        in_sz != 3 + symbol_count + PackedBytes(count, width))
+      return 0;
+    if (!width) {
+      memset(bytes, symbols[0], count);
+      return 1;
+    }
+    // Indices past the symbols can only come from corrupt blocks, and are
+    //  looked up in the zeroed rest of the table.
+    uint8_t table[1 << 8] = {0};
+    memcpy(table, symbols, symbol_count);
+    for (size_t i = 0; i < count; ++i)
+      bytes[i] = table[Unpack(packed, i, width)];
+    return 1;
+  }
+
+  uint32_t *words = data;
+  size_t base = (stride < count) ? stride : count;
+  if (in_sz < 1 + base * sizeof(uint32_t))
+    return 0;
+  unsigned width = in[0];
+  memcpy(words, in + 1, base * sizeof(uint32_t));
+  const uint8_t *packed = in + 1 + base * sizeof(uint32_t);
+  if (width > 32 ||
+      in_sz != 1 + base * sizeof(uint32_t) + PackedBytes(count - base, width))
+    return 0;
+  if (!width) {
+    for (size_t i = base; i < count; ++i)
+      words[i] = (stride) ? words[i - stride] : 0;
+    return 1;
+  }
+  if (!stride) {
+    for (size_t i = 0; i < count; ++i)
+      words[i] = Unpack(packed, i, width);
+    return 1;
+  }
+  for (size_t i = base; i < count; ++i)
+    words[i] = Unpack(packed, i - base, width) + words[i - stride];
+  return 1;
+}
+
+static size_t BlockEntries(size_t stride) {
+  return (stride > 1) ? FM_COMPRESS_BLOCK_SZ - FM_COMPRESS_BLOCK_SZ % stride
+                      : FM_COMPRESS_BLOCK_SZ;
+}
+
+/* Write count entries of element_sz bytes (1 or 4) compressed to f. Entries
+ *  of 4 bytes are coded as differences to the entry stride before them, or
+ *  as themselves if stride is 0.
+ * Return 0 on memory allocation or write error.
+ */
+int FMCompressedWrite(FILE *f, const void *data, size_t count,
+                      unsigned element_sz, size_t stride) {
+  if (element_sz != 1 && element_sz != sizeof(uint32_t))
+    return 0;
+  if (element_sz == 1 || stride > FM_COMPRESS_BLOCK_SZ / 2)
+    stride = 0;
+  size_t block_sz = BlockEntries(stride);
+  size_t block_count = (count + block_sz - 1) / block_sz;
+
+  uint64_t *offsets = malloc((block_count + 1) * sizeof(uint64_t));
+  uint8_t *out = malloc(BlockBound(block_sz, element_sz, stride));
+  uint32_t *tmp = malloc(block_sz * sizeof(uint32_t));
+  int ok = offsets && out && tmp;
+
+  uint64_t header[5] = {count, element_sz, stride, block_sz, block_count};
+  ok = ok && fwrite(header, sizeof(uint64_t), 5, f) == 5;
+  // The offsets are written once known, after the payload.
+  long offsets_pos = ftell(f);
+  ok = ok && fseek(f, (block_count + 1) * sizeof(uint64_t), SEEK_CUR) == 0;
+
+  offsets[0] = 0;
+  for (size_t b = 0; ok && b < block_count; ++b) {
+    size_t n = (b + 1 < block_count) ? block_sz : count - b * block_sz;
+    size_t sz = CompressBlock((const uint8_t *)data + b * block_sz * element_sz,
+                              n, element_sz, stride, out, tmp);
+    ok = fwrite(out, 1, sz, f) == sz;
+    offsets[b + 1] = offsets[b] + sz;
+  }
+
+  long end_pos = ftell(f);
+  ok = ok && fseek(f, offsets_pos, SEEK_SET) == 0 &&
+       fwrite(offsets, sizeof(uint64_t), block_count + 1, f) ==
+           block_count + 1 &&
+       fseek(f, end_pos, SEEK_SET) == 0;
+
+  free(offsets);
+  free(out);
+  free(tmp);
+  return ok;
+}
+
+typedef struct decompress_job {
+  const uint8_t *payload;
+  const uint64_t *offsets;
+  uint8_t *data;
+  size_t count;
+  unsigned element_sz;
+  size_t stride;
+  size_t block_sz;
+  size_t block_count;
+  size_t next_block;
+  int corrupt;
+} decompress_job;
+
+static void *DecompressBlocks(void *arg) {
+  decompress_job *job = arg;
+  FM_TRACE_BEGIN(span);
+  size_t blocks = 0, b;
+  while ((b = __atomic_fetch_add(&job->next_block, 1, __ATOMIC_RELAXED)) <
+         job->block_count) {
+    size_t n = (b + 1 < job->block_count) ? job->block_sz
+                                          : job->count - b * job->block_sz;
+    if (!DecompressBlock(job->payload + job->offsets[b],
+                         job->offsets[b + 1] - job->offsets[b],
+                         job->data + b * job->block_sz * job->element_sz, n,
+                         job->element_sz, job->stride))
+      __atomic_store_n(&job->corrupt, 1, __ATOMIC_RELAXED);
+    ++blocks;
+  }
+  FM_TRACE_END(span, "decompress blocks", 0, blocks);
+  return NULL;
+}
+
+// Decompress the blocks of the job on the calling thread and helper threads.
+static void DecompressParallel(decompress_job *job) {
+  unsigned threads = (decompress_threads) ? decompress_threads
+                                          : sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > job->block_count)
+    threads = job->block_count;
+  if (!threads)
+    return;
+
+  pthread_t workers[threads];
+  unsigned started = 0;
+  while (started + 1 < threads &&
+         pthread_create(&workers[started], NULL, &DecompressBlocks, job) == 0)
+    ++started;
+  DecompressBlocks(job);
+  for (unsigned i = 0; i < started; ++i)
+    pthread_join(workers[i], NULL);
+}
+
+/* Read an array written by FMCompressedWrite into data, which must hold
+ *  count entries of element_sz bytes. Blocks are decompressed in parallel.
+ * Return 0 on read or memory allocation error, or if the array is corrupt or
+ *  does not have the expected size.
+ */
+int FMCompressedRead(FILE *f, void *data, size_t count, unsigned element_sz) {
+  uint64_t header[5];
+  if (fread(header, sizeof(uint64_t), 5, f) != 5 || header[0] != count ||
+      header[1] != element_sz || header[2] > FM_COMPRESS_BLOCK_SZ / 2 ||
+      header[3] != BlockEntries(header[2]) ||
+      header[4] != (count + header[3] - 1) / header[3])
+    return 0;
+
+  decompress_job job = {0};
+  job.data = data;
+  job.count = count;
+  job.element_sz = element_sz;
+  job.stride = header[2];
+  job.block_sz = header[3];
+  job.block_count = header[4];
+
+  uint64_t *offsets = malloc((job.block_count + 1) * sizeof(uint64_t));
+  uint8_t *payload = NULL;
+  int ok = offsets && fread(offsets, sizeof(uint64_t), job.block_count + 1,
+                            f) == job.block_count + 1;
+  // Every block must fit its largest compressed size, so that corrupt
+  //  offsets cannot make decompression read past the payload.
+  for (size_t b = 0; ok && b < job.block_count; ++b)
+    ok = offsets[b] <= offsets[b + 1] &&
+         offsets[b + 1] - offsets[b] <=
+             BlockBound(job.block_sz, element_sz, job.stride);
+  size_t payload_sz = (ok) ? offsets[job.block_count] : 0;
+  // Padding so unpacking may load a whole word at the end of a block.
+  ok = ok && (payload = calloc(payload_sz + sizeof(uint64_t), 1)) &&
+       fread(payload, 1, payload_sz, f) == payload_sz;
+  if (!ok)
+    goto cleanup;
+  job.payload = payload;
+  job.offsets = offsets;
+
+  DecompressParallel(&job);
+  ok = !job.corrupt;
+
+cleanup:
+  free(offsets);
+  free(payload);
+  return ok;
+}
@@ -0,0 +1,21 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// Entries per independently compressed block, rounded down to a multiple of
+//  the stride of the array.
+#define FM_COMPRESS_BLOCK_SZ (1 << 16)
+
+int FMCompressedWrite(FILE *f, const void *data, size_t count,
+                      unsigned element_sz, size_t stride);
+int FMCompressedRead(FILE *f, void *data, size_t count, unsigned element_sz);
+void FMCompressSetThreads(unsigned thread_count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -1,30 +1,206 @@
 #include "fmindex.h"
+#include "rlindex.h"
 #include "util.h"
 
 #include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Read and concatenate the given files, separated by FM_DOCUMENT_SEPARATOR.
+ * The start position of each file is written to the newly allocated
+ *  *doc_starts.
+ * Return NULL on error.
+ */
+static char *ReadDocuments(char **filenames, int count, sa_t **doc_starts) {
+  char *s = NULL;
+  size_t sz = 0;
+  if (!(*doc_starts = malloc(count * sizeof(sa_t))))
+    return NULL;
+
+  for (int i = 0; i < count; ++i) {
+    char *document = ReadFile(filenames[i]);
+    if (!document)
+      goto error;
+    if (strchr(document, FM_DOCUMENT_SEPARATOR)) {
+      printf("File %s contains the document separator.\n", filenames[i]);
+      free(document);
+      goto error;
+    }
+
+    size_t document_sz = strlen(document);
+    char *grown = realloc(s, sz + document_sz + 2);
+    if (!grown) {
+      free(document);
+      goto error;
+    }
+    s = grown;
+    if (i)
+      s[sz++] = FM_DOCUMENT_SEPARATOR;
+    (*doc_starts)[i] = sz;
+    memcpy(&s[sz], document, document_sz + 1);
+    sz += document_sz;
+    free(document);
+  }
+
+  return s;
+
+error:
+  free(s);
+  free(*doc_starts);
+  return NULL;
+}
+
+static void usage(char *name) {
+  printf("Usage: $ %s [-q QGRAMLENGTH] [-b FILTERBITS] [-r] [-j] [-l] "
+         "[-s SAMPLERATE] [-R] [-p] [-z] [-2] <INPUTFILE>... <OUTPUTFILE>\n",
+         name);
+  printf("Multiple input files are indexed as a collection of documents.\n");
+  printf("  -q  Build a q-gram presence filter with q-grams of this length.\n");
+  printf("  -b  Log2 of the number of bits in the q-gram filter (default "
+         "24).\n");
+  printf("  -r  Also build an index of the reversed text for approximate "
+         "search.\n");
+  printf("  -j  Build the forward and reverse indices in parallel.\n");
+  printf("  -l  Build the LCP array for matching statistics.\n");
+  printf("  -s  Sample the inverse suffix array at this rate so text can be "
+         "extracted\n      from the index.\n");
+  printf("  -R  Build a run-length compressed index instead, and report the "
+         "number\n      of BWT runs r over the text length n.\n");
+  printf("  -p  Store the rank matrix and suffix array bit-packed, using just "
+         "enough\n      bits per entry for the text length.\n");
+  printf("  -z  Compress the BWT, rank matrix and suffix array in blocks that "
+         "are\n      decompressed in parallel when loading.\n");
+  printf("  -2  Store occurrences of character pairs, so backward search takes "
+         "two\n      characters per step. The alphabet may have at most %d "
+         "characters.\n",
+         FM_PAIR_OCC_MAX_SYMBOLS);
+}
 
 int main(int argc, char *argv[]) {
-  if (argc < 3) {
-    printf("Usage: $ %s <INPUTFILE> <OUTPUTFILE>\n", argv[0]);
+  unsigned qgram_q = 0, qgram_bits_log2 = 24;
+  int bidirectional = 0, parallel = 0, lcp = 0;
+  sa_t sample_rate = 0;
+  int run_length = 0, packed = 0, compressed = 0, pairs = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "q:b:rjls:Rpz2")) != -1) {
+    switch (opt) {
+    case 'q':
+      qgram_q = atoi(optarg);
+      break;
+    case 'b':
+      qgram_bits_log2 = atoi(optarg);
+      break;
+    case 'r':
+      bidirectional = 1;
+      break;
+    case 'j':
+      parallel = 1;
+      break;
+    case 'l':
+      lcp = 1;
+      break;
+    case 's':
+      sample_rate = atoi(optarg);
+      break;
+    case 'R':
+      run_length = 1;
+      break;
+    case 'p':
+      packed = 1;
+      break;
+    case 'z':
+      compressed = 1;
+      break;
+    case '2':
+      pairs = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - optind < 2 || (packed && compressed)) {
+    usage(argv[0]);
     return 1;
   }
 
-  char *s = ReadFile(argv[1]);
+  char *output = argv[argc - 1];
+  int document_count = argc - optind - 1;
+  sa_t *doc_starts = NULL;
+  char *s = (document_count > 1)
+                ? ReadDocuments(&argv[optind], document_count, &doc_starts)
+                : ReadFile(argv[optind]);
   if (!s)
     return 1;
 
-  fm_index *index = FMIndexConstruct(s);
+  if (run_length) {
+    rl_index *rl = RLIndexConstruct(s);
+    if (!rl) {
+      printf("Failed to construct run-length index.\n");
+      return 1;
+    }
+
+    printf("r/n: %lu/%lu = %f (%.2f bytes per character)\n", rl->run_count,
+           rl->bwt_sz, (double)rl->run_count / rl->bwt_sz,
+           (double)RLIndexSize(rl) / rl->bwt_sz);
+    if (!RLIndexDumpToFile(rl, output)) {
+      printf("Failed to write run-length index to file.\n");
+      return 1;
+    }
+
+    RLIndexFree(rl);
+    free(s);
+    return 0;
+  }
+
+  fm_index *index = (bidirectional) ? FMIndexConstructBidirectional(s, parallel)
+                                     : FMIndexConstruct(s);
   if (!index) {
     printf("Failed to construct index.\n");
     return 1;
   }
 
-  if (!FMIndexDumpToFile(index, argv[2])) {
+  if (qgram_q &&
+      !FMIndexBuildQGramFilter(index, s, qgram_q, qgram_bits_log2)) {
+    printf("Failed to construct q-gram filter.\n");
+    return 1;
+  }
+
+  if (doc_starts && !FMIndexSetDocuments(index, doc_starts, document_count)) {
+    printf("Failed to construct document structures.\n");
+    return 1;
+  }
+
+  if (lcp && !FMIndexBuildLCP(index, s)) {
+    printf("Failed to construct LCP array.\n");
+    return 1;
+  }
+
+  if (sample_rate && !FMIndexBuildISASamples(index, sample_rate)) {
+    printf("Failed to construct inverse suffix array samples.\n");
+    return 1;
+  }
+
+  if (pairs && !FMIndexBuildPairOcc(index)) {
+    printf("Failed to construct pair occurrences.\n");
+    return 1;
+  }
+
+  if (packed && !FMIndexPack(index)) {
+    printf("Failed to pack FM-index.\n");
+    return 1;
+  }
+
+  int written = (compressed) ? FMIndexDumpCompressedToFile(index, output)
+                             : FMIndexDumpToFile(index, output);
+  if (!written) {
     printf("Failed to write FM-index to file.\n");
     return 1;
   }
 
   FMIndexFree(index);
+  free(doc_starts);
   free(s);
   return 0;
 }
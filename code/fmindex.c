@@ -1,15 +1,49 @@
 #define _GNU_SOURCE
 
+#include "compress.h"
 #include "fmindex.h"
+#include "trace.h"
 #include "util.h"
 
 #include <limits.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 inline static int string_index(char *s, char c) { return strchr(s, c) - s; }
 
+// Tags of the optional sections that may follow the suffix array on disk.
+#define FM_SECTION_QGRAM_FILTER 1
+#define FM_SECTION_REVERSE 2
+#define FM_SECTION_LCP 3
+#define FM_SECTION_ISA_SAMPLES 4
+#define FM_SECTION_DOCUMENTS 5
+#define FM_SECTION_REVERSE_PACKED 6
+#define FM_SECTION_REVERSE_COMPRESSED 7
+#define FM_SECTION_PAIR_OCC 8
+
+// First word of files with a bit-packed rank matrix and suffix array, in
+//  place of the BWT size of the original layout.
+#define FM_PACKED_MAGIC 0xf3f3f3f3f3f3f301UL
+// First word of files with the BWT, rank matrix and suffix array compressed
+//  in blocks, see compress.c.
+#define FM_COMPRESSED_MAGIC 0xf3f3f3f3f3f3f302UL
+
+// Rows per block of the range minimum structure over doc_prev.
+#define DOC_RMQ_BLOCK 32
+
+static void InitAlphabetMap(fm_index *index) {
+  for (unsigned i = 0; i < 256; ++i)
+    index->alphabet_map[i] = -1;
+  for (size_t i = 0; i < index->alphabet_sz; ++i)
+    index->alphabet_map[(unsigned char)index->alphabet[i]] = i;
+}
+
+inline static int AlphabetIndex(fm_index *fm, char c) {
+  return fm->alphabet_map[(unsigned char)c];
+}
+
 static int CompareChar(const void *a, const void *b) {
   char i = *(char *)a;
   char j = *(char *)b;
@@ -182,27 +216,296 @@ ranges_t *ConstructCharacterRanges(char *bwt, size_t sz, char *alphabet) {
   return ranges;
 }
 
-/* Find the range of matches for the given pattern in the F column of the
- *  given FM-index.
+inline static unsigned long MixQGram(unsigned long x) {
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53UL;
+  x ^= x >> 33;
+  return x;
+}
+
+/* Visit the filter bits for the q-gram with the given code.
+ * If set is non-zero the bits are set, otherwise return whether all of them
+ *  are set.
  */
-void FMIndexFindMatchRange(fm_index *fm, char *pattern, size_t pattern_sz,
-                           ranges_t *start, ranges_t *end) {
+inline static int QGramFilterBits(fm_index *fm, unsigned long code, int set) {
+  unsigned long mask = (1UL << fm->qgram_bits_log2) - 1;
+  unsigned long h = (fm->qgram_hashes) ? MixQGram(code) : code;
+  unsigned probes = (fm->qgram_hashes) ? fm->qgram_hashes : 1;
+
+  for (unsigned i = 0; i < probes; ++i) {
+    unsigned long bit = h & mask;
+    if (set)
+      fm->qgram_filter[bit >> 3] |= 1 << (bit & 7);
+    else if (!(fm->qgram_filter[bit >> 3] & (1 << (bit & 7))))
+      return 0;
+    // Derive the next probe from the same hash (double hashing).
+    h += (h >> 32) | 1;
+  }
+
+  return 1;
+}
+
+// Set the filter bits of all q-grams of s, whose characters must all be in
+//  the alphabet.
+static void QGramFilterAdd(fm_index *index, char *s) {
+  unsigned q = index->qgram_q;
+
+  // Rolling base-alphabet_sz code of the last q characters (mod 2^64).
+  unsigned long pow = 1;
+  for (unsigned i = 0; i < q; ++i)
+    pow *= index->alphabet_sz;
+
+  unsigned long code = 0;
+  for (size_t i = 0; s[i] != '\0'; ++i) {
+    code = code * index->alphabet_sz + AlphabetIndex(index, s[i]);
+    if (i >= q)
+      code -= pow * AlphabetIndex(index, s[i - q]);
+    if (i + 1 >= q)
+      QGramFilterBits(index, code, 1);
+  }
+}
+
+/* Build a presence filter over all q-grams of the original text s.
+ * The filter holds at most 2^bits_log2 bits. If every possible q-gram over
+ *  the alphabet fits, each q-gram gets its own bit and the filter is exact.
+ *  Otherwise a Bloom filter with two hash functions is used.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexBuildQGramFilter(fm_index *index, char *s, unsigned q,
+                            unsigned bits_log2) {
+  if (!q || bits_log2 < 3 || bits_log2 > 40)
+    return 0;
+
+  // Check whether alphabet_sz^q fits in the filter without overflowing.
+  unsigned long distinct = 1;
+  index->qgram_hashes = 0;
+  for (unsigned i = 0; i < q && !index->qgram_hashes; ++i)
+    if ((distinct *= index->alphabet_sz) > (1UL << bits_log2))
+      index->qgram_hashes = 2;
+
+  // An exact filter only needs one bit for each possible q-gram.
+  if (!index->qgram_hashes)
+    while (bits_log2 > 3 && (1UL << (bits_log2 - 1)) >= distinct)
+      --bits_log2;
+
+  free(index->qgram_filter);
+  if (!(index->qgram_filter = calloc(1UL << (bits_log2 - 3), 1)))
+    return 0;
+  index->qgram_q = q;
+  index->qgram_bits_log2 = bits_log2;
+
+  QGramFilterAdd(index, s);
+  return 1;
+}
+
+/* Return whether the pattern certainly does not occur in the text,
+ *  either because it contains characters outside the alphabet or because one
+ *  of its q-grams is absent from the q-gram filter.
+ * No rank lookups are done.
+ */
+int FMIndexQGramFilterRejects(fm_index *fm, char *pattern, size_t pattern_sz) {
+  unsigned q = fm->qgram_q;
+  unsigned long pow = 1;
+  for (unsigned i = 0; i < q; ++i)
+    pow *= fm->alphabet_sz;
+
+  unsigned long code = 0;
+  for (size_t i = 0; i < pattern_sz; ++i) {
+    int alphabet_idx = AlphabetIndex(fm, pattern[i]);
+    if (alphabet_idx < 0)
+      return 1;
+    if (!fm->qgram_filter)
+      continue;
+
+    code = code * fm->alphabet_sz + alphabet_idx;
+    if (i >= q)
+      code -= pow * AlphabetIndex(fm, pattern[i - q]);
+    if (i + 1 >= q && !QGramFilterBits(fm, code, 0))
+      return 1;
+  }
+
+  return 0;
+}
+
+// Backward search of FMIndexFindMatchRange. Return the number of LF steps.
+static unsigned long FindMatchRange(fm_index *fm, char *pattern,
+                                    size_t pattern_sz, ranges_t *start,
+                                    ranges_t *end) {
+  *start = *end = 0;
+  if (fm->qgram_filter && FMIndexQGramFilterRejects(fm, pattern, pattern_sz))
+    return 0;
+
   int p_idx = pattern_sz - 1;
   char c = pattern[p_idx];
+  int alphabet_idx = AlphabetIndex(fm, c);
+  if (alphabet_idx < 0)
+    return 0;
   // Initial range is all instances of the last character in pattern.
-  *start = fm->ranges[2 * string_index(fm->alphabet, c)];
-  *end = fm->ranges[2 * string_index(fm->alphabet, c) + 1];
+  *start = fm->ranges[2 * alphabet_idx];
+  *end = fm->ranges[2 * alphabet_idx + 1];
 
+  unsigned long steps = 0;
   p_idx -= 1;
+  // Pairs of characters take one step each, until a pair has a character
+  //  without a pair symbol, which the single steps below handle.
+  fm_pair_occ *pairs = fm->pair_occ;
+  while (pairs && p_idx >= 1 && *end > 1) {
+    unsigned code = FMPairOccCode(pairs, pattern[p_idx - 1], pattern[p_idx]);
+    if (code == FM_PAIR_OCC_NONE)
+      break;
+    ranges_t range_start = pairs->starts[code];
+    *start = range_start + FMPairOccRank(pairs, code, *start);
+    *end = range_start + FMPairOccRank(pairs, code, *end);
+    p_idx -= 2;
+    ++steps;
+  }
   while (p_idx >= 0 && *end > 1) {
     c = pattern[p_idx];
-    ranges_t range_start = fm->ranges[2 * string_index(fm->alphabet, c)];
-    int alphabet_idx = string_index(fm->alphabet, c);
-    *start =
-        range_start + fm->ranks[fm->alphabet_sz * (*start - 1) + alphabet_idx];
-    *end = range_start + fm->ranks[fm->alphabet_sz * (*end - 1) + alphabet_idx];
+    if ((alphabet_idx = AlphabetIndex(fm, c)) < 0) {
+      *start = *end = 0;
+      return steps;
+    }
+    ranges_t range_start = fm->ranges[2 * alphabet_idx];
+    *start = range_start + FMIndexRank(fm, *start - 1, alphabet_idx);
+    *end = range_start + FMIndexRank(fm, *end - 1, alphabet_idx);
     p_idx -= 1;
+    ++steps;
   }
+  return steps;
+}
+
+/* Find the range of matches for the given pattern in the F column of the
+ *  given FM-index.
+ * Patterns rejected by the q-gram filter, or containing characters that do
+ *  not occur in the text, get the empty range [0, 0).
+ */
+void FMIndexFindMatchRange(fm_index *fm, char *pattern, size_t pattern_sz,
+                           ranges_t *start, ranges_t *end) {
+  FM_TRACE_BEGIN(span);
+  unsigned long steps = FindMatchRange(fm, pattern, pattern_sz, start, end);
+  FM_TRACE_END(span, "search", steps, *end - *start);
+}
+
+typedef struct pattern_batch {
+  char *patterns;
+  size_t pattern_sz;
+} pattern_batch;
+
+static int CompareReversedPattern(const void *a, const void *b, void *arg) {
+  pattern_batch *batch = arg;
+  char *p = &batch->patterns[*(unsigned *)a * batch->pattern_sz];
+  char *q = &batch->patterns[*(unsigned *)b * batch->pattern_sz];
+
+  for (size_t k = batch->pattern_sz; k > 0; --k)
+    if (p[k - 1] != q[k - 1])
+      return (unsigned char)p[k - 1] - (unsigned char)q[k - 1];
+
+  return 0;
+}
+
+/* Find the match ranges for a batch of equally sized patterns at once.
+ * Patterns are visited in order of their reversed strings, so patterns
+ *  sharing a suffix reuse the LF steps already taken for that suffix. This
+ *  is a depth-first walk over the trie of reversed patterns, where only the
+ *  steps below the point where two suffixes diverge are computed.
+ * The resulting ranges are identical to calling FMIndexFindMatchRange for
+ *  each pattern separately.
+ * If lf_steps or lf_steps_saved are not NULL, they are set to the number of
+ *  LF steps taken and the number of steps that were reused, respectively.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexFindMatchRangeBatch(fm_index *fm, char *patterns,
+                               unsigned pattern_count, size_t pattern_sz,
+                               ranges_t *starts, ranges_t *ends,
+                               unsigned long *lf_steps,
+                               unsigned long *lf_steps_saved) {
+  FM_TRACE_BEGIN(span);
+  unsigned long steps = 0, saved = 0;
+  if (!pattern_count || !pattern_sz)
+    goto done;
+
+  unsigned *order = malloc(pattern_count * sizeof(unsigned));
+  // Range after consuming the last (depth + 1) characters of the pattern.
+  ranges_t *stack = malloc(2 * pattern_sz * sizeof(ranges_t));
+  if (!order || !stack) {
+    free(order);
+    free(stack);
+    return 0;
+  }
+
+  for (unsigned i = 0; i < pattern_count; ++i)
+    order[i] = i;
+  pattern_batch batch = {patterns, pattern_sz};
+  qsort_r(order, pattern_count, sizeof(unsigned), &CompareReversedPattern,
+          &batch);
+
+  char *prev = NULL;
+  for (unsigned k = 0; k < pattern_count; ++k) {
+    char *pattern = &patterns[order[k] * pattern_sz];
+    if (fm->qgram_filter && FMIndexQGramFilterRejects(fm, pattern, pattern_sz)) {
+      starts[order[k]] = ends[order[k]] = 0;
+      continue;
+    }
+
+    // Length of the suffix shared with the previous pattern in sorted order.
+    size_t shared = 0;
+    if (prev)
+      while (shared < pattern_sz &&
+             pattern[pattern_sz - 1 - shared] == prev[pattern_sz - 1 - shared])
+        ++shared;
+
+    size_t depth = shared;
+    if (depth == 0) {
+      // The empty range [0, 0) is frozen by the stopping rule below.
+      int alphabet_idx = AlphabetIndex(fm, pattern[pattern_sz - 1]);
+      stack[0] = (alphabet_idx < 0) ? 0 : fm->ranges[2 * alphabet_idx];
+      stack[1] = (alphabet_idx < 0) ? 0 : fm->ranges[2 * alphabet_idx + 1];
+      depth = 1;
+    }
+
+    for (; depth < pattern_sz; ++depth) {
+      ranges_t start = stack[2 * (depth - 1)];
+      ranges_t end = stack[2 * (depth - 1) + 1];
+      // Same stopping rule as FMIndexFindMatchRange: the range is frozen.
+      if (end > 1) {
+        char c = pattern[pattern_sz - 1 - depth];
+        int alphabet_idx = AlphabetIndex(fm, c);
+        if (alphabet_idx < 0) {
+          start = end = 0;
+        } else {
+          ranges_t range_start = fm->ranges[2 * alphabet_idx];
+          start = range_start + FMIndexRank(fm, start - 1, alphabet_idx);
+          end = range_start + FMIndexRank(fm, end - 1, alphabet_idx);
+          ++steps;
+        }
+      }
+      stack[2 * depth] = start;
+      stack[2 * depth + 1] = end;
+    }
+
+    // Count the steps an independent search would have taken on the shared
+    //  suffix.
+    for (size_t d = 1; d < shared; ++d)
+      if (stack[2 * (d - 1) + 1] > 1)
+        ++saved;
+
+    starts[order[k]] = stack[2 * (pattern_sz - 1)];
+    ends[order[k]] = stack[2 * (pattern_sz - 1) + 1];
+    prev = pattern;
+  }
+
+  free(order);
+  free(stack);
+
+done:
+  if (lf_steps)
+    *lf_steps = steps;
+  if (lf_steps_saved)
+    *lf_steps_saved = saved;
+  FM_TRACE_END(span, "batch search", steps, 0);
+  return 1;
 }
 
 /* Find the matching indices in the original text for the given
@@ -210,8 +513,51 @@ void FMIndexFindMatchRange(fm_index *fm, char *pattern, size_t pattern_sz,
  */
 void FMIndexFindRangeIndices(fm_index *fm, ranges_t start, ranges_t end,
                              unsigned long **match_indices) {
-  for (unsigned long i = 0; i < end - start; ++i)
-    (*match_indices)[i] = fm->sa[start + i];
+  FM_TRACE_BEGIN(span);
+  if (!fm->sa) {
+    PackedDecode(&fm->packed_sa, start, end - start, *match_indices);
+  } else {
+    for (unsigned long i = 0; i < end - start; ++i)
+      (*match_indices)[i] = fm->sa[start + i];
+  }
+  FM_TRACE_END(span, "locate", 0, end - start);
+}
+
+/* Locate the matches of a batch of ranges into one dense array.
+ * First the match counts are prefix-summed into offsets, which gets
+ *  count + 1 entries, so the matches of range i are positions[offsets[i]]
+ *  up to positions[offsets[i + 1]]. Then the positions of every range are
+ *  written to their exact place, so frequent patterns take no more space
+ *  than they need.
+ * Return 0 on memory allocation error, with both arrays NULL, 1 otherwise.
+ */
+int FMIndexFindRangeIndicesBatch(fm_index *fm, ranges_t *starts,
+                                 ranges_t *ends, unsigned count,
+                                 unsigned long **offsets,
+                                 unsigned long **positions) {
+  FM_TRACE_BEGIN(span);
+  *positions = NULL;
+  if (!(*offsets = malloc((count + 1) * sizeof(unsigned long))))
+    return 0;
+
+  (*offsets)[0] = 0;
+  for (unsigned i = 0; i < count; ++i)
+    (*offsets)[i + 1] = (*offsets)[i] + (ends[i] - starts[i]);
+
+  unsigned long total = (*offsets)[count];
+  if (!(*positions = malloc((total ? total : 1) * sizeof(unsigned long)))) {
+    free(*offsets);
+    *offsets = NULL;
+    return 0;
+  }
+
+  for (unsigned i = 0; i < count; ++i) {
+    unsigned long *out = *positions + (*offsets)[i];
+    FMIndexFindRangeIndices(fm, starts[i], ends[i], &out);
+  }
+
+  FM_TRACE_END(span, "batch locate", 0, total);
+  return 1;
 }
 
 fm_index *FMIndexConstruct(char *s) {
@@ -224,6 +570,7 @@ fm_index *FMIndexConstruct(char *s) {
   if (!(index->alphabet = TextToAlphabet(s, sz)))
     goto error;
   index->alphabet_sz = strlen(index->alphabet);
+  InitAlphabetMap(index);
   if (!(index->sa = ConstructSuffixArray(s, sz)))
     goto error;
   if (!(index->bwt = ConstructBWT(s, sz, index->sa)))
@@ -254,33 +601,1164 @@ error:
   return NULL;
 }
 
+/* Compute the previous and next smaller values of the LCP array.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+static int InitLCPNavigation(fm_index *index) {
+  size_t n = index->bwt_sz + 1;
+  sa_t *stack = malloc(n * sizeof(sa_t));
+  index->lcp_psv = malloc(n * sizeof(sa_t));
+  index->lcp_nsv = malloc(n * sizeof(sa_t));
+  if (!stack || !index->lcp_psv || !index->lcp_nsv) {
+    free(stack);
+    return 0;
+  }
+
+  // A stack of positions with strictly increasing LCP values.
+  size_t top = 0;
+  for (size_t i = 0; i < n; ++i) {
+    while (top && index->lcp[stack[top - 1]] >= index->lcp[i])
+      --top;
+    index->lcp_psv[i] = (top) ? stack[top - 1] : 0;
+    stack[top++] = i;
+  }
+  top = 0;
+  for (size_t i = n; i > 0; --i) {
+    while (top && index->lcp[stack[top - 1]] >= index->lcp[i - 1])
+      --top;
+    index->lcp_nsv[i - 1] = (top) ? stack[top - 1] : index->bwt_sz;
+    stack[top++] = i - 1;
+  }
+
+  free(stack);
+  return 1;
+}
+
+/* Build the LCP array of the index for the original text s with Kasai's
+ *  algorithm, which is needed for matching statistics.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexBuildLCP(fm_index *index, char *s) {
+  size_t n = index->bwt_sz;
+  sa_t *rank = malloc(n * sizeof(sa_t));
+  free(index->lcp);
+  if (!(index->lcp = calloc(n + 1, sizeof(sa_t))) || !rank) {
+    free(rank);
+    return 0;
+  }
+
+  for (size_t i = 0; i < n; ++i)
+    rank[FMIndexSA(index, i)] = i;
+
+  // The LCP of a suffix is at most one less than that of its predecessor in
+  //  text order, so h only decreases by one per step.
+  size_t h = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (rank[i] == 0) {
+      h = 0;
+      continue;
+    }
+    size_t j = FMIndexSA(index, rank[i] - 1);
+    while (s[i + h] != '\0' && s[i + h] == s[j + h])
+      ++h;
+    index->lcp[rank[i]] = h;
+    if (h)
+      --h;
+  }
+
+  free(rank);
+  return InitLCPNavigation(index);
+}
+
+/* Sample the inverse suffix array at every rate-th text position, so that
+ *  text can be extracted from the index without the original text.
+ * A lower rate makes extraction faster at the cost of more memory.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexBuildISASamples(fm_index *index, sa_t rate) {
+  if (!rate)
+    return 0;
+
+  size_t sample_count = (index->bwt_sz - 1) / rate + 1;
+  free(index->isa_samples);
+  if (!(index->isa_samples = malloc(sample_count * sizeof(sa_t))))
+    return 0;
+  index->isa_sample_rate = rate;
+
+  for (size_t i = 0; i < index->bwt_sz; ++i)
+    if (FMIndexSA(index, i) % rate == 0)
+      index->isa_samples[FMIndexSA(index, i) / rate] = i;
+
+  return 1;
+}
+
+/* Extract len characters of the original text starting at pos into out,
+ *  which must hold len + 1 characters. The extracted text is cut off at the
+ *  end of the text and terminated with a null character.
+ * The text is recovered by walking backwards with LF from the nearest
+ *  inverse suffix array sample after the requested part.
+ * Return 0 if the index has no samples or pos lies outside the text.
+ */
+int FMIndexExtract(fm_index *fm, size_t pos, size_t len, char *out) {
+  size_t text_sz = fm->bwt_sz - 1;
+  if (!fm->isa_samples || pos > text_sz)
+    return 0;
+  if (len > text_sz - pos)
+    len = text_sz - pos;
+  out[len] = '\0';
+
+  // The suffix at the end of the text is the dollar sign in row 0.
+  size_t sample = (pos + len + fm->isa_sample_rate - 1) / fm->isa_sample_rate;
+  size_t p = sample * fm->isa_sample_rate;
+  ranges_t row = 0;
+  if (p < text_sz)
+    row = fm->isa_samples[sample];
+  else
+    p = text_sz;
+
+  // Row r holds the character before its suffix in the BWT.
+  for (; p > pos; --p) {
+    char c = fm->bwt[row];
+    int alphabet_idx = AlphabetIndex(fm, c);
+    if (p <= pos + len)
+      out[p - 1 - pos] = c;
+    row = fm->ranges[2 * alphabet_idx] + FMIndexRank(fm, row, alphabet_idx) - 1;
+  }
+
+  return 1;
+}
+
+/* Extract a snippet around every match in the range [start, end) of the F
+ *  column, from before characters before the match up to after characters
+ *  after its start.
+ * Snippets are written to consecutive slots of (before + after + 1)
+ *  characters and are null-terminated. Snippets near the start or end of the
+ *  text are shorter.
+ * Return 0 if the index has no samples, 1 otherwise.
+ */
+int FMIndexExtractSnippets(fm_index *fm, ranges_t start, ranges_t end,
+                           size_t before, size_t after, char *snippets) {
+  size_t slot_sz = before + after + 1;
+
+  for (ranges_t i = start; i < end; ++i) {
+    size_t pos = FMIndexSA(fm, i);
+    size_t snippet_start = (pos > before) ? pos - before : 0;
+    if (!FMIndexExtract(fm, snippet_start, pos + after - snippet_start,
+                        &snippets[(i - start) * slot_sz]))
+      return 0;
+  }
+
+  return 1;
+}
+
+// Return the number of levels of the sparse table over the given number of
+//  blocks.
+static size_t DocRMQLevels(size_t blocks) {
+  size_t levels = 1;
+  while ((1UL << levels) <= blocks)
+    ++levels;
+  return levels;
+}
+
+/* Set the document boundaries of the index and build the structures for
+ *  listing documents: the previous row of the same document for every row,
+ *  a sparse table over the block minima of that array, and the rows of each
+ *  document.
+ * doc_starts is copied and must be sorted and start with 0.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexSetDocuments(fm_index *index, sa_t *doc_starts, size_t doc_count) {
+  size_t n = index->bwt_sz;
+  size_t blocks = (n + DOC_RMQ_BLOCK - 1) / DOC_RMQ_BLOCK;
+  size_t levels = DocRMQLevels(blocks);
+
+  free(index->doc_starts);
+  free(index->doc_prev);
+  free(index->doc_rmq);
+  free(index->doc_rows);
+  free(index->doc_row_offsets);
+  index->doc_starts = malloc(doc_count * sizeof(sa_t));
+  index->doc_prev = malloc(n * sizeof(sa_t));
+  index->doc_rmq = malloc(levels * blocks * sizeof(sa_t));
+  index->doc_rows = malloc(n * sizeof(sa_t));
+  index->doc_row_offsets = calloc(doc_count + 1, sizeof(sa_t));
+  sa_t *last = calloc(doc_count, sizeof(sa_t));
+  if (!index->doc_starts || !index->doc_prev || !index->doc_rmq ||
+      !index->doc_rows || !index->doc_row_offsets || !last) {
+    free(last);
+    return 0;
+  }
+  memcpy(index->doc_starts, doc_starts, doc_count * sizeof(sa_t));
+  index->doc_count = doc_count;
+
+  for (size_t i = 0; i < n; ++i) {
+    size_t d = FMIndexDocumentOf(index, FMIndexSA(index, i));
+    index->doc_prev[i] = last[d];
+    last[d] = i + 1;
+    ++index->doc_row_offsets[d + 1];
+  }
+
+  for (size_t d = 0; d < doc_count; ++d)
+    index->doc_row_offsets[d + 1] += index->doc_row_offsets[d];
+  memcpy(last, index->doc_row_offsets, doc_count * sizeof(sa_t));
+  for (size_t i = 0; i < n; ++i)
+    index->doc_rows[last[FMIndexDocumentOf(index, FMIndexSA(index, i))]++] = i;
+  free(last);
+
+  // Level l holds the row with the minimum over 2^l blocks.
+  sa_t *table = index->doc_rmq;
+  for (size_t b = 0; b < blocks; ++b) {
+    sa_t min = b * DOC_RMQ_BLOCK;
+    for (size_t i = min + 1; i < n && i < (b + 1) * DOC_RMQ_BLOCK; ++i)
+      if (index->doc_prev[i] < index->doc_prev[min])
+        min = i;
+    table[b] = min;
+  }
+  for (size_t l = 1; l < levels; ++l)
+    for (size_t b = 0; b + (1UL << l) <= blocks; ++b) {
+      sa_t left = table[(l - 1) * blocks + b];
+      sa_t right = table[(l - 1) * blocks + b + (1UL << (l - 1))];
+      table[l * blocks + b] =
+          (index->doc_prev[right] < index->doc_prev[left]) ? right : left;
+    }
+
+  return 1;
+}
+
+// Return the document that holds the given text position.
+size_t FMIndexDocumentOf(fm_index *fm, sa_t pos) {
+  size_t lo = 0, hi = fm->doc_count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (fm->doc_starts[mid] <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Return the row in [start, end) with the minimum value in doc_prev.
+static ranges_t DocRMQ(fm_index *fm, ranges_t start, ranges_t end) {
+  size_t blocks = (fm->bwt_sz + DOC_RMQ_BLOCK - 1) / DOC_RMQ_BLOCK;
+  size_t first = (start + DOC_RMQ_BLOCK - 1) / DOC_RMQ_BLOCK;
+  size_t last = end / DOC_RMQ_BLOCK;
+  ranges_t min = start;
+
+  if (first >= last) {
+    for (ranges_t i = start + 1; i < end; ++i)
+      if (fm->doc_prev[i] < fm->doc_prev[min])
+        min = i;
+    return min;
+  }
+
+  // Scan the partial blocks at both ends, and look up the whole blocks.
+  for (ranges_t i = start; i < first * DOC_RMQ_BLOCK; ++i)
+    if (fm->doc_prev[i] < fm->doc_prev[min])
+      min = i;
+  for (ranges_t i = last * DOC_RMQ_BLOCK; i < end; ++i)
+    if (fm->doc_prev[i] < fm->doc_prev[min])
+      min = i;
+
+  size_t l = DocRMQLevels(last - first) - 1;
+  ranges_t left = fm->doc_rmq[l * blocks + first];
+  ranges_t right = fm->doc_rmq[l * blocks + last - (1UL << l)];
+  if (fm->doc_prev[left] < fm->doc_prev[min])
+    min = left;
+  if (fm->doc_prev[right] < fm->doc_prev[min])
+    min = right;
+  return min;
+}
+
+// Return the number of rows of the document in [start, end).
+static ranges_t DocumentFrequency(fm_index *fm, size_t document,
+                                  ranges_t start, ranges_t end) {
+  sa_t *rows = &fm->doc_rows[fm->doc_row_offsets[document]];
+  size_t count = fm->doc_row_offsets[document + 1] -
+                 fm->doc_row_offsets[document];
+  size_t bounds[2];
+  ranges_t keys[2] = {start, end};
+
+  for (int k = 0; k < 2; ++k) {
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (rows[mid] < keys[k])
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    bounds[k] = lo;
+  }
+
+  return bounds[1] - bounds[0];
+}
+
+/* List the distinct documents holding a match in the range [start, end) of
+ *  the F column, with the number of matches in each (Muthukrishnan, 2002).
+ * A row is the first of its document in the range exactly when the previous
+ *  row of that document lies before start, so repeatedly taking the range
+ *  minimum of doc_prev finds each document once. The work depends on the
+ *  number of documents found instead of the number of matches.
+ * On success *documents holds a newly allocated array of *document_count
+ *  entries.
+ * Return 0 on memory allocation error or if the index has no documents.
+ */
+int FMIndexListDocuments(fm_index *fm, ranges_t start, ranges_t end,
+                         fm_document **documents, size_t *document_count) {
+  *documents = NULL;
+  *document_count = 0;
+  if (!fm->doc_starts)
+    return 0;
+  if (start >= end)
+    return 1;
+
+  size_t capacity = 16, count = 0;
+  size_t stack_capacity = 16, top = 0;
+  fm_document *found = malloc(capacity * sizeof(fm_document));
+  ranges_t *stack = malloc(2 * stack_capacity * sizeof(ranges_t));
+  if (!found || !stack)
+    goto error;
+
+  stack[top++] = start;
+  stack[top++] = end;
+  while (top) {
+    ranges_t hi = stack[--top];
+    ranges_t lo = stack[--top];
+    if (lo >= hi)
+      continue;
+
+    ranges_t row = DocRMQ(fm, lo, hi);
+    if (fm->doc_prev[row] > start)
+      continue;
+
+    if (count == capacity) {
+      fm_document *grown = realloc(found, 2 * capacity * sizeof(fm_document));
+      if (!grown)
+        goto error;
+      found = grown;
+      capacity *= 2;
+    }
+    size_t document = FMIndexDocumentOf(fm, FMIndexSA(fm, row));
+    found[count].document = document;
+    found[count].count = DocumentFrequency(fm, document, start, end);
+    ++count;
+
+    if (top + 4 > 2 * stack_capacity) {
+      ranges_t *grown = realloc(stack, 4 * stack_capacity * sizeof(ranges_t));
+      if (!grown)
+        goto error;
+      stack = grown;
+      stack_capacity *= 2;
+    }
+    stack[top++] = lo;
+    stack[top++] = row;
+    stack[top++] = row + 1;
+    stack[top++] = hi;
+  }
+
+  free(stack);
+  *documents = found;
+  *document_count = count;
+  return 1;
+
+error:
+  free(found);
+  free(stack);
+  return 0;
+}
+
+typedef struct construct_job {
+  char *s;
+  fm_index *index;
+} construct_job;
+
+static void *ConstructJob(void *arg) {
+  construct_job *job = arg;
+  job->index = FMIndexConstruct(job->s);
+  return NULL;
+}
+
+/* Construct an FM-index of the given string together with an index of the
+ *  reversed string, which is stored in the reverse member.
+ * If parallel is non-zero both indices are constructed concurrently.
+ * Return NULL on memory allocation error.
+ */
+fm_index *FMIndexConstructBidirectional(char *s, int parallel) {
+  size_t sz = strlen(s);
+  char *reversed = malloc(sz + 1);
+  if (!reversed)
+    return NULL;
+  for (size_t i = 0; i < sz; ++i)
+    reversed[i] = s[sz - 1 - i];
+  reversed[sz] = '\0';
+
+  construct_job jobs[2] = {{s, NULL}, {reversed, NULL}};
+  pthread_t thread;
+  if (parallel && pthread_create(&thread, NULL, &ConstructJob, &jobs[1]) == 0) {
+    ConstructJob(&jobs[0]);
+    pthread_join(thread, NULL);
+  } else {
+    ConstructJob(&jobs[0]);
+    ConstructJob(&jobs[1]);
+  }
+  free(reversed);
+
+  if (!jobs[0].index || !jobs[1].index) {
+    if (jobs[0].index)
+      FMIndexFree(jobs[0].index);
+    if (jobs[1].index)
+      FMIndexFree(jobs[1].index);
+    return NULL;
+  }
+
+  // Only the forward suffix array is needed to locate matches.
+  free(jobs[1].index->sa);
+  jobs[1].index->sa = NULL;
+  jobs[0].index->reverse = jobs[1].index;
+
+  return jobs[0].index;
+}
+
+// Return the number of rows whose suffix starts with a character smaller
+//  than c, which need not occur in the text.
+static ranges_t CharacterStart(fm_index *fm, char c) {
+  int alphabet_idx = AlphabetIndex(fm, c);
+  if (alphabet_idx >= 0)
+    return fm->ranges[2 * alphabet_idx];
+  for (size_t i = 1; i < fm->alphabet_sz; ++i)
+    if (fm->alphabet[i] > c)
+      return fm->ranges[2 * i];
+  return fm->bwt_sz;
+}
+
+// Number of suffixes smaller than c followed by the string whose rank is
+//  row, which is an LF step that also works for characters not in the text.
+static ranges_t ExtendRank(fm_index *fm, char c, ranges_t row) {
+  int alphabet_idx = AlphabetIndex(fm, c);
+  return CharacterStart(fm, c) +
+         ((alphabet_idx >= 0) ? FMIndexOcc(fm, alphabet_idx, row) : 0);
+}
+
+// Compute the Z-array of s: z[i] is the length of the longest common prefix
+//  of s and s[i, sz).
+static void ZArray(int *s, size_t sz, size_t *z) {
+  // [l, r) is the rightmost match with a prefix of s found so far.
+  size_t l = 0, r = 0;
+  if (sz)
+    z[0] = sz;
+  for (size_t i = 1; i < sz; ++i) {
+    z[i] = 0;
+    if (i < r)
+      z[i] = (z[i - l] < r - i) ? z[i - l] : r - i;
+    while (i + z[i] < sz && s[z[i]] == s[i + z[i]])
+      ++z[i];
+    if (i + z[i] > r) {
+      l = i;
+      r = i + z[i];
+    }
+  }
+}
+
+static int CompareRow(const void *a, const void *b) {
+  sa_t i = *(sa_t *)a;
+  sa_t j = *(sa_t *)b;
+  return (i > j) - (i < j);
+}
+
+/* Return the length of the longest suffix of the text that also occurs at
+ *  another position of the text followed by s.
+ * tail holds the last tail_sz characters of the text in reverse, and
+ *  repeated is the length of the longest suffix that occurs twice within the
+ *  text.
+ * Return -1 on memory allocation error.
+ */
+static long LongestRepeatedSuffix(char *tail, size_t tail_sz, size_t repeated,
+                                  char *s, size_t sz) {
+  // Occurrences that reach into s end there, so they are found by matching
+  //  the reversed suffixes against the reversed text followed by s.
+  size_t k = (repeated + sz < tail_sz) ? repeated + sz : tail_sz;
+  size_t str_sz = 2 * k + sz + 1;
+  int *str = malloc(str_sz * sizeof(int));
+  size_t *z = malloc(str_sz * sizeof(size_t));
+  if (!str || !z) {
+    free(str);
+    free(z);
+    return -1;
+  }
+
+  for (size_t i = 0; i < k; ++i)
+    str[i] = str[k + 1 + sz + i] = (unsigned char)tail[i];
+  str[k] = -1;
+  for (size_t i = 0; i < sz; ++i)
+    str[k + 1 + i] = (unsigned char)s[sz - 1 - i];
+  ZArray(str, str_sz, z);
+
+  size_t longest = repeated;
+  for (size_t i = 0; i < sz; ++i)
+    if (z[k + 1 + i] > longest)
+      longest = z[k + 1 + i];
+
+  free(str);
+  free(z);
+  return longest;
+}
+
+/* Append s to the indexed text, without sorting the suffixes of the text
+ *  again. If the index holds a collection of documents, s is added as a new
+ *  document and must not contain FM_DOCUMENT_SEPARATOR.
+ * Appending only changes the order of the suffixes of the text whose end
+ *  also occurs elsewhere, once followed by s instead of the dollar sign.
+ *  These are the last few suffixes of the text, so only they and the
+ *  suffixes of s are sorted. Each one finds its place among the other
+ *  suffixes by backward search, and a single pass over the rows merges
+ *  them into the BWT and suffix array, taking time linear in the size of
+ *  the index.
+ * The q-gram filter, inverse suffix array samples, document structures and
+ *  pair occurrences are updated, and packed or hybrid indices keep their
+ *  representation.
+ * Return 0 on memory allocation error, if the index has a reverse index or
+ *  LCP array, which need the whole text, or if s has characters that the
+ *  q-gram filter cannot hold because they are not in the alphabet.
+ */
+int FMIndexAppend(fm_index *index, char *s) {
+  if (index->reverse || index->lcp)
+    return 0;
+
+  // Documents are separated from the new one.
+  size_t n = index->bwt_sz - 1;
+  int separate = index->doc_starts != NULL;
+  size_t sz = strlen(s) + separate;
+  for (size_t i = 0; index->qgram_filter && i < sz - separate; ++i)
+    if (AlphabetIndex(index, s[i]) < 0)
+      return 0;
+
+  int ok = 0;
+  char *tail = malloc(n + 1);
+  sa_t *tail_rows = malloc((n + 1) * sizeof(sa_t));
+  char *x = NULL, *y = NULL, *bwt = NULL, *alphabet = NULL;
+  sa_t *y_sa = NULL, *y_ranks = NULL, *sa = NULL, *doc_starts = NULL;
+  ranks_t *ranks = NULL;
+  ranges_t *ranges = NULL;
+  if (!tail || !tail_rows)
+    goto cleanup;
+
+  // Read the text backwards from its end in row 0 with LF, while the
+  //  backward search for the suffix read so far has another occurrence.
+  size_t tail_sz = 0, repeated = 0;
+  ranges_t start = 0, end = index->bwt_sz, row = 0;
+  tail_rows[0] = 0;
+  while (tail_sz < n && end - start > 1) {
+    char c = index->bwt[row];
+    int alphabet_idx = AlphabetIndex(index, c);
+    tail[tail_sz++] = c;
+    row = index->ranges[2 * alphabet_idx] +
+          FMIndexRank(index, row, alphabet_idx) - 1;
+    tail_rows[tail_sz] = row;
+    start = ExtendRank(index, c, start);
+    end = ExtendRank(index, c, end);
+    if (end - start > 1)
+      repeated = tail_sz;
+  }
+
+  // Read as much of the text as an occurrence reaching into s could cover,
+  //  one more character for the BWT and the last q-gram for the filter.
+  size_t needed = repeated + sz + 1;
+  if (index->qgram_filter && needed < index->qgram_q)
+    needed = index->qgram_q;
+  if (needed > n)
+    needed = n;
+  for (; tail_sz < needed; tail_rows[tail_sz] = row) {
+    char c = index->bwt[row];
+    int alphabet_idx = AlphabetIndex(index, c);
+    tail[tail_sz++] = c;
+    row = index->ranges[2 * alphabet_idx] +
+          FMIndexRank(index, row, alphabet_idx) - 1;
+  }
+
+  // The new text, which always starts with the separator of a document.
+  if (!(x = malloc(sz + 1)))
+    goto cleanup;
+  x[0] = FM_DOCUMENT_SEPARATOR;
+  strcpy(&x[separate], s);
+  long resorted = LongestRepeatedSuffix(tail, tail_sz, repeated, x, sz);
+  if (resorted < 0)
+    goto cleanup;
+
+  // The suffixes from s_start on are sorted again, as suffixes of y.
+  size_t s_start = n - resorted;
+  size_t y_sz = resorted + sz;
+  if (!(y = malloc(y_sz + 1)))
+    goto cleanup;
+  for (long i = 0; i < resorted; ++i)
+    y[i] = tail[resorted - 1 - i];
+  memcpy(&y[resorted], x, sz + 1);
+  if (!(y_sa = ConstructSuffixArray(y, y_sz)) ||
+      !(y_ranks = malloc((y_sz + 1) * sizeof(sa_t))))
+    goto cleanup;
+
+  // The rows of the suffixes that are sorted again are left out, and the
+  //  rank of each suffix of y counts only the remaining rows before it.
+  qsort(tail_rows, resorted + 1, sizeof(sa_t), &CompareRow);
+  ranges_t rank = 0;
+  y_ranks[y_sz] = 0;
+  for (size_t i = y_sz; i-- > 0;) {
+    rank = ExtendRank(index, y[i], rank);
+    size_t lo = 0, hi = resorted + 1;
+    while (lo < hi) {
+      size_t mid = lo + (hi - lo) / 2;
+      if (tail_rows[mid] < rank)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    y_ranks[i] = rank - lo;
+  }
+
+  size_t bwt_sz = index->bwt_sz + sz;
+  if (!(bwt = malloc(bwt_sz + 1)) || !(sa = malloc(bwt_sz * sizeof(sa_t))))
+    goto cleanup;
+
+  // Merge the rows that are kept with the sorted suffixes of y.
+  size_t row_idx = 0, skipped = 0, kept = 0, next = 0;
+  for (size_t i = 0; i <= index->bwt_sz; ++i) {
+    if (i < index->bwt_sz && skipped <= (size_t)resorted &&
+        tail_rows[skipped] == i) {
+      ++skipped;
+      continue;
+    }
+    for (; next <= y_sz && y_ranks[y_sa[next]] <= kept; ++next) {
+      sa_t pos = y_sa[next];
+      sa[row_idx] = s_start + pos;
+      if (pos)
+        bwt[row_idx++] = y[pos - 1];
+      else
+        bwt[row_idx++] = (s_start) ? tail[resorted] : '$';
+    }
+    if (i == index->bwt_sz)
+      break;
+    sa[row_idx] = FMIndexSA(index, i);
+    bwt[row_idx++] = index->bwt[i];
+    ++kept;
+  }
+  bwt[bwt_sz] = '\0';
+
+  if (!(alphabet = TextToAlphabet(bwt, bwt_sz)) ||
+      !(ranks = ConstructRankMatrix(bwt, bwt_sz, alphabet)) ||
+      !(ranges = ConstructCharacterRanges(bwt, bwt_sz, alphabet)))
+    goto cleanup;
+  if (separate) {
+    if (!(doc_starts = malloc((index->doc_count + 1) * sizeof(sa_t))))
+      goto cleanup;
+    memcpy(doc_starts, index->doc_starts, index->doc_count * sizeof(sa_t));
+    doc_starts[index->doc_count] = n + 1;
+  }
+
+  // Replace the arrays of the index with the merged ones.
+  int hybrid = index->occ != NULL;
+  int packed = !index->ranks && !hybrid;
+  free(index->bwt);
+  free(index->sa);
+  free(index->ranks);
+  free(index->alphabet);
+  free(index->ranges);
+  PackedVectorFree(&index->packed_ranks);
+  PackedVectorFree(&index->packed_sa);
+  if (hybrid)
+    FMOccFree(index->occ);
+  index->occ = NULL;
+  index->bwt = bwt;
+  index->bwt_sz = bwt_sz;
+  index->sa = sa;
+  index->ranks = ranks;
+  index->alphabet = alphabet;
+  index->alphabet_sz = strlen(alphabet);
+  index->ranges = ranges;
+  InitAlphabetMap(index);
+  bwt = alphabet = NULL;
+  sa = NULL;
+  ranks = NULL;
+  ranges = NULL;
+
+  // The q-grams reaching into s start in the last q - 1 characters.
+  if (index->qgram_filter) {
+    size_t before = (index->qgram_q - 1 < n) ? index->qgram_q - 1 : n;
+    char *grams = malloc(before + sz + 1);
+    if (!grams)
+      goto cleanup;
+    for (size_t i = 0; i < before; ++i)
+      grams[i] = tail[before - 1 - i];
+    memcpy(&grams[before], x, sz + 1);
+    QGramFilterAdd(index, grams);
+    free(grams);
+  }
+  if ((index->isa_samples &&
+       !FMIndexBuildISASamples(index, index->isa_sample_rate)) ||
+      (doc_starts &&
+       !FMIndexSetDocuments(index, doc_starts, index->doc_count + 1)) ||
+      (packed && !FMIndexPack(index)) ||
+      (hybrid && !FMIndexBuildHybridOcc(index)) ||
+      (index->pair_occ && !FMIndexBuildPairOcc(index)))
+    goto cleanup;
+  ok = 1;
+
+cleanup:
+  free(tail);
+  free(x);
+  free(tail_rows);
+  free(y);
+  free(y_sa);
+  free(y_ranks);
+  free(bwt);
+  free(sa);
+  free(alphabet);
+  free(ranks);
+  free(ranges);
+  free(doc_starts);
+  return ok;
+}
+
+/* Replace the rank matrix and suffix array (if any) of the index and its
+ *  reverse index with bit-packed copies, using just enough bits to store
+ *  values up to the BWT size.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexPack(fm_index *index) {
+  unsigned width = PackedWidth(index->bwt_sz);
+  size_t ranks_sz = index->bwt_sz * index->alphabet_sz;
+
+  if (index->ranks) {
+    if (!PackedVectorInit(&index->packed_ranks, ranks_sz, width))
+      return 0;
+    for (size_t i = 0; i < ranks_sz; ++i)
+      PackedSet(&index->packed_ranks, i, index->ranks[i]);
+    free(index->ranks);
+    index->ranks = NULL;
+  }
+
+  if (index->sa) {
+    if (!PackedVectorInit(&index->packed_sa, index->bwt_sz, width))
+      return 0;
+    for (size_t i = 0; i < index->bwt_sz; ++i)
+      PackedSet(&index->packed_sa, i, index->sa[i]);
+    free(index->sa);
+    index->sa = NULL;
+  }
+
+  return (index->reverse) ? FMIndexPack(index->reverse) : 1;
+}
+
+/* Replace the rank matrix (plain or packed) of the index and its reverse
+ *  index with hybrid occurrence structures, which pick the smaller of a
+ *  bitvector and a list of positions for each character. This mostly saves
+ *  space on the many rare characters of skewed alphabets.
+ * Hybrid structures are only kept in memory and indices using them cannot
+ *  be written to file.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexBuildHybridOcc(fm_index *index) {
+  if (!index->occ) {
+    if (!(index->occ =
+              FMOccCreate(index->bwt, index->bwt_sz, index->alphabet)))
+      return 0;
+    free(index->ranks);
+    index->ranks = NULL;
+    PackedVectorFree(&index->packed_ranks);
+  }
+
+  return (index->reverse) ? FMIndexBuildHybridOcc(index->reverse) : 1;
+}
+
+/* Build the occurrences of character pairs, replacing any earlier ones, so
+ *  backward search takes two characters per rank, see pairocc.h. They are
+ *  built from the BWT, so any representation of the rank matrix works.
+ * Return 0 on memory allocation error or if the alphabet has more than
+ *  FM_PAIR_OCC_MAX_SYMBOLS characters besides the dollar sign, 1 otherwise.
+ */
+int FMIndexBuildPairOcc(fm_index *index) {
+  fm_pair_occ *pair_occ = FMPairOccCreate(index->bwt, index->bwt_sz,
+                                          index->alphabet, index->ranges);
+  if (!pair_occ)
+    return 0;
+  if (index->pair_occ)
+    FMPairOccFree(index->pair_occ);
+  index->pair_occ = pair_occ;
+  return 1;
+}
+
+/* Replace bit-packed arrays and hybrid occurrence structures of the index
+ *  and its reverse index with plain arrays, as used by the FPGA kernels.
+ *  Does nothing for unpacked indices.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexUnpack(fm_index *index, int aligned) {
+  if (index->occ) {
+    size_t sigma = index->alphabet_sz;
+    if (!MaybeMallocAligned((void **)&index->ranks,
+                            index->bwt_sz * sigma * sizeof(ranks_t), aligned))
+      return 0;
+    for (size_t i = 0; i < index->bwt_sz; ++i)
+      for (size_t c = 0; c < sigma; ++c)
+        index->ranks[i * sigma + c] = FMOccRank(index->occ, c, i + 1);
+    FMOccFree(index->occ);
+    index->occ = NULL;
+  }
+
+  if (index->packed_ranks.words) {
+    size_t ranks_sz = index->packed_ranks.size;
+    if (!MaybeMallocAligned((void **)&index->ranks, ranks_sz * sizeof(ranks_t),
+                            aligned))
+      return 0;
+    for (size_t i = 0; i < ranks_sz; ++i)
+      index->ranks[i] = PackedGet(&index->packed_ranks, i);
+    PackedVectorFree(&index->packed_ranks);
+  }
+
+  if (index->packed_sa.words) {
+    if (!MaybeMallocAligned((void **)&index->sa, index->bwt_sz * sizeof(sa_t),
+                            aligned))
+      return 0;
+    for (size_t i = 0; i < index->bwt_sz; ++i)
+      index->sa[i] = PackedGet(&index->packed_sa, i);
+    PackedVectorFree(&index->packed_sa);
+  }
+
+  return (index->reverse) ? FMIndexUnpack(index->reverse, aligned) : 1;
+}
+
+static size_t PackedVectorBytes(packed_vector *v) {
+  return (v->words) ? PackedVectorWords(v->size, v->width) * sizeof(uint64_t)
+                    : 0;
+}
+
+// Return the number of bytes used by the index and its optional structures.
+size_t FMIndexSize(fm_index *index) {
+  size_t n = index->bwt_sz, sigma = index->alphabet_sz;
+  size_t sz = sizeof(fm_index) + n + sigma + 2 * sigma * sizeof(ranges_t);
+
+  if (index->ranks)
+    sz += n * sigma * sizeof(ranks_t);
+  else if (index->occ)
+    sz += FMOccSize(index->occ);
+  else
+    sz += PackedVectorBytes(&index->packed_ranks);
+  if (index->pair_occ)
+    sz += FMPairOccSize(index->pair_occ);
+  sz += (index->sa) ? n * sizeof(sa_t) : PackedVectorBytes(&index->packed_sa);
+  if (index->qgram_filter)
+    sz += 1UL << (index->qgram_bits_log2 - 3);
+  if (index->reverse)
+    sz += FMIndexSize(index->reverse);
+  if (index->lcp)
+    sz += 3 * (n + 1) * sizeof(sa_t);
+  if (index->isa_samples)
+    sz += ((n - 1) / index->isa_sample_rate + 1) * sizeof(sa_t);
+  if (index->doc_starts) {
+    size_t blocks = (n + DOC_RMQ_BLOCK - 1) / DOC_RMQ_BLOCK;
+    sz += index->doc_count * sizeof(sa_t) + 2 * n * sizeof(sa_t) +
+          DocRMQLevels(blocks) * blocks * sizeof(sa_t) +
+          (index->doc_count + 1) * sizeof(sa_t);
+  }
+
+  return sz;
+}
+
 void FMIndexFree(fm_index *index) {
   free(index->alphabet);
   free(index->sa);
   free(index->bwt);
   free(index->ranks);
   free(index->ranges);
+  PackedVectorFree(&index->packed_ranks);
+  PackedVectorFree(&index->packed_sa);
+  if (index->occ)
+    FMOccFree(index->occ);
+  if (index->pair_occ)
+    FMPairOccFree(index->pair_occ);
+  free(index->qgram_filter);
+  if (index->reverse)
+    FMIndexFree(index->reverse);
+  free(index->lcp);
+  free(index->lcp_psv);
+  free(index->lcp_nsv);
+  free(index->isa_samples);
+  free(index->doc_starts);
+  free(index->doc_prev);
+  free(index->doc_rmq);
+  free(index->doc_rows);
+  free(index->doc_row_offsets);
   free(index);
 }
 
-int FMIndexDumpToFile(fm_index *index, char *filename) {
-  FILE *f = fopen(filename, "w");
+static void WritePackedVector(packed_vector *v, FILE *f) {
+  fwrite(&v->size, sizeof(v->size), 1, f);
+  fwrite(&v->width, sizeof(v->width), 1, f);
+  fwrite(v->words, sizeof(uint64_t), PackedVectorWords(v->size, v->width), f);
+}
+
+static int ReadPackedVector(packed_vector *v, FILE *f) {
+  size_t size;
+  unsigned width;
+  if (fread(&size, sizeof(size), 1, f) != 1 ||
+      fread(&width, sizeof(width), 1, f) != 1 ||
+      !PackedVectorInit(v, size, width))
+    return 0;
+
+  size_t words = PackedVectorWords(size, width);
+  return fread(v->words, sizeof(uint64_t), words, f) == words;
+}
+
+// Write the compressed reverse index section, whose size is only known
+//  once it is written. Return 0 on write error.
+static int WriteCompressedReverse(fm_index *index, FILE *f) {
+  unsigned tag = FM_SECTION_REVERSE_COMPRESSED;
+  size_t section_sz = 0;
+  fwrite(&tag, sizeof(tag), 1, f);
+  long size_pos = ftell(f);
+  fwrite(&section_sz, sizeof(section_sz), 1, f);
+  if (!FMCompressedWrite(f, index->reverse->bwt, index->bwt_sz, 1, 0) ||
+      !FMCompressedWrite(f, index->reverse->ranks,
+                         index->bwt_sz * index->alphabet_sz, sizeof(ranks_t),
+                         index->alphabet_sz))
+    return 0;
+
+  long end_pos = ftell(f);
+  section_sz = end_pos - size_pos - sizeof(section_sz);
+  return fseek(f, size_pos, SEEK_SET) == 0 &&
+         fwrite(&section_sz, sizeof(section_sz), 1, f) == 1 &&
+         fseek(f, end_pos, SEEK_SET) == 0;
+}
+
+static int DumpIndex(fm_index *index, char *filename, int compressed) {
+  if (index->occ || (index->reverse && index->reverse->occ))
+    return 0;
+  // Only plain arrays are compressed.
+  int packed = !index->ranks;
+  if (compressed &&
+      (packed || (index->reverse && !index->reverse->ranks)))
+    return 0;
+
+  char *tmp_filename;
+  FILE *f = OpenReplacement(filename, &tmp_filename);
   if (!f)
     return 0;
 
+  // Packed and compressed indices are marked by a magic first word.
+  if (packed || compressed) {
+    size_t magic = (packed) ? FM_PACKED_MAGIC : FM_COMPRESSED_MAGIC;
+    fwrite(&magic, sizeof(magic), 1, f);
+  }
+
+  int ok = 1;
   fwrite(&index->bwt_sz, sizeof(index->bwt_sz), 1, f);
-  fwrite(index->bwt, sizeof(char), index->bwt_sz, f);
+  if (compressed)
+    ok = FMCompressedWrite(f, index->bwt, index->bwt_sz, 1, 0);
+  else
+    fwrite(index->bwt, sizeof(char), index->bwt_sz, f);
   fwrite(&index->alphabet_sz, sizeof(index->alphabet_sz), 1, f);
   fwrite(index->alphabet, sizeof(char), index->alphabet_sz, f);
   fwrite(index->ranges, sizeof(ranges_t), 2 * index->alphabet_sz, f);
-  fwrite(index->ranks, sizeof(ranks_t), index->bwt_sz * index->alphabet_sz, f);
-  fwrite(index->sa, sizeof(sa_t), index->bwt_sz, f);
+  if (packed) {
+    WritePackedVector(&index->packed_ranks, f);
+    WritePackedVector(&index->packed_sa, f);
+  } else if (compressed) {
+    // Rows of the rank matrix are coded as differences to the previous row.
+    ok = ok &&
+         FMCompressedWrite(f, index->ranks, index->bwt_sz * index->alphabet_sz,
+                           sizeof(ranks_t), index->alphabet_sz) &&
+         FMCompressedWrite(f, index->sa, index->bwt_sz, sizeof(sa_t), 0);
+  } else {
+    fwrite(index->ranks, sizeof(ranks_t), index->bwt_sz * index->alphabet_sz,
+           f);
+    fwrite(index->sa, sizeof(sa_t), index->bwt_sz, f);
+  }
+
+  // Optional sections, each preceded by its tag and payload size.
+  if (index->qgram_filter) {
+    unsigned tag = FM_SECTION_QGRAM_FILTER;
+    size_t filter_sz = 1UL << (index->qgram_bits_log2 - 3);
+    size_t section_sz = 3 * sizeof(unsigned) + filter_sz;
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&section_sz, sizeof(section_sz), 1, f);
+    fwrite(&index->qgram_q, sizeof(unsigned), 1, f);
+    fwrite(&index->qgram_hashes, sizeof(unsigned), 1, f);
+    fwrite(&index->qgram_bits_log2, sizeof(unsigned), 1, f);
+    fwrite(index->qgram_filter, 1, filter_sz, f);
+  }
+
+  // The symbols and block layout follow from the alphabet and BWT size.
+  if (index->pair_occ) {
+    fm_pair_occ *p = index->pair_occ;
+    unsigned tag = FM_SECTION_PAIR_OCC;
+    size_t starts_sz = p->symbol_count * p->symbol_count * sizeof(unsigned);
+    size_t section_sz =
+        sizeof(unsigned) + starts_sz + p->block_count * p->block_sz;
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&section_sz, sizeof(section_sz), 1, f);
+    fwrite(&p->symbol_count, sizeof(unsigned), 1, f);
+    fwrite(p->starts, 1, starts_sz, f);
+    fwrite(p->blocks, p->block_sz, p->block_count, f);
+  }
+
+  // The reverse index shares the alphabet and character ranges.
+  if (index->reverse && compressed) {
+    ok = ok && WriteCompressedReverse(index, f);
+  } else if (index->reverse && !index->reverse->ranks) {
+    unsigned tag = FM_SECTION_REVERSE_PACKED;
+    size_t section_sz =
+        index->bwt_sz * sizeof(char) + sizeof(size_t) + sizeof(unsigned) +
+        PackedVectorBytes(&index->reverse->packed_ranks);
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&section_sz, sizeof(section_sz), 1, f);
+    fwrite(index->reverse->bwt, sizeof(char), index->bwt_sz, f);
+    WritePackedVector(&index->reverse->packed_ranks, f);
+  } else if (index->reverse) {
+    unsigned tag = FM_SECTION_REVERSE;
+    size_t ranks_sz = index->bwt_sz * index->alphabet_sz;
+    size_t section_sz = index->bwt_sz * sizeof(char) + ranks_sz * sizeof(ranks_t);
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&section_sz, sizeof(section_sz), 1, f);
+    fwrite(index->reverse->bwt, sizeof(char), index->bwt_sz, f);
+    fwrite(index->reverse->ranks, sizeof(ranks_t), ranks_sz, f);
+  }
+
+  // The smaller value arrays are recomputed when reading.
+  if (index->lcp) {
+    unsigned tag = FM_SECTION_LCP;
+    size_t section_sz = (index->bwt_sz + 1) * sizeof(sa_t);
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&section_sz, sizeof(section_sz), 1, f);
+    fwrite(index->lcp, sizeof(sa_t), index->bwt_sz + 1, f);
+  }
+
+  if (index->isa_samples) {
+    unsigned tag = FM_SECTION_ISA_SAMPLES;
+    size_t sample_count = (index->bwt_sz - 1) / index->isa_sample_rate + 1;
+    size_t section_sz = (sample_count + 1) * sizeof(sa_t);
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&section_sz, sizeof(section_sz), 1, f);
+    fwrite(&index->isa_sample_rate, sizeof(sa_t), 1, f);
+    fwrite(index->isa_samples, sizeof(sa_t), sample_count, f);
+  }
+
+  // The listing structures are rebuilt from the boundaries when reading.
+  if (index->doc_starts) {
+    unsigned tag = FM_SECTION_DOCUMENTS;
+    size_t section_sz =
+        sizeof(index->doc_count) + index->doc_count * sizeof(sa_t);
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&section_sz, sizeof(section_sz), 1, f);
+    fwrite(&index->doc_count, sizeof(index->doc_count), 1, f);
+    fwrite(index->doc_starts, sizeof(sa_t), index->doc_count, f);
+  }
+
+  if (!ok) {
+    fclose(f);
+    remove(tmp_filename);
+    free(tmp_filename);
+    return 0;
+  }
+  return CommitReplacement(f, tmp_filename, filename);
+}
+
+/* Write the index to filename. An existing file is replaced atomically, so
+ *  concurrent readers never see a partially written index.
+ * Indices with hybrid occurrence structures cannot be written.
+ * Return 0 on error, 1 otherwise.
+ */
+int FMIndexDumpToFile(fm_index *index, char *filename) {
+  return DumpIndex(index, filename, 0);
+}
+
+/* Write the index to filename like FMIndexDumpToFile, with the BWT, rank
+ *  matrix and suffix array of the index and its reverse index compressed
+ *  in blocks that are decompressed in parallel when reading.
+ * Packed indices cannot be written compressed.
+ * Return 0 on error, 1 otherwise.
+ */
+int FMIndexDumpCompressedToFile(fm_index *index, char *filename) {
+  return DumpIndex(index, filename, 1);
+}
+
+/* Read the reverse index section, copying the alphabet and character
+ *  ranges of the forward index.
+ * Return 0 on error.
+ */
+static int ReadReverseSection(fm_index *index, FILE *f, int aligned,
+                              int packed, int compressed) {
+  fm_index *reverse;
+  if (!(index->reverse = reverse = calloc(1, sizeof(fm_index))))
+    return 0;
+
+  reverse->bwt_sz = index->bwt_sz;
+  reverse->alphabet_sz = index->alphabet_sz;
+  if (!(reverse->alphabet = strdup(index->alphabet)))
+    return 0;
+  if (!(reverse->ranges = malloc(2 * index->alphabet_sz * sizeof(ranges_t))))
+    return 0;
+  memcpy(reverse->ranges, index->ranges,
+         2 * index->alphabet_sz * sizeof(ranges_t));
+  InitAlphabetMap(reverse);
+
+  if (!MaybeMallocAligned((void **)&reverse->bwt,
+                          (reverse->bwt_sz + 1) * sizeof(char), aligned))
+    return 0;
+  if (compressed ? !FMCompressedRead(f, reverse->bwt, reverse->bwt_sz, 1)
+                 : fread(reverse->bwt, sizeof(char), reverse->bwt_sz, f) !=
+                       reverse->bwt_sz)
+    return 0;
+  reverse->bwt[reverse->bwt_sz] = '\0';
+
+  if (packed)
+    return ReadPackedVector(&reverse->packed_ranks, f);
+
+  size_t ranks_sz = reverse->bwt_sz * reverse->alphabet_sz;
+  if (!MaybeMallocAligned((void **)&reverse->ranks, ranks_sz * sizeof(ranks_t),
+                          aligned))
+    return 0;
+  if (compressed)
+    return FMCompressedRead(f, reverse->ranks, ranks_sz, sizeof(ranks_t));
+  if (fread(reverse->ranks, sizeof(ranks_t), ranks_sz, f) != ranks_sz)
+    return 0;
 
-  fclose(f);
+  return 1;
+}
+
+static int ReadDocumentsSection(fm_index *index, FILE *f) {
+  size_t doc_count;
+  if (fread(&doc_count, sizeof(doc_count), 1, f) != 1 || !doc_count)
+    return 0;
+
+  sa_t *doc_starts = malloc(doc_count * sizeof(sa_t));
+  if (!doc_starts)
+    return 0;
+  int ok = fread(doc_starts, sizeof(sa_t), doc_count, f) == doc_count &&
+           FMIndexSetDocuments(index, doc_starts, doc_count);
+  free(doc_starts);
+  return ok;
+}
+
+static int ReadPairOccSection(fm_index *index, FILE *f, size_t section_sz) {
+  fm_pair_occ *p = FMPairOccAlloc(index->alphabet, index->bwt_sz);
+  if (!p)
+    return 0;
+  unsigned symbol_count;
+  size_t starts_sz = p->symbol_count * p->symbol_count * sizeof(unsigned);
+  size_t blocks_sz = p->block_count * p->block_sz;
+  if (fread(&symbol_count, sizeof(symbol_count), 1, f) != 1 ||
+      symbol_count != p->symbol_count ||
+      section_sz != sizeof(unsigned) + starts_sz + blocks_sz ||
+      fread(p->starts, 1, starts_sz, f) != starts_sz ||
+      fread(p->blocks, p->block_sz, p->block_count, f) != p->block_count) {
+    FMPairOccFree(p);
+    return 0;
+  }
+  index->pair_occ = p;
   return 1;
 }
 
 fm_index *FMIndexReadFromFile(char *filename, int aligned) {
+  FM_TRACE_BEGIN(span);
   FILE *f = fopen(filename, "r");
   if (!f)
     return NULL;
@@ -291,11 +1769,19 @@ fm_index *FMIndexReadFromFile(char *filename, int aligned) {
     goto error;
 
   fread(&index->bwt_sz, sizeof(index->bwt_sz), 1, f);
+  int packed = index->bwt_sz == FM_PACKED_MAGIC;
+  int compressed = index->bwt_sz == FM_COMPRESSED_MAGIC;
+  if (packed || compressed)
+    fread(&index->bwt_sz, sizeof(index->bwt_sz), 1, f);
 
   if (!MaybeMallocAligned((void **)&index->bwt,
                           (index->bwt_sz + 1) * sizeof(char), aligned))
     goto error;
-  fread(index->bwt, sizeof(char), index->bwt_sz, f);
+  if (compressed) {
+    if (!FMCompressedRead(f, index->bwt, index->bwt_sz, 1))
+      goto error;
+  } else
+    fread(index->bwt, sizeof(char), index->bwt_sz, f);
   index->bwt[index->bwt_sz] = '\0';
 
   fread(&index->alphabet_sz, sizeof(index->alphabet_sz), 1, f);
@@ -311,18 +1797,93 @@ fm_index *FMIndexReadFromFile(char *filename, int aligned) {
     goto error;
   fread(index->ranges, sizeof(ranges_t), 2 * index->alphabet_sz, f);
 
-  if (!MaybeMallocAligned((void **)&index->ranks,
-                          index->bwt_sz * index->alphabet_sz * sizeof(ranks_t),
-                          aligned))
-    goto error;
-  fread(index->ranks, sizeof(ranks_t), index->bwt_sz * index->alphabet_sz, f);
+  if (packed) {
+    if (!ReadPackedVector(&index->packed_ranks, f) ||
+        !ReadPackedVector(&index->packed_sa, f))
+      goto error;
+  } else {
+    size_t ranks_sz = index->bwt_sz * index->alphabet_sz;
+    if (!MaybeMallocAligned((void **)&index->ranks, ranks_sz * sizeof(ranks_t),
+                            aligned))
+      goto error;
+    if (!MaybeMallocAligned((void **)&index->sa, index->bwt_sz * sizeof(sa_t),
+                            aligned))
+      goto error;
+    if (compressed) {
+      if (!FMCompressedRead(f, index->ranks, ranks_sz, sizeof(ranks_t)) ||
+          !FMCompressedRead(f, index->sa, index->bwt_sz, sizeof(sa_t)))
+        goto error;
+    } else {
+      fread(index->ranks, sizeof(ranks_t), ranks_sz, f);
+      fread(index->sa, sizeof(sa_t), index->bwt_sz, f);
+    }
+  }
 
-  if (!MaybeMallocAligned((void **)&index->sa, index->bwt_sz * sizeof(sa_t),
-                          aligned))
-    goto error;
-  fread(index->sa, sizeof(sa_t), index->bwt_sz, f);
+  InitAlphabetMap(index);
+
+  // Read optional sections until the end of the file, skipping unknown ones.
+  unsigned tag;
+  size_t section_sz;
+  while (fread(&tag, sizeof(tag), 1, f) == 1) {
+    if (fread(&section_sz, sizeof(section_sz), 1, f) != 1)
+      goto error;
+
+    switch (tag) {
+    case FM_SECTION_QGRAM_FILTER:
+      fread(&index->qgram_q, sizeof(unsigned), 1, f);
+      fread(&index->qgram_hashes, sizeof(unsigned), 1, f);
+      fread(&index->qgram_bits_log2, sizeof(unsigned), 1, f);
+      if (index->qgram_bits_log2 < 3 || index->qgram_bits_log2 > 40)
+        goto error;
+      size_t filter_sz = 1UL << (index->qgram_bits_log2 - 3);
+      if (!(index->qgram_filter = malloc(filter_sz)))
+        goto error;
+      if (fread(index->qgram_filter, 1, filter_sz, f) != filter_sz)
+        goto error;
+      break;
+    case FM_SECTION_REVERSE:
+    case FM_SECTION_REVERSE_PACKED:
+    case FM_SECTION_REVERSE_COMPRESSED:
+      if (!ReadReverseSection(index, f, aligned,
+                              tag == FM_SECTION_REVERSE_PACKED,
+                              tag == FM_SECTION_REVERSE_COMPRESSED))
+        goto error;
+      break;
+    case FM_SECTION_LCP:
+      if (!(index->lcp = malloc((index->bwt_sz + 1) * sizeof(sa_t))))
+        goto error;
+      if (fread(index->lcp, sizeof(sa_t), index->bwt_sz + 1, f) !=
+          index->bwt_sz + 1)
+        goto error;
+      if (!InitLCPNavigation(index))
+        goto error;
+      break;
+    case FM_SECTION_ISA_SAMPLES:
+      fread(&index->isa_sample_rate, sizeof(sa_t), 1, f);
+      if (!index->isa_sample_rate)
+        goto error;
+      size_t sample_count = (index->bwt_sz - 1) / index->isa_sample_rate + 1;
+      if (!(index->isa_samples = malloc(sample_count * sizeof(sa_t))))
+        goto error;
+      if (fread(index->isa_samples, sizeof(sa_t), sample_count, f) !=
+          sample_count)
+        goto error;
+      break;
+    case FM_SECTION_DOCUMENTS:
+      if (!ReadDocumentsSection(index, f))
+        goto error;
+      break;
+    case FM_SECTION_PAIR_OCC:
+      if (!ReadPairOccSection(index, f, section_sz))
+        goto error;
+      break;
+    default:
+      fseek(f, section_sz, SEEK_CUR);
+    }
+  }
 
   fclose(f);
+  FM_TRACE_END(span, "load", 0, 0);
   return index;
 
 error:
@@ -337,6 +1898,22 @@ error:
       free(index->ranks);
     if (index->sa)
       free(index->sa);
+    PackedVectorFree(&index->packed_ranks);
+    PackedVectorFree(&index->packed_sa);
+    free(index->qgram_filter);
+    if (index->pair_occ)
+      FMPairOccFree(index->pair_occ);
+    if (index->reverse)
+      FMIndexFree(index->reverse);
+    free(index->lcp);
+    free(index->lcp_psv);
+    free(index->lcp_nsv);
+    free(index->isa_samples);
+    free(index->doc_starts);
+    free(index->doc_prev);
+    free(index->doc_rmq);
+    free(index->doc_rows);
+    free(index->doc_row_offsets);
     free(index);
   }
 
@@ -6,6 +6,10 @@ extern "C" {
 
 #include <stdlib.h>
 
+#include "occ.h"
+#include "packed.h"
+#include "pairocc.h"
+
 typedef unsigned ranges_t;
 typedef unsigned ranks_t;
 typedef unsigned sa_t;
@@ -17,18 +21,132 @@ typedef struct fm_index {
   ranks_t *ranks;
   sa_t *sa;
   ranges_t *ranges;
+  // Bit-packed rank matrix and suffix array, used instead of ranks and sa
+  //  (which are then NULL) after FMIndexPack.
+  packed_vector packed_ranks;
+  packed_vector packed_sa;
+  // Hybrid occurrence structure, used instead of ranks and packed_ranks
+  //  after FMIndexBuildHybridOcc.
+  fm_occ *occ;
+  // Optional occurrences of character pairs, NULL if the index has none.
+  //  Backward search then takes two pattern characters per step.
+  fm_pair_occ *pair_occ;
+  // Index of each character in the alphabet, or -1 if it does not occur.
+  short alphabet_map[256];
+  // Optional q-gram presence filter, NULL if the index has none.
+  // With qgram_hashes == 0 every q-gram has its own bit, otherwise it is a
+  //  Bloom filter with that many hash functions.
+  unsigned char *qgram_filter;
+  unsigned qgram_q;
+  unsigned qgram_hashes;
+  unsigned qgram_bits_log2;
+  // Optional index of the reversed text for bidirectional search, NULL if
+  //  the index has none. It has no suffix array of its own.
+  struct fm_index *reverse;
+  // Optional LCP array with bwt_sz + 1 entries, NULL if the index has none.
+  // lcp[i] is the longest common prefix of the suffixes at sa[i - 1] and
+  //  sa[i], and the first and last entries are zero. lcp_psv and lcp_nsv
+  //  hold the previous and next entry with a smaller value, used to widen a
+  //  range to its parent interval.
+  sa_t *lcp;
+  sa_t *lcp_psv;
+  sa_t *lcp_nsv;
+  // Optional samples of the inverse suffix array for text extraction, NULL
+  //  if the index has none. isa_samples[k] is the row of the suffix starting
+  //  at text position k * isa_sample_rate.
+  sa_t *isa_samples;
+  sa_t isa_sample_rate;
+  // Optional document boundaries for collections of texts, NULL if the index
+  //  has none. Documents are separated by FM_DOCUMENT_SEPARATOR and
+  //  doc_starts holds the text position where each one starts.
+  sa_t *doc_starts;
+  size_t doc_count;
+  // For every row, one more than the previous row of the same document (0 if
+  //  there is none), with a range minimum structure over it.
+  sa_t *doc_prev;
+  sa_t *doc_rmq;
+  // Rows of each document in increasing order: the rows of document d are
+  //  doc_rows[doc_row_offsets[d], doc_row_offsets[d + 1]).
+  sa_t *doc_rows;
+  sa_t *doc_row_offsets;
 } fm_index;
 
+#define FM_DOCUMENT_SEPARATOR '\x1e'
+
+typedef struct fm_document {
+  size_t document;
+  ranges_t count;
+} fm_document;
+
+// Suffix array entry i, from either representation.
+static inline sa_t FMIndexSA(fm_index *fm, size_t i) {
+  return (fm->sa) ? fm->sa[i] : (sa_t)PackedGet(&fm->packed_sa, i);
+}
+
+// Number of occurrences of the character with the given alphabet index in
+//  bwt[0, pos], from any representation of the rank matrix.
+static inline ranks_t FMIndexRank(fm_index *fm, size_t pos, int alphabet_idx) {
+  size_t i = fm->alphabet_sz * pos + alphabet_idx;
+  if (fm->ranks)
+    return fm->ranks[i];
+  if (fm->occ)
+    return FMOccRank(fm->occ, alphabet_idx, pos + 1);
+  return PackedGet(&fm->packed_ranks, i);
+}
+
+// Number of occurrences of the character with the given alphabet index in
+//  bwt[0, pos).
+static inline ranks_t FMIndexOcc(fm_index *fm, int alphabet_idx,
+                                 ranges_t pos) {
+  return (pos) ? FMIndexRank(fm, pos - 1, alphabet_idx) : 0;
+}
+
+char *TextToAlphabet(char *text, size_t sz);
+sa_t *ConstructSuffixArray(char *s, size_t sz);
+char *ConstructBWT(char *s, size_t sz, sa_t *suffix_array);
+ranks_t *ConstructRankMatrix(char *bwt, size_t sz, char *alphabet);
+ranges_t *ConstructCharacterRanges(char *bwt, size_t sz, char *alphabet);
+
 fm_index *FMIndexConstruct(char *s);
+fm_index *FMIndexConstructBidirectional(char *s, int parallel);
+int FMIndexAppend(fm_index *index, char *s);
 void FMIndexFree(fm_index *index);
+int FMIndexPack(fm_index *index);
+int FMIndexUnpack(fm_index *index, int aligned);
+int FMIndexBuildHybridOcc(fm_index *index);
+int FMIndexBuildPairOcc(fm_index *index);
+size_t FMIndexSize(fm_index *index);
+
+int FMIndexBuildQGramFilter(fm_index *index, char *s, unsigned q,
+                            unsigned bits_log2);
+int FMIndexQGramFilterRejects(fm_index *fm, char *pattern, size_t pattern_sz);
+int FMIndexBuildLCP(fm_index *index, char *s);
+int FMIndexBuildISASamples(fm_index *index, sa_t rate);
+int FMIndexExtract(fm_index *fm, size_t pos, size_t len, char *out);
+int FMIndexSetDocuments(fm_index *index, sa_t *doc_starts, size_t doc_count);
+size_t FMIndexDocumentOf(fm_index *fm, sa_t pos);
+int FMIndexListDocuments(fm_index *fm, ranges_t start, ranges_t end,
+                         fm_document **documents, size_t *document_count);
+int FMIndexExtractSnippets(fm_index *fm, ranges_t start, ranges_t end,
+                           size_t before, size_t after, char *snippets);
 
 fm_index *FMIndexReadFromFile(char *filename, int aligned);
 int FMIndexDumpToFile(fm_index *index, char *filename);
+int FMIndexDumpCompressedToFile(fm_index *index, char *filename);
 
 void FMIndexFindMatchRange(fm_index *fm, char *pattern, size_t pattern_sz,
                            ranges_t *start, ranges_t *end);
+int FMIndexFindMatchRangeBatch(fm_index *fm, char *patterns,
+                               unsigned pattern_count, size_t pattern_sz,
+                               ranges_t *starts, ranges_t *ends,
+                               unsigned long *lf_steps,
+                               unsigned long *lf_steps_saved);
 void FMIndexFindRangeIndices(fm_index *fm, ranges_t start, ranges_t end,
                              unsigned long **match_indices);
+int FMIndexFindRangeIndicesBatch(fm_index *fm, ranges_t *starts,
+                                 ranges_t *ends, unsigned count,
+                                 unsigned long **offsets,
+                                 unsigned long **positions);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,444 @@
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+
+#include "fmindex.h"
+
+#include <string.h>
+
+/* Python bindings.
+ * fmpy.Index loads an index once, and searches batches of patterns held in
+ *  any contiguous buffer: a two-dimensional uint8 NumPy array with one
+ *  pattern per row, a one-dimensional array of dtype S<length>, or bytes
+ *  with the pattern length given. Results are allocated by the C code and
+ *  handed to Python without copying, as NumPy arrays if NumPy can be
+ *  imported and as memoryviews otherwise. The GIL is released while
+ *  searching, so Python threads querying the same index run in parallel.
+ *
+ *   import fmpy, numpy as np
+ *   index = fmpy.Index("text.fm")
+ *   patterns = np.frombuffer(b"ACGTACGA", dtype=np.uint8).reshape(2, 4)
+ *   counts = index.count(patterns)
+ *   offsets, positions = index.locate(patterns)
+ *
+ * Build with make python, which needs python3-config.
+ */
+
+// Result memory owned by Python, exported through the buffer protocol.
+typedef struct {
+  PyObject_HEAD void *data;
+  Py_ssize_t length;
+  Py_ssize_t itemsize;
+  const char *format;
+} result_object;
+
+typedef struct {
+  PyObject_HEAD fm_index *fm;
+  // LF steps taken and reused by the last search, see lf_steps.
+  unsigned long lf_steps;
+  unsigned long lf_steps_saved;
+} index_object;
+
+static PyTypeObject result_type;
+// NumPy module, or None if it cannot be imported.
+static PyObject *numpy;
+
+static int ResultGetBuffer(PyObject *self, Py_buffer *view, int flags) {
+  result_object *r = (result_object *)self;
+  int ret = PyBuffer_FillInfo(view, self, r->data, r->length * r->itemsize, 0,
+                              flags);
+  if (ret == 0) {
+    // FillInfo describes bytes, so the element type is filled in here.
+    view->itemsize = r->itemsize;
+    if (flags & PyBUF_FORMAT)
+      view->format = (char *)r->format;
+    if (flags & PyBUF_ND) {
+      view->shape = &r->length;
+      if (flags & PyBUF_STRIDES)
+        view->strides = &view->itemsize;
+    }
+  }
+  return ret;
+}
+
+static void ResultDealloc(PyObject *self) {
+  free(((result_object *)self)->data);
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyBufferProcs result_buffer = {ResultGetBuffer, NULL};
+
+static PyTypeObject result_type = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "fmpy.Result",
+    .tp_basicsize = sizeof(result_object),
+    .tp_dealloc = ResultDealloc,
+    .tp_as_buffer = &result_buffer,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Memory of a search result, viewed as an array.",
+};
+
+/* Wrap length elements at data, which the returned array then owns, or free
+ *  data on error. format is a struct module code matching the C type.
+ * Return NULL with an exception set on error.
+ */
+static PyObject *WrapResult(void *data, Py_ssize_t length, Py_ssize_t itemsize,
+                            const char *format) {
+  result_object *r = PyObject_New(result_object, &result_type);
+  if (!r) {
+    free(data);
+    return NULL;
+  }
+  r->data = data;
+  r->length = length;
+  r->itemsize = itemsize;
+  r->format = format;
+
+  // Both views keep the result alive and share its memory.
+  PyObject *array = (numpy != Py_None)
+                        ? PyObject_CallMethod(numpy, "asarray", "O", r)
+                        : PyMemoryView_FromObject((PyObject *)r);
+  Py_DECREF(r);
+  return array;
+}
+
+#define WRAP_RANGES(data, length)                                              \
+  WrapResult(data, length, sizeof(ranges_t), "I")
+#define WRAP_POSITIONS(data, length)                                           \
+  WrapResult(data, length, sizeof(unsigned long), "L")
+
+// A batch of patterns taken from a Python buffer.
+typedef struct search_args {
+  fm_index *fm;
+  Py_buffer view;
+  size_t pattern_sz;
+  unsigned pattern_count;
+  int batch;
+  unsigned long lf_steps;
+  unsigned long lf_steps_saved;
+} search_args;
+
+// Methods other than __init__ need a loaded index.
+static fm_index *LoadedIndex(PyObject *self) {
+  fm_index *fm = ((index_object *)self)->fm;
+  if (!fm)
+    PyErr_SetString(PyExc_RuntimeError, "index is not loaded");
+  return fm;
+}
+
+/* Parse the arguments of a search method and get the buffer of patterns.
+ *  The pattern length is taken from the shape or item size unless given,
+ *  in which case the buffer is split into patterns of that length.
+ * Return 0 with an exception set on error, 1 otherwise, after which the
+ *  buffer must be released.
+ */
+static int ParseSearchArgs(PyObject *self, PyObject *args, PyObject *kwds,
+                           search_args *s) {
+  static char *keywords[] = {"patterns", "pattern_sz", "batch", NULL};
+  PyObject *obj;
+  Py_ssize_t pattern_sz = 0;
+  s->batch = 1;
+  s->lf_steps = s->lf_steps_saved = 0;
+  if (!(s->fm = LoadedIndex(self)) ||
+      !PyArg_ParseTupleAndKeywords(args, kwds, "O|np", keywords, &obj,
+                                   &pattern_sz, &s->batch))
+    return 0;
+  Py_buffer *view = &s->view;
+  if (PyObject_GetBuffer(obj, view, PyBUF_C_CONTIGUOUS | PyBUF_FORMAT) != 0)
+    return 0;
+
+  // Only bytes are accepted, as uint8, char or fixed-size strings.
+  const char *f = view->format;
+  while (f && (*f == '@' || *f == '=' || *f == '<' || *f == '>' || *f == '|'))
+    ++f;
+  while (f && *f >= '0' && *f <= '9')
+    ++f;
+  if (f && strcmp(f, "B") != 0 && strcmp(f, "b") != 0 && strcmp(f, "c") != 0 &&
+      strcmp(f, "s") != 0) {
+    PyErr_Format(PyExc_TypeError, "patterns must be bytes, not format '%s'",
+                 view->format);
+    goto error;
+  }
+
+  if (pattern_sz <= 0) {
+    if (view->ndim == 2 && view->itemsize == 1)
+      pattern_sz = view->shape[1];
+    else if (view->ndim == 1 && view->itemsize > 1)
+      pattern_sz = view->itemsize;
+    else {
+      PyErr_SetString(PyExc_ValueError,
+                      "pattern_sz is required for flat pattern buffers");
+      goto error;
+    }
+  }
+  if (!pattern_sz || view->len % pattern_sz != 0) {
+    PyErr_SetString(PyExc_ValueError,
+                    "buffer length is not a multiple of the pattern length");
+    goto error;
+  }
+  // Offsets of located positions take one more entry than there are
+  //  patterns.
+  if (view->len / pattern_sz >= (Py_ssize_t)(unsigned)-1) {
+    PyErr_SetString(PyExc_OverflowError, "too many patterns");
+    goto error;
+  }
+  s->pattern_sz = pattern_sz;
+  s->pattern_count = view->len / pattern_sz;
+  return 1;
+
+error:
+  PyBuffer_Release(view);
+  return 0;
+}
+
+/* Search the patterns into newly allocated starts and ends, one pattern at
+ *  a time or as a batch sharing common suffixes. Called without the GIL.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+static int Search(search_args *s, ranges_t **starts, ranges_t **ends) {
+  char *patterns = s->view.buf;
+  unsigned count = s->pattern_count;
+  // One extra entry, so empty batches allocate too.
+  *starts = malloc((count + 1) * sizeof(ranges_t));
+  *ends = malloc((count + 1) * sizeof(ranges_t));
+  if (!*starts || !*ends)
+    goto error;
+
+  if (s->batch) {
+    if (count && !FMIndexFindMatchRangeBatch(s->fm, patterns, count,
+                                             s->pattern_sz, *starts, *ends,
+                                             &s->lf_steps, &s->lf_steps_saved))
+      goto error;
+  } else {
+    for (unsigned i = 0; i < count; ++i)
+      FMIndexFindMatchRange(s->fm, &patterns[i * s->pattern_sz],
+                            s->pattern_sz, &(*starts)[i], &(*ends)[i]);
+  }
+  return 1;
+
+error:
+  free(*starts);
+  free(*ends);
+  return 0;
+}
+
+// Keep the LF step counts of a search, once the GIL is held again.
+static void KeepSteps(PyObject *self, search_args *s) {
+  index_object *index = (index_object *)self;
+  index->lf_steps = s->lf_steps;
+  index->lf_steps_saved = s->lf_steps_saved;
+}
+
+static PyObject *IndexSearch(PyObject *self, PyObject *args, PyObject *kwds) {
+  search_args s;
+  if (!ParseSearchArgs(self, args, kwds, &s))
+    return NULL;
+
+  ranges_t *starts, *ends;
+  int ok;
+  Py_BEGIN_ALLOW_THREADS;
+  ok = Search(&s, &starts, &ends);
+  Py_END_ALLOW_THREADS;
+  PyBuffer_Release(&s.view);
+  if (!ok)
+    return PyErr_NoMemory();
+  KeepSteps(self, &s);
+
+  PyObject *start_array = WRAP_RANGES(starts, s.pattern_count);
+  PyObject *end_array = WRAP_RANGES(ends, s.pattern_count);
+  if (!start_array || !end_array) {
+    Py_XDECREF(start_array);
+    Py_XDECREF(end_array);
+    return NULL;
+  }
+  return Py_BuildValue("(NN)", start_array, end_array);
+}
+
+static PyObject *IndexCount(PyObject *self, PyObject *args, PyObject *kwds) {
+  search_args s;
+  if (!ParseSearchArgs(self, args, kwds, &s))
+    return NULL;
+
+  // Counts replace the starts in place.
+  ranges_t *starts, *ends;
+  int ok;
+  Py_BEGIN_ALLOW_THREADS;
+  if ((ok = Search(&s, &starts, &ends))) {
+    for (unsigned i = 0; i < s.pattern_count; ++i)
+      starts[i] = ends[i] - starts[i];
+    free(ends);
+  }
+  Py_END_ALLOW_THREADS;
+  PyBuffer_Release(&s.view);
+  if (!ok)
+    return PyErr_NoMemory();
+  KeepSteps(self, &s);
+  return WRAP_RANGES(starts, s.pattern_count);
+}
+
+static PyObject *IndexLocate(PyObject *self, PyObject *args, PyObject *kwds) {
+  search_args s;
+  if (!ParseSearchArgs(self, args, kwds, &s))
+    return NULL;
+
+  ranges_t *starts, *ends;
+  unsigned long *offsets, *positions;
+  int ok;
+  Py_BEGIN_ALLOW_THREADS;
+  if ((ok = Search(&s, &starts, &ends))) {
+    ok = FMIndexFindRangeIndicesBatch(s.fm, starts, ends, s.pattern_count,
+                                      &offsets, &positions);
+    free(starts);
+    free(ends);
+  }
+  Py_END_ALLOW_THREADS;
+  PyBuffer_Release(&s.view);
+  if (!ok)
+    return PyErr_NoMemory();
+  KeepSteps(self, &s);
+
+  Py_ssize_t total = offsets[s.pattern_count];
+  PyObject *offset_array = WRAP_POSITIONS(offsets, s.pattern_count + 1);
+  PyObject *position_array = WRAP_POSITIONS(positions, total);
+  if (!offset_array || !position_array) {
+    Py_XDECREF(offset_array);
+    Py_XDECREF(position_array);
+    return NULL;
+  }
+  return Py_BuildValue("(NN)", offset_array, position_array);
+}
+
+static int IndexInit(PyObject *self, PyObject *args, PyObject *kwds) {
+  static char *keywords[] = {"filename", NULL};
+  index_object *index = (index_object *)self;
+  PyObject *filename;
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&", keywords,
+                                   PyUnicode_FSConverter, &filename))
+    return -1;
+  if (index->fm) {
+    PyErr_SetString(PyExc_RuntimeError, "index is already loaded");
+    Py_DECREF(filename);
+    return -1;
+  }
+
+  fm_index *fm;
+  Py_BEGIN_ALLOW_THREADS;
+  fm = FMIndexReadFromFile(PyBytes_AS_STRING(filename), 0);
+  Py_END_ALLOW_THREADS;
+  if (!fm) {
+    PyErr_Format(PyExc_OSError, "failed to read FM-index %s",
+                 PyBytes_AS_STRING(filename));
+    Py_DECREF(filename);
+    return -1;
+  }
+  Py_DECREF(filename);
+  index->fm = fm;
+  return 0;
+}
+
+static void IndexDealloc(PyObject *self) {
+  index_object *index = (index_object *)self;
+  if (index->fm)
+    FMIndexFree(index->fm);
+  Py_TYPE(self)->tp_free(self);
+}
+
+static PyObject *IndexGetLength(PyObject *self, void *closure) {
+  (void)closure;
+  fm_index *fm = LoadedIndex(self);
+  // The BWT holds one more character, the dollar sign.
+  return (fm) ? PyLong_FromSize_t(fm->bwt_sz - 1) : NULL;
+}
+
+static PyObject *IndexGetAlphabet(PyObject *self, void *closure) {
+  (void)closure;
+  fm_index *fm = LoadedIndex(self);
+  return (fm) ? PyBytes_FromStringAndSize(fm->alphabet, fm->alphabet_sz)
+              : NULL;
+}
+
+static PyObject *IndexGetNbytes(PyObject *self, void *closure) {
+  (void)closure;
+  fm_index *fm = LoadedIndex(self);
+  return (fm) ? PyLong_FromSize_t(FMIndexSize(fm)) : NULL;
+}
+
+static PyObject *IndexGetLfSteps(PyObject *self, void *closure) {
+  (void)closure;
+  return PyLong_FromUnsignedLong(((index_object *)self)->lf_steps);
+}
+
+static PyObject *IndexGetLfStepsSaved(PyObject *self, void *closure) {
+  (void)closure;
+  return PyLong_FromUnsignedLong(((index_object *)self)->lf_steps_saved);
+}
+
+static PyMethodDef index_methods[] = {
+    {"search", (PyCFunction)(void (*)(void))IndexSearch,
+     METH_VARARGS | METH_KEYWORDS,
+     "search(patterns, pattern_sz=0, batch=True) -> (starts, ends)\n\n"
+     "Suffix array ranges of the patterns as uint32 arrays. With batch, "
+     "patterns\nsharing a suffix share its LF steps."},
+    {"count", (PyCFunction)(void (*)(void))IndexCount,
+     METH_VARARGS | METH_KEYWORDS,
+     "count(patterns, pattern_sz=0, batch=True) -> counts\n\n"
+     "Number of occurrences of each pattern as a uint32 array."},
+    {"locate", (PyCFunction)(void (*)(void))IndexLocate,
+     METH_VARARGS | METH_KEYWORDS,
+     "locate(patterns, pattern_sz=0, batch=True) -> (offsets, positions)\n\n"
+     "Text positions of all occurrences as uint64 arrays: those of pattern "
+     "i are\npositions[offsets[i]:offsets[i + 1]], in suffix array order."},
+    {NULL, NULL, 0, NULL},
+};
+
+static PyGetSetDef index_getset[] = {
+    {"length", IndexGetLength, NULL, "Length of the indexed text.", NULL},
+    {"alphabet", IndexGetAlphabet, NULL, "Characters of the text.", NULL},
+    {"nbytes", IndexGetNbytes, NULL, "Memory used by the index.", NULL},
+    {"lf_steps", IndexGetLfSteps, NULL,
+     "LF steps taken by the last batch search, 0 without batch.", NULL},
+    {"lf_steps_saved", IndexGetLfStepsSaved, NULL,
+     "LF steps the last batch search reused for shared suffixes.", NULL},
+    {NULL, NULL, NULL, NULL, NULL},
+};
+
+static PyTypeObject index_type = {
+    PyVarObject_HEAD_INIT(NULL, 0).tp_name = "fmpy.Index",
+    .tp_basicsize = sizeof(index_object),
+    .tp_dealloc = IndexDealloc,
+    .tp_flags = Py_TPFLAGS_DEFAULT,
+    .tp_doc = "Index(filename)\n\nFM-index read from a file written by "
+              "construct.",
+    .tp_methods = index_methods,
+    .tp_getset = index_getset,
+    .tp_init = IndexInit,
+    .tp_new = PyType_GenericNew,
+};
+
+static struct PyModuleDef fmpy_module = {
+    PyModuleDef_HEAD_INIT, .m_name = "fmpy",
+    .m_doc = "Batched FM-index searches over NumPy arrays.", .m_size = -1,
+};
+
+PyMODINIT_FUNC PyInit_fmpy(void) {
+  if (PyType_Ready(&result_type) < 0 || PyType_Ready(&index_type) < 0)
+    return NULL;
+
+  // NumPy is optional: without it, results are memoryviews.
+  if (!(numpy = PyImport_ImportModule("numpy"))) {
+    if (!PyErr_ExceptionMatches(PyExc_ImportError))
+      return NULL;
+    PyErr_Clear();
+    Py_INCREF(Py_None);
+    numpy = Py_None;
+  }
+
+  PyObject *module = PyModule_Create(&fmpy_module);
+  if (!module)
+    return NULL;
+  Py_INCREF(&index_type);
+  if (PyModule_AddObject(module, "Index", (PyObject *)&index_type) < 0) {
+    Py_DECREF(&index_type);
+    Py_DECREF(module);
+    return NULL;
+  }
+  return module;
+}
@@ -0,0 +1,417 @@
+#include "fmindex.h"
+#include "util.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define CACHE_LINE_LOG2 6
+#define PAGE_LOG2 12
+#define HUGE_PAGE_LOG2 21
+
+/* Reuse distances of a stream of accesses to blocks of 2^block_log2 bytes.
+ * The reuse distance of an access is the number of distinct blocks accessed
+ *  since the last access to the same block, so an LRU cache of c blocks hits
+ *  exactly the accesses with a distance below c. A Fenwick tree over the
+ *  access times marks the last access of every block, so the distance is
+ *  the number of marks after the previous access of the block.
+ */
+typedef struct reuse_profile {
+  unsigned block_log2;
+  // Hash table from block to the time of its last access plus one.
+  uint64_t *blocks;
+  size_t *last;
+  size_t capacity;
+  size_t distinct;
+  unsigned *tree;
+  size_t tree_sz;
+  size_t time;
+  // Accesses by floor(log2(distance + 1)), and first accesses.
+  unsigned long histogram[64];
+  unsigned long cold;
+} reuse_profile;
+
+static int ReuseProfileInit(reuse_profile *p, unsigned block_log2,
+                            size_t access_count) {
+  memset(p, 0, sizeof(reuse_profile));
+  p->block_log2 = block_log2;
+  p->capacity = 1024;
+  p->tree_sz = access_count + 1;
+  return (p->blocks = malloc(p->capacity * sizeof(uint64_t))) &&
+         (p->last = calloc(p->capacity, sizeof(size_t))) &&
+         (p->tree = calloc(p->tree_sz, sizeof(unsigned)));
+}
+
+static void ReuseProfileFree(reuse_profile *p) {
+  free(p->blocks);
+  free(p->last);
+  free(p->tree);
+}
+
+static void TreeAdd(reuse_profile *p, size_t i, int value) {
+  for (++i; i < p->tree_sz; i += i & -i)
+    p->tree[i] += value;
+}
+
+// Return the number of marks at times below i.
+static size_t TreeSum(reuse_profile *p, size_t i) {
+  size_t sum = 0;
+  for (; i; i -= i & -i)
+    sum += p->tree[i];
+  return sum;
+}
+
+// Return the slot of the block in the hash table, which is empty if the
+//  block has not been accessed yet.
+static size_t FindSlot(uint64_t *blocks, size_t *last, size_t capacity,
+                       uint64_t block) {
+  size_t slot = (block * 0x9e3779b97f4a7c15UL) & (capacity - 1);
+  while (last[slot] && blocks[slot] != block)
+    slot = (slot + 1) & (capacity - 1);
+  return slot;
+}
+
+static int Grow(reuse_profile *p) {
+  size_t capacity = 2 * p->capacity;
+  uint64_t *blocks = malloc(capacity * sizeof(uint64_t));
+  size_t *last = calloc(capacity, sizeof(size_t));
+  if (!blocks || !last) {
+    free(blocks);
+    free(last);
+    return 0;
+  }
+
+  for (size_t i = 0; i < p->capacity; ++i)
+    if (p->last[i]) {
+      size_t slot = FindSlot(blocks, last, capacity, p->blocks[i]);
+      blocks[slot] = p->blocks[i];
+      last[slot] = p->last[i];
+    }
+  free(p->blocks);
+  free(p->last);
+  p->blocks = blocks;
+  p->last = last;
+  p->capacity = capacity;
+  return 1;
+}
+
+static int ReuseProfileAccess(reuse_profile *p, uint64_t offset) {
+  if (2 * (p->distinct + 1) > p->capacity && !Grow(p))
+    return 0;
+
+  uint64_t block = offset >> p->block_log2;
+  size_t slot = FindSlot(p->blocks, p->last, p->capacity, block);
+  if (p->last[slot]) {
+    size_t previous = p->last[slot] - 1;
+    size_t distance = TreeSum(p, p->time) - TreeSum(p, previous + 1);
+    unsigned bucket = 0;
+    while ((distance + 1) >> (bucket + 1))
+      ++bucket;
+    ++p->histogram[bucket];
+    TreeAdd(p, previous, -1);
+  } else {
+    ++p->cold;
+    ++p->distinct;
+    p->blocks[slot] = block;
+  }
+  p->last[slot] = p->time + 1;
+  TreeAdd(p, p->time++, 1);
+  return 1;
+}
+
+// Return the fraction of accesses that an LRU cache of the given number of
+//  blocks hits, rounded down to whole histogram buckets.
+static double HitRate(reuse_profile *p, size_t blocks) {
+  unsigned long hits = 0;
+  for (unsigned bucket = 0; bucket < 64 && (2UL << bucket) - 1 <= blocks;
+       ++bucket)
+    hits += p->histogram[bucket];
+  return (p->time) ? (double)hits / p->time : 0.;
+}
+
+// Byte offset of rank entry (pos, alphabet_idx) in the rank matrix.
+static uint64_t RankOffset(fm_index *fm, size_t pos, int alphabet_idx) {
+  uint64_t i = fm->alphabet_sz * pos + alphabet_idx;
+  return (fm->ranks) ? i * sizeof(ranks_t) : i * fm->packed_ranks.width / 8;
+}
+
+// Byte offsets of the count of the pair code before pos and of the codes
+//  of its block in the pair occurrences, which follow the rank matrix.
+static void PairOffsets(fm_index *fm, size_t pos, unsigned code,
+                        uint64_t *offsets) {
+  fm_pair_occ *pairs = fm->pair_occ;
+  uint64_t block = RankOffset(fm, fm->bwt_sz, 0) +
+                   pos / FM_PAIR_OCC_BLOCK_ROWS * pairs->block_sz;
+  offsets[0] = block + code * sizeof(uint32_t);
+  offsets[1] = block + pairs->block_sz - FM_PAIR_OCC_BLOCK_ROWS;
+}
+
+// Return the number of distinct blocks of 2^block_log2 bytes among the
+//  offsets.
+static unsigned DistinctBlocks(const uint64_t *offsets, unsigned n,
+                               unsigned block_log2) {
+  unsigned distinct = 0;
+  for (unsigned i = 0; i < n; ++i) {
+    unsigned j = 0;
+    while (j < i && offsets[j] >> block_log2 != offsets[i] >> block_log2)
+      ++j;
+    distinct += j == i;
+  }
+  return distinct;
+}
+
+/* Replay the backward search of FMIndexFindMatchRange for every pattern and
+ *  pass the offsets it reads to the profiles, if any. Steps over pairs of
+ *  characters read the pair occurrences, and single steps the rank matrix.
+ * Set the number of LF steps and of reads, and the number of distinct cache
+ *  lines and pages read by each step summed over all steps.
+ * Return 0 on memory allocation error.
+ */
+static int Replay(fm_index *fm, char *patterns, unsigned pattern_count,
+                  unsigned pattern_sz, reuse_profile *profiles,
+                  unsigned profile_count, unsigned long *steps,
+                  unsigned long *reads, unsigned long *lines,
+                  unsigned long *pages) {
+  *steps = *reads = *lines = *pages = 0;
+  for (unsigned i = 0; i < pattern_count; ++i) {
+    char *pattern = &patterns[i * pattern_sz];
+    if (fm->qgram_filter &&
+        FMIndexQGramFilterRejects(fm, pattern, pattern_sz))
+      continue;
+
+    int alphabet_idx = fm->alphabet_map[(unsigned char)pattern[pattern_sz - 1]];
+    if (alphabet_idx < 0)
+      continue;
+    ranges_t start = fm->ranges[2 * alphabet_idx];
+    ranges_t end = fm->ranges[2 * alphabet_idx + 1];
+
+    int p = pattern_sz - 2;
+    fm_pair_occ *pairs = fm->pair_occ;
+    unsigned code = FM_PAIR_OCC_NONE;
+    while (p >= 0 && end > 1) {
+      uint64_t offsets[4];
+      unsigned n;
+      if (pairs && p >= 1 &&
+          (code = FMPairOccCode(pairs, pattern[p - 1], pattern[p])) !=
+              FM_PAIR_OCC_NONE) {
+        PairOffsets(fm, start, code, &offsets[0]);
+        PairOffsets(fm, end, code, &offsets[2]);
+        n = 4;
+        ranges_t range_start = pairs->starts[code];
+        start = range_start + FMPairOccRank(pairs, code, start);
+        end = range_start + FMPairOccRank(pairs, code, end);
+        p -= 2;
+      } else {
+        if ((alphabet_idx = fm->alphabet_map[(unsigned char)pattern[p]]) < 0)
+          break;
+        offsets[0] = RankOffset(fm, start - 1, alphabet_idx);
+        offsets[1] = RankOffset(fm, end - 1, alphabet_idx);
+        n = 2;
+        ranges_t range_start = fm->ranges[2 * alphabet_idx];
+        start = range_start + FMIndexRank(fm, start - 1, alphabet_idx);
+        end = range_start + FMIndexRank(fm, end - 1, alphabet_idx);
+        p -= 1;
+        // Like FindMatchRange, single steps finish the pattern once a pair
+        //  has no code.
+        pairs = NULL;
+      }
+
+      for (unsigned k = 0; k < profile_count; ++k)
+        for (unsigned j = 0; j < n; ++j)
+          if (!ReuseProfileAccess(&profiles[k], offsets[j]))
+            return 0;
+      ++*steps;
+      *reads += n;
+      *lines += DistinctBlocks(offsets, n, CACHE_LINE_LOG2);
+      *pages += DistinctBlocks(offsets, n, PAGE_LOG2);
+    }
+  }
+
+  return 1;
+}
+
+static void PrintSection(const char *name, size_t bytes, size_t n) {
+  printf("  %-20s %14lu  %8.3f\n", name, bytes, 8. * bytes / n);
+}
+
+static void PrintSections(fm_index *fm, char *filename) {
+  size_t n = fm->bwt_sz, sigma = fm->alphabet_sz;
+  size_t ranks = (fm->ranks) ? n * sigma * sizeof(ranks_t)
+                             : PackedVectorWords(fm->packed_ranks.size,
+                                                 fm->packed_ranks.width) *
+                                   sizeof(uint64_t);
+  size_t sa = (fm->sa) ? n * sizeof(sa_t)
+                       : PackedVectorWords(fm->packed_sa.size,
+                                           fm->packed_sa.width) *
+                             sizeof(uint64_t);
+  size_t filter = (fm->qgram_filter) ? 1UL << (fm->qgram_bits_log2 - 3) : 0;
+  size_t pairs = (fm->pair_occ) ? FMPairOccSize(fm->pair_occ) : 0;
+  size_t reverse = (fm->reverse) ? FMIndexSize(fm->reverse) : 0;
+  size_t lcp = (fm->lcp) ? 3 * (n + 1) * sizeof(sa_t) : 0;
+  size_t isa = (fm->isa_samples)
+                   ? ((n - 1) / fm->isa_sample_rate + 1) * sizeof(sa_t)
+                   : 0;
+  size_t total = FMIndexSize(fm);
+  // The document structures are whatever FMIndexSize counts beyond the rest.
+  size_t fixed = sizeof(fm_index) + sigma + 2 * sigma * sizeof(ranges_t);
+  size_t documents =
+      total - fixed - n - ranks - sa - filter - pairs - reverse - lcp - isa;
+
+  printf("Sections (bytes, bits per character):\n");
+  PrintSection("bwt", n, n);
+  PrintSection("header+alphabet", fixed, n);
+  PrintSection((fm->ranks) ? "ranks" : "ranks (packed)", ranks, n);
+  PrintSection((fm->sa) ? "sa" : "sa (packed)", sa, n);
+  if (filter)
+    PrintSection("q-gram filter", filter, n);
+  if (pairs)
+    PrintSection("pair occurrences", pairs, n);
+  if (reverse)
+    PrintSection("reverse index", reverse, n);
+  if (lcp)
+    PrintSection("lcp", lcp, n);
+  if (isa)
+    PrintSection("isa samples", isa, n);
+  if (fm->doc_starts)
+    PrintSection("documents", documents, n);
+  PrintSection("total in memory", total, n);
+
+  struct stat st;
+  if (stat(filename, &st) == 0)
+    PrintSection("file", st.st_size, n);
+  if (!fm->ranks)
+    printf("Packed entries use %u bits.\n", fm->packed_ranks.width);
+}
+
+static void PrintAlphabet(fm_index *fm) {
+  size_t n = fm->bwt_sz, sigma = fm->alphabet_sz;
+  double entropy = 0.;
+  size_t rare = 0;
+  for (size_t c = 0; c < sigma; ++c) {
+    size_t count = fm->ranges[2 * c + 1] - fm->ranges[2 * c];
+    double p = (double)count / n;
+    entropy -= p * log2(p);
+    rare += count < n / FM_OCC_RARE_DIVISOR;
+  }
+
+  size_t runs = (n) ? 1 : 0;
+  for (size_t i = 1; i < n; ++i)
+    runs += fm->bwt[i] != fm->bwt[i - 1];
+
+  printf("Text length n: %lu (including the dollar sign)\n", n);
+  printf("Alphabet size: %lu, of which %lu below 1/%d of the text\n", sigma,
+         rare, FM_OCC_RARE_DIVISOR);
+  printf("Empirical entropy H0: %.3f bits per character\n", entropy);
+  printf("BWT runs r: %lu, n/r = %.2f\n", runs, (double)n / runs);
+
+  printf("Most frequent characters:");
+  char shown[sigma];
+  memset(shown, 0, sigma);
+  for (unsigned k = 0; k < 5 && k < sigma; ++k) {
+    size_t best = 0, best_count = 0;
+    for (size_t c = 0; c < sigma; ++c) {
+      size_t count = fm->ranges[2 * c + 1] - fm->ranges[2 * c];
+      if (!shown[c] && count >= best_count) {
+        best = c;
+        best_count = count;
+      }
+    }
+    shown[best] = 1;
+    unsigned char ch = fm->alphabet[best];
+    if (ch > ' ' && ch < 127)
+      printf(" '%c'", ch);
+    else
+      printf(" 0x%02x", ch);
+    printf(" %.1f%%", 100. * best_count / n);
+  }
+  printf("\n");
+}
+
+static void PrintProfile(reuse_profile *p, const char *name,
+                         unsigned block_log2) {
+  printf("%s (%lu bytes): working set %lu blocks (%.1f MiB), %lu accesses\n",
+         name, 1UL << block_log2, p->distinct,
+         (double)(p->distinct << block_log2) / (1 << 20), p->time);
+  printf("  reuse distance histogram (distance: fraction of accesses):\n");
+  printf("    first access: %.4f\n",
+         (p->time) ? (double)p->cold / p->time : 0.);
+  for (unsigned b = 0; b < 64; ++b)
+    if (p->histogram[b])
+      printf("    [%lu, %lu): %.4f\n", (1UL << b) - 1, (2UL << b) - 1,
+             (double)p->histogram[b] / p->time);
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    printf("Usage: $ %s <FMINDEXFILE> [TESTFILE]\n", argv[0]);
+    printf("Report the size of every section of the index, alphabet "
+           "statistics and the\nnumber of BWT runs. Given a test file, also "
+           "replay the backward search of its\npatterns and profile the "
+           "locality of the rank matrix and pair occurrence reads.\n");
+    return 1;
+  }
+
+  fm_index *fm = FMIndexReadFromFile(argv[1], 0);
+  if (!fm) {
+    printf("Could not read FM-index from file.\n");
+    return 1;
+  }
+  PrintSections(fm, argv[1]);
+  PrintAlphabet(fm);
+
+  if (argc < 3) {
+    FMIndexFree(fm);
+    return 0;
+  }
+
+  char *patterns;
+  unsigned pattern_count, pattern_sz, max_match_count;
+  if (!LoadTestData(argv[2], &patterns, &pattern_count, &pattern_sz,
+                    &max_match_count, 0) ||
+      !pattern_sz) {
+    printf("Could not read test data file.\n");
+    return 1;
+  }
+
+  // Count the accesses first to size the Fenwick trees.
+  unsigned long steps, reads, lines, pages;
+  Replay(fm, patterns, pattern_count, pattern_sz, NULL, 0, &steps, &reads,
+         &lines, &pages);
+
+  unsigned block_log2[3] = {CACHE_LINE_LOG2, PAGE_LOG2, HUGE_PAGE_LOG2};
+  const char *names[3] = {"Cache lines", "Pages", "Huge pages"};
+  reuse_profile profiles[3];
+  for (unsigned k = 0; k < 3; ++k)
+    if (!ReuseProfileInit(&profiles[k], block_log2[k], reads)) {
+      printf("Failed to allocate memory for the profile.\n");
+      return 1;
+    }
+  if (!Replay(fm, patterns, pattern_count, pattern_sz, profiles, 3, &steps,
+              &reads, &lines, &pages)) {
+    printf("Failed to allocate memory for the profile.\n");
+    return 1;
+  }
+
+  printf("LF steps: %lu over %u patterns, %.2f cache lines and %.2f pages "
+         "per step\n",
+         steps, pattern_count, (steps) ? (double)lines / steps : 0.,
+         (steps) ? (double)pages / steps : 0.);
+  for (unsigned k = 0; k < 3; ++k)
+    PrintProfile(&profiles[k], names[k], block_log2[k]);
+
+  // Hit rates of fully associative LRU caches and TLBs of typical sizes.
+  printf("LRU hit rates: L1 32 KiB %.3f, L2 1 MiB %.3f, LLC 32 MiB %.3f\n",
+         HitRate(&profiles[0], (32 << 10) >> CACHE_LINE_LOG2),
+         HitRate(&profiles[0], (1 << 20) >> CACHE_LINE_LOG2),
+         HitRate(&profiles[0], (32 << 20) >> CACHE_LINE_LOG2));
+  printf("TLB hit rates (1536 entries): 4 KiB pages %.3f, 2 MiB pages %.3f\n",
+         HitRate(&profiles[1], 1536), HitRate(&profiles[2], 1536));
+
+  for (unsigned k = 0; k < 3; ++k)
+    ReuseProfileFree(&profiles[k]);
+  free(patterns);
+  FMIndexFree(fm);
+  return 0;
+}
@@ -15,6 +15,8 @@
 
 #include "../fmindex.h"
 #include "../util.h"
+#include "compact.hpp"
+#include "opencl_backend.hpp"
 
 std::vector<cl::Device> get_xilinx_devices();
 char *read_binary_file(const std::string &xclbin_file_name, unsigned &nb);
@@ -23,13 +25,23 @@ int main(int argc, char **argv) {
   if (argc < 6) {
     fprintf(
         stderr,
-        "Usage: %s <FMINDEXFILE> <XCLBIN> <TESTFILE> <NDRANGE> <LOCALSIZE>\n",
+        "Usage: %s <FMINDEXFILE> <XCLBIN> <TESTFILE> <NDRANGE> <LOCALSIZE> "
+        "[COMPACT] [CHUNKSIZE] [SLOTS]\n",
         argv[0]);
+    fprintf(stderr, "A non-zero CHUNKSIZE searches the patterns in chunks with "
+                    "SLOTS (default 2)\nchunks in flight, and prints the "
+                    "pipeline times. For ndrange kernels it\nmust be a "
+                    "multiple of LOCALSIZE.\n");
     return 1;
   }
 
   int use_ndrange = atoi(argv[4]);
   int local_size = atoi(argv[5]);
+  // Kernels of compact.cl write matches densely instead of into
+  //  max_match_count slots per pattern.
+  int compact = (argc > 6) ? atoi(argv[6]) : 0;
+  unsigned chunk_sz = (argc > 7) ? atoi(argv[7]) : 0;
+  unsigned slot_count = (argc > 8) ? atoi(argv[8]) : 2;
 
   // Load FM-index.
   fm_index *index = FMIndexReadFromFile(argv[1], 1);
@@ -38,6 +50,12 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // The kernels read plain rank and suffix arrays.
+  if (!FMIndexUnpack(index, 1)) {
+    fprintf(stderr, "Could not unpack FM-index.\n");
+    return 1;
+  }
+
   // Load test file.
   unsigned pattern_count, pattern_sz, max_match_count;
   char *patterns;
@@ -78,6 +96,17 @@ int main(int argc, char **argv) {
   cl::Buffer patterns_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
                           sizeof(char) * pattern_count * pattern_sz, patterns,
                           &err);
+  if (compact) {
+    std::vector<unsigned long> offsets, positions;
+    run_compact(context, program, q, bwt_buf, alphabet_buf, ranks_buf, sa_buf,
+                ranges_buf, patterns_buf, index, pattern_count, pattern_sz,
+                use_ndrange ? local_size : 0, offsets, positions);
+
+    delete[] fileBuf;
+    FMIndexFree(index);
+    return EXIT_SUCCESS;
+  }
+
   cl::Buffer out_buf(context, CL_MEM_WRITE_ONLY,
                      sizeof(unsigned long) *
                          (pattern_count * (max_match_count + 1)),
@@ -106,6 +135,34 @@ int main(int argc, char **argv) {
   kernel.setArg(10, pattern_sz);
   kernel.setArg(11, max_match_count + 1);
 
+  // Overlap pattern transfer, kernels and readback of chunks in several
+  //  slots, with the index transferred once up front.
+  if (chunk_sz && slot_count) {
+    q.enqueueMigrateMemObjects(
+        {bwt_buf, alphabet_buf, ranks_buf, sa_buf, ranges_buf}, 0);
+    q.finish();
+
+    std::vector<unsigned long> out((size_t)pattern_count *
+                                   (max_match_count + 1));
+    fm_pipeline_stats stats;
+    fm_backend *backend = opencl_backend_create(
+        context, device, kernel, slot_count, chunk_sz, pattern_sz,
+        max_match_count + 1, use_ndrange, local_size);
+    if (!FMPipelineRun(backend, patterns, pattern_count, pattern_sz,
+                       max_match_count + 1, chunk_sz, out.data(), &stats)) {
+      fprintf(stderr, "Pipeline failed.\n");
+      return 1;
+    }
+    printf("%a %a %a %a %a %u\n", stats.wall_time, stats.transfer_time,
+           stats.compute_time, stats.readback_time, stats.wait_time,
+           stats.chunk_count);
+
+    backend->free(backend);
+    delete[] fileBuf;
+    FMIndexFree(index);
+    return EXIT_SUCCESS;
+  }
+
   // Schedule transfer of inputs and output.
   q.enqueueMigrateMemObjects(
       {bwt_buf, alphabet_buf, ranks_buf, sa_buf, ranges_buf, patterns_buf}, 0);
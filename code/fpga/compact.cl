@@ -0,0 +1,82 @@
+#define MAX_ALPHABET_SZ 97
+#define MAX_RANGES_SZ (2 * MAX_ALPHABET_SZ)
+
+/* Two-phase version of the search kernel, with a dense output layout.
+ * fmindex_count writes the match range of every pattern. The host
+ *  prefix-sums the match counts into output offsets, after which
+ *  fmindex_locate writes the matches of pattern i from out[offsets[i]].
+ *  The output is thus exactly as large as the total number of matches.
+ */
+
+inline static int string_index(__private char *s, char c) {
+  int i = 0;
+  while (1) {
+    if (s[i] == c)
+      return i;
+    ++i;
+  }
+}
+
+kernel
+__attribute__((xcl_zero_global_work_offset))
+void fmindex_count(__global char *bwt,
+                   __global char *alphabet,
+                   __global unsigned *ranks,
+                   __global unsigned *ranges,
+                   __global char *patterns,
+                   __global unsigned *match_ranges,
+                   size_t bwt_sz, size_t alphabet_sz, unsigned pattern_count,
+                   unsigned pattern_sz) {
+  __attribute__((xcl_pipeline_workitems)) {
+    int work_id = get_global_id(0);
+
+    __private char _alphabet[MAX_ALPHABET_SZ];
+    __attribute__((xcl_pipeline_loop(1)))
+    for (unsigned i = 0; i < alphabet_sz; ++i)
+      _alphabet[i] = alphabet[i];
+
+    __private unsigned _ranges[MAX_RANGES_SZ];
+    __attribute__((xcl_pipeline_loop(1)))
+    for (unsigned i = 0; i < 2 * alphabet_sz; ++i)
+      _ranges[i] = ranges[i];
+
+    int p_idx = pattern_sz - 1;
+    char c = patterns[work_id * pattern_sz + p_idx];
+    int alphabet_idx = string_index(_alphabet, c);
+    unsigned start = _ranges[2 * alphabet_idx];
+    unsigned end = _ranges[2 * alphabet_idx + 1];
+
+    p_idx -= 1;
+    while (p_idx >= 0 && end > 1) {
+      c = patterns[work_id * pattern_sz + p_idx];
+      alphabet_idx = string_index(_alphabet, c);
+      unsigned range_start = _ranges[2 * alphabet_idx];
+      start = range_start + ranks[alphabet_sz * (start - 1) + alphabet_idx];
+      end = range_start + ranks[alphabet_sz * (end - 1) + alphabet_idx];
+      p_idx -= 1;
+    }
+
+    match_ranges[2 * work_id] = start;
+    match_ranges[2 * work_id + 1] = end;
+  }
+}
+
+kernel
+__attribute__((xcl_zero_global_work_offset))
+void fmindex_locate(__global unsigned *sa,
+                    __global unsigned *match_ranges,
+                    __global unsigned long *offsets,
+                    __global unsigned long *out,
+                    unsigned pattern_count) {
+  __attribute__((xcl_pipeline_workitems)) {
+    int work_id = get_global_id(0);
+
+    unsigned start = match_ranges[2 * work_id];
+    unsigned long offset = offsets[work_id];
+    unsigned long match_count = offsets[work_id + 1] - offset;
+
+    __attribute__((xcl_pipeline_loop(1)))
+    for (unsigned i = 0; i < match_count; ++i)
+      out[offset + i] = sa[start + i];
+  }
+}
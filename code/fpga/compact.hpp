@@ -0,0 +1,79 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include <vector>
+
+#include "../fmindex.h"
+
+/* Run the two-phase kernels of compact.cl on buffers that hold the index and
+ *  patterns. The match ranges are read back and their counts prefix-summed
+ *  into offsets (pattern_count + 1 entries), after which the matches of
+ *  pattern i are written to positions[offsets[i]] up to
+ *  positions[offsets[i + 1]].
+ */
+static void run_compact(cl::Context &context, cl::Program &program,
+                        cl::CommandQueue &q, cl::Buffer &bwt_buf,
+                        cl::Buffer &alphabet_buf, cl::Buffer &ranks_buf,
+                        cl::Buffer &sa_buf, cl::Buffer &ranges_buf,
+                        cl::Buffer &patterns_buf, fm_index *index,
+                        unsigned pattern_count, unsigned pattern_sz,
+                        int local_size, std::vector<unsigned long> &offsets,
+                        std::vector<unsigned long> &positions) {
+  cl_int err;
+  cl::NDRange local =
+      (local_size > 0) ? cl::NDRange(local_size) : cl::NullRange;
+
+  // Phase 1: match range of every pattern.
+  cl::Kernel count_kernel(program, "fmindex_count", &err);
+  cl::Buffer match_ranges_buf(context, CL_MEM_READ_WRITE,
+                              sizeof(unsigned) * 2 * pattern_count, NULL,
+                              &err);
+  count_kernel.setArg(0, bwt_buf);
+  count_kernel.setArg(1, alphabet_buf);
+  count_kernel.setArg(2, ranks_buf);
+  count_kernel.setArg(3, ranges_buf);
+  count_kernel.setArg(4, patterns_buf);
+  count_kernel.setArg(5, match_ranges_buf);
+  count_kernel.setArg(6, index->bwt_sz);
+  count_kernel.setArg(7, index->alphabet_sz);
+  count_kernel.setArg(8, pattern_count);
+  count_kernel.setArg(9, pattern_sz);
+
+  q.enqueueMigrateMemObjects(
+      {bwt_buf, alphabet_buf, ranks_buf, ranges_buf, patterns_buf}, 0);
+  q.enqueueNDRangeKernel(count_kernel, 0, pattern_count, local);
+
+  // Phase 2: prefix sum of the match counts into output offsets.
+  unsigned *match_ranges = (unsigned *)q.enqueueMapBuffer(
+      match_ranges_buf, CL_TRUE, CL_MAP_READ, 0,
+      sizeof(unsigned) * 2 * pattern_count);
+  offsets.assign(pattern_count + 1, 0);
+  for (unsigned i = 0; i < pattern_count; ++i)
+    offsets[i + 1] =
+        offsets[i] + (match_ranges[2 * i + 1] - match_ranges[2 * i]);
+  q.enqueueUnmapMemObject(match_ranges_buf, match_ranges);
+
+  // Phase 3: dense output of exactly the total number of matches.
+  unsigned long total = offsets[pattern_count];
+  positions.assign(total, 0);
+  cl::Buffer offsets_buf(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                         sizeof(unsigned long) * (pattern_count + 1),
+                         offsets.data(), &err);
+  cl::Buffer positions_buf(context, CL_MEM_WRITE_ONLY,
+                           sizeof(unsigned long) * (total ? total : 1), NULL,
+                           &err);
+
+  cl::Kernel locate_kernel(program, "fmindex_locate", &err);
+  locate_kernel.setArg(0, sa_buf);
+  locate_kernel.setArg(1, match_ranges_buf);
+  locate_kernel.setArg(2, offsets_buf);
+  locate_kernel.setArg(3, positions_buf);
+  locate_kernel.setArg(4, pattern_count);
+
+  q.enqueueMigrateMemObjects({sa_buf}, 0);
+  q.enqueueNDRangeKernel(locate_kernel, 0, pattern_count, local);
+  if (total)
+    q.enqueueReadBuffer(positions_buf, CL_TRUE, 0,
+                        sizeof(unsigned long) * total, positions.data());
+  q.finish();
+}
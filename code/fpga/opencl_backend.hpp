@@ -0,0 +1,112 @@
+#pragma once
+
+#include <CL/cl2.hpp>
+#include <vector>
+
+#include "../backend.h"
+
+/* Backend running the fmindex kernel of an xclbin, with one in-order queue
+ *  and one pair of pattern and output buffers per slot. Submitting a chunk
+ *  enqueues the pattern transfer, the kernel and the result readback
+ *  without blocking, so the chunks of different slots overlap.
+ */
+struct opencl_backend {
+  cl::Kernel kernel;
+  std::vector<cl::CommandQueue> queues;
+  std::vector<cl::Buffer> patterns_bufs;
+  std::vector<cl::Buffer> out_bufs;
+  std::vector<cl::Event> kernel_events;
+  std::vector<cl::Event> read_events;
+  std::vector<unsigned> chunk_sizes;
+  unsigned pattern_sz;
+  unsigned out_sz;
+  int use_ndrange;
+  int local_size;
+};
+
+static int opencl_submit(fm_backend *backend, unsigned slot, char *patterns,
+                         unsigned pattern_count, unsigned long *out) {
+  opencl_backend *b = (opencl_backend *)backend->state;
+  cl::CommandQueue &q = b->queues[slot];
+
+  // Kernel arguments are captured when the kernel is enqueued.
+  q.enqueueWriteBuffer(b->patterns_bufs[slot], CL_FALSE, 0,
+                       sizeof(char) * pattern_count * b->pattern_sz, patterns);
+  b->kernel.setArg(5, b->patterns_bufs[slot]);
+  b->kernel.setArg(6, b->out_bufs[slot]);
+  b->kernel.setArg(9, pattern_count);
+  if (b->use_ndrange)
+    q.enqueueNDRangeKernel(b->kernel, 0, pattern_count, b->local_size, NULL,
+                           &b->kernel_events[slot]);
+  else
+    q.enqueueTask(b->kernel, NULL, &b->kernel_events[slot]);
+  q.enqueueReadBuffer(b->out_bufs[slot], CL_FALSE, 0,
+                      sizeof(unsigned long) * pattern_count * b->out_sz, out,
+                      NULL, &b->read_events[slot]);
+  q.flush();
+
+  b->chunk_sizes[slot] = pattern_count;
+  return 1;
+}
+
+static int opencl_wait(fm_backend *backend, unsigned slot,
+                       double *device_time) {
+  opencl_backend *b = (opencl_backend *)backend->state;
+  *device_time = 0.;
+  if (!b->chunk_sizes[slot])
+    return 1;
+
+  if (b->read_events[slot].wait() != CL_SUCCESS)
+    return 0;
+  cl_ulong start =
+      b->kernel_events[slot].getProfilingInfo<CL_PROFILING_COMMAND_START>();
+  cl_ulong end =
+      b->kernel_events[slot].getProfilingInfo<CL_PROFILING_COMMAND_END>();
+  *device_time = (end - start) * 1e-9;
+  b->chunk_sizes[slot] = 0;
+  return 1;
+}
+
+static void opencl_free(fm_backend *backend) {
+  delete (opencl_backend *)backend->state;
+  delete backend;
+}
+
+/* Create a backend for the fmindex kernel of program, whose index arguments
+ *  are already set, with chunks of up to chunk_sz patterns in slot_count
+ *  slots.
+ */
+static fm_backend *
+opencl_backend_create(cl::Context &context, cl::Device &device,
+                      cl::Kernel &kernel, unsigned slot_count,
+                      unsigned chunk_sz, unsigned pattern_sz, unsigned out_sz,
+                      int use_ndrange, int local_size) {
+  cl_int err;
+  opencl_backend *b = new opencl_backend;
+  b->kernel = kernel;
+  b->pattern_sz = pattern_sz;
+  b->out_sz = out_sz;
+  b->use_ndrange = use_ndrange;
+  b->local_size = local_size;
+  b->kernel_events.resize(slot_count);
+  b->read_events.resize(slot_count);
+  b->chunk_sizes.assign(slot_count, 0);
+  for (unsigned i = 0; i < slot_count; ++i) {
+    b->queues.emplace_back(context, device, CL_QUEUE_PROFILING_ENABLE, &err);
+    b->patterns_bufs.emplace_back(context, CL_MEM_READ_ONLY,
+                                  sizeof(char) * chunk_sz * pattern_sz, nullptr,
+                                  &err);
+    b->out_bufs.emplace_back(context, CL_MEM_WRITE_ONLY,
+                             sizeof(unsigned long) * chunk_sz * out_sz, nullptr,
+                             &err);
+  }
+
+  fm_backend *backend = new fm_backend;
+  backend->name = "opencl";
+  backend->slot_count = slot_count;
+  backend->state = b;
+  backend->submit = opencl_submit;
+  backend->wait = opencl_wait;
+  backend->free = opencl_free;
+  return backend;
+}
@@ -14,6 +14,7 @@
 
 #include "../fmindex.h"
 #include "../util.h"
+#include "compact.hpp"
 
 std::vector<cl::Device> get_xilinx_devices();
 char *read_binary_file(const std::string &xclbin_file_name, unsigned &nb);
@@ -21,13 +22,17 @@ char *read_binary_file(const std::string &xclbin_file_name, unsigned &nb);
 int main(int argc, char **argv) {
   if (argc < 6) {
     printf(
-        "Usage: %s <FMINDEXFILE> <XCLBIN> <TESTFILE> <NDRANGE> <LOCALSIZE>\n",
+        "Usage: %s <FMINDEXFILE> <XCLBIN> <TESTFILE> <NDRANGE> <LOCALSIZE> "
+        "[COMPACT]\n",
         argv[0]);
     return 1;
   }
 
   int use_ndrange = atoi(argv[4]);
   int local_size = atoi(argv[5]);
+  // Kernels of compact.cl write matches densely instead of into
+  //  max_match_count slots per pattern.
+  int compact = (argc > 6) ? atoi(argv[6]) : 0;
 
   // Load FM-index.
   fm_index *index = FMIndexReadFromFile(argv[1], 1);
@@ -36,6 +41,12 @@ int main(int argc, char **argv) {
     return 1;
   }
 
+  // The kernels read plain rank and suffix arrays.
+  if (!FMIndexUnpack(index, 1)) {
+    printf("Could not unpack FM-index.\n");
+    return 1;
+  }
+
   // Load test file.
   unsigned pattern_count, pattern_sz, max_match_count;
   char *patterns;
@@ -76,6 +87,69 @@ int main(int argc, char **argv) {
   cl::Buffer patterns_buf(context, CL_MEM_READ_ONLY | CL_MEM_USE_HOST_PTR,
                           sizeof(char) * pattern_count * pattern_sz, patterns,
                           &err);
+  if (compact) {
+    std::vector<unsigned long> offsets, positions;
+    run_compact(context, program, q, bwt_buf, alphabet_buf, ranks_buf, sa_buf,
+                ranges_buf, patterns_buf, index, pattern_count, pattern_sz,
+                use_ndrange ? local_size : 0, offsets, positions);
+
+    // Compute the same layout on the CPU and compare it pattern by pattern.
+    ranges_t *starts = (ranges_t *)calloc(pattern_count, sizeof(ranges_t));
+    ranges_t *ends = (ranges_t *)calloc(pattern_count, sizeof(ranges_t));
+    unsigned long *cpu_offsets, *cpu_positions;
+    if (!starts || !ends) {
+      printf("Failed to allocate memory for reference results.\n");
+      free(starts);
+      free(ends);
+      delete[] fileBuf;
+      FMIndexFree(index);
+      return 1;
+    }
+    for (unsigned i = 0; i < pattern_count; ++i)
+      FMIndexFindMatchRange(index, &patterns[i * pattern_sz], pattern_sz,
+                            &starts[i], &ends[i]);
+    if (!FMIndexFindRangeIndicesBatch(index, starts, ends, pattern_count,
+                                      &cpu_offsets, &cpu_positions)) {
+      printf("Failed to allocate memory for reference results.\n");
+      free(starts);
+      free(ends);
+      delete[] fileBuf;
+      FMIndexFree(index);
+      return 1;
+    }
+
+    for (unsigned i = 0; i < pattern_count; ++i) {
+      char *pattern = &patterns[i * pattern_sz];
+      unsigned long match_count = cpu_offsets[i + 1] - cpu_offsets[i];
+      printf("Verifying pattern \"%.*s\": ", pattern_sz, pattern);
+      if (offsets[i] != cpu_offsets[i] ||
+          offsets[i + 1] - offsets[i] != match_count) {
+        printf("INCORRECT (offset %lu != %lu or match count %lu != %lu)\n",
+               offsets[i], cpu_offsets[i], offsets[i + 1] - offsets[i],
+               match_count);
+        continue;
+      }
+      int success = 1;
+      for (unsigned long j = cpu_offsets[i]; j < cpu_offsets[i + 1]; ++j)
+        if (positions[j] != cpu_positions[j]) {
+          printf("INCORRECT (index %lu != %lu)\n", positions[j],
+                 cpu_positions[j]);
+          success = 0;
+          break;
+        }
+      if (success)
+        printf("CORRECT\n");
+    }
+
+    free(starts);
+    free(ends);
+    free(cpu_offsets);
+    free(cpu_positions);
+    delete[] fileBuf;
+    FMIndexFree(index);
+    return EXIT_SUCCESS;
+  }
+
   cl::Buffer out_buf(context, CL_MEM_WRITE_ONLY,
                      sizeof(unsigned long) *
                          (pattern_count * (max_match_count + 1)),
@@ -0,0 +1,256 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Text is generated and written in chunks of this many characters.
+#define CHUNK_SZ (1 << 20)
+
+// Modulus of the rolling hash of the Markov context.
+#define CONTEXT_MODULUS 1000003UL
+
+typedef struct corpus_params {
+  unsigned long size;
+  unsigned alphabet_sz;
+  double skew;
+  unsigned order;
+  double repeat;
+  unsigned long repeat_length;
+  double mutation;
+  unsigned long window;
+} corpus_params;
+
+// xoshiro256** generator, seeded with splitmix64.
+static uint64_t rng_state[4];
+
+static uint64_t Rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+
+static uint64_t NextRandom(void) {
+  uint64_t result = Rotl(rng_state[1] * 5, 7) * 9;
+  uint64_t t = rng_state[1] << 17;
+  rng_state[2] ^= rng_state[0];
+  rng_state[3] ^= rng_state[1];
+  rng_state[1] ^= rng_state[2];
+  rng_state[0] ^= rng_state[3];
+  rng_state[2] ^= t;
+  rng_state[3] = Rotl(rng_state[3], 45);
+  return result;
+}
+
+static void SeedRandom(uint64_t seed) {
+  for (unsigned i = 0; i < 4; ++i) {
+    uint64_t z = (seed += 0x9e3779b97f4a7c15UL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+    rng_state[i] = z ^ (z >> 31);
+  }
+}
+
+// Return a uniform random number in [0, 1).
+static double NextUniform(void) { return (NextRandom() >> 11) * 0x1.0p-53; }
+
+/* Printable characters used as the alphabet, in order of decreasing
+ *  frequency. The dollar sign and the document separator are left out.
+ */
+static const char *CorpusAlphabet(void) {
+  static char alphabet[128];
+  if (!alphabet[0]) {
+    size_t len = 0;
+    for (int c = '!'; c <= '~'; ++c)
+      if (c != '$')
+        alphabet[len++] = c;
+    alphabet[len] = '\0';
+  }
+  return alphabet;
+}
+
+/* Generate text from a Markov chain of the given order. Symbol ranks follow
+ *  a Zipf distribution with the given skew, and the context of the last
+ *  order symbols rotates which symbol gets which rank, so every context has
+ *  the same entropy but a different most likely successor.
+ * A fraction repeat of the text is copied in runs of about repeat_length
+ *  characters from the last window characters instead, with every character
+ *  mutated with probability mutation, which makes the text repetitive.
+ */
+static int Generate(corpus_params *p, FILE *out) {
+  const char *alphabet = CorpusAlphabet();
+  double cumulative[p->alphabet_sz];
+  double total = 0.;
+  for (unsigned i = 0; i < p->alphabet_sz; ++i)
+    cumulative[i] = (total += pow(i + 1, -p->skew));
+
+  // Runs start at a rate that makes them cover a fraction repeat of the
+  //  text on average.
+  double start_rate = (p->repeat < 1.)
+                          ? p->repeat / ((1. - p->repeat) * p->repeat_length)
+                          : 1.;
+  uint64_t order_pow = 1;
+  for (unsigned k = 0; k < p->order; ++k)
+    order_pow = order_pow * 31 % CONTEXT_MODULUS;
+
+  // The window is a ring buffer of the last generated characters.
+  char *window = malloc(p->window);
+  char *chunk = malloc(CHUNK_SZ);
+  if (!window || !chunk) {
+    free(window);
+    free(chunk);
+    return 0;
+  }
+
+  uint64_t context = 0;
+  unsigned long written = 0, copy_left = 0, copy_from = 0;
+  while (written < p->size) {
+    size_t chunk_sz = (p->size - written < CHUNK_SZ) ? p->size - written
+                                                       : CHUNK_SZ;
+    for (size_t i = 0; i < chunk_sz; ++i, ++written) {
+      unsigned long available = (written < p->window) ? written : p->window;
+      if (!copy_left && available && NextUniform() < start_rate) {
+        copy_left = 1 + NextRandom() % (2 * p->repeat_length);
+        copy_from = written - 1 - NextRandom() % available;
+      }
+
+      char c;
+      if (copy_left && NextUniform() >= p->mutation) {
+        c = window[copy_from++ % p->window];
+        --copy_left;
+      } else {
+        if (copy_left) {
+          --copy_left;
+          ++copy_from;
+        }
+        double u = NextUniform() * total;
+        unsigned lo = 0, hi = p->alphabet_sz - 1;
+        while (lo < hi) {
+          unsigned mid = (lo + hi) / 2;
+          if (cumulative[mid] <= u)
+            lo = mid + 1;
+          else
+            hi = mid;
+        }
+        c = alphabet[(lo + context) % p->alphabet_sz];
+      }
+
+      chunk[i] = window[written % p->window] = c;
+      // Rolling hash of the last order characters.
+      if (p->order) {
+        uint64_t oldest = (written >= p->order)
+                              ? window[(written - p->order) % p->window]
+                              : 0;
+        context = (context * 31 + c) % CONTEXT_MODULUS;
+        context = (context + CONTEXT_MODULUS - oldest * order_pow %
+                                                   CONTEXT_MODULUS) %
+                  CONTEXT_MODULUS;
+      }
+    }
+
+    if (fwrite(chunk, 1, chunk_sz, out) != chunk_sz)
+      break;
+  }
+
+  free(window);
+  free(chunk);
+  return written == p->size && !ferror(out);
+}
+
+// Parse a size with an optional K, M or G suffix (powers of 1024).
+static unsigned long ParseSize(const char *s) {
+  char *end;
+  unsigned long size = strtoul(s, &end, 10);
+  switch (*end) {
+  case 'G':
+    size <<= 10; // Fall through.
+  case 'M':
+    size <<= 10; // Fall through.
+  case 'K':
+    size <<= 10;
+  }
+  return size;
+}
+
+static void usage(char *name) {
+  printf("Usage: $ %s [-a ALPHABETSIZE] [-z SKEW] [-k ORDER] [-r REPEAT] "
+         "[-l REPEATLENGTH] [-m MUTATION] [-w WINDOW] [-S SEED] <SIZE> "
+         "<OUTPUTFILE>\n",
+         name);
+  printf("Generate a synthetic text of SIZE characters (K, M and G suffixes "
+         "allowed),\nstreamed to OUTPUTFILE (- for standard output).\n");
+  printf("  -a  Number of distinct characters, at most %lu (default 4).\n",
+         strlen(CorpusAlphabet()));
+  printf("  -z  Zipf exponent of the character frequencies, 0 for uniform "
+         "(default 1).\n");
+  printf("  -k  Markov order: the number of preceding characters that "
+         "shape the\n      distribution of the next one (default 0).\n");
+  printf("  -r  Fraction of the text copied from earlier text (default 0).\n");
+  printf("  -l  Average length of a copied run (default 1000).\n");
+  printf("  -m  Probability that a copied character is mutated (default "
+         "0.01).\n");
+  printf("  -w  Number of preceding characters that runs are copied from "
+         "(default 64M).\n");
+  printf("  -S  Random seed (default the current time).\n");
+}
+
+int main(int argc, char *argv[]) {
+  corpus_params p = {0, 4, 1., 0, 0., 1000, 0.01, 64UL << 20};
+  unsigned long seed = time(NULL);
+  int opt;
+  while ((opt = getopt(argc, argv, "a:z:k:r:l:m:w:S:")) != -1) {
+    switch (opt) {
+    case 'a':
+      p.alphabet_sz = atoi(optarg);
+      break;
+    case 'z':
+      p.skew = atof(optarg);
+      break;
+    case 'k':
+      p.order = atoi(optarg);
+      break;
+    case 'r':
+      p.repeat = atof(optarg);
+      break;
+    case 'l':
+      p.repeat_length = ParseSize(optarg);
+      break;
+    case 'm':
+      p.mutation = atof(optarg);
+      break;
+    case 'w':
+      p.window = ParseSize(optarg);
+      break;
+    case 'S':
+      seed = strtoul(optarg, NULL, 10);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (argc - optind < 2 || !p.alphabet_sz ||
+      p.alphabet_sz > strlen(CorpusAlphabet()) || !p.repeat_length ||
+      p.window <= p.order || p.repeat < 0. || p.repeat > 1.) {
+    usage(argv[0]);
+    return 1;
+  }
+  p.size = ParseSize(argv[optind]);
+  fprintf(stderr, "Seed: %lu\n", seed);
+  SeedRandom(seed);
+
+  char *output = argv[optind + 1];
+  FILE *out = (strcmp(output, "-") == 0) ? stdout : fopen(output, "w");
+  if (!out) {
+    printf("Failed to open output file.\n");
+    return 1;
+  }
+  if (!Generate(&p, out)) {
+    fprintf(stderr, "Failed to generate corpus.\n");
+    return 1;
+  }
+  if (out != stdout && fclose(out) != 0) {
+    fprintf(stderr, "Failed to write corpus.\n");
+    return 1;
+  }
+  return 0;
+}
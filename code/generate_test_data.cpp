@@ -1,23 +1,37 @@
 #include <random>
 #include <stdio.h>
 #include <string.h>
+#include <time.h>
 
 #include "fmindex.h"
 #include "util.h"
 
+// Copy the text at idx into pattern, from the original text if it was given
+//  and otherwise extracted from the index.
+static void CopyText(char *s, fm_index *index, unsigned long idx, int length,
+                     char *pattern) {
+  if (s)
+    memcpy(pattern, &s[idx], length);
+  else
+    FMIndexExtract(index, idx, length, pattern);
+}
+
 int main(int argc, char **argv) {
   if (argc < 7) {
     printf("Usage: $ %s <TEXTFILE> <FMFILE> <OUTPUTFILE> <TESTCOUNT> "
-           "<TESTLENGTH> <MAXMATCHES>\n",
+           "<TESTLENGTH> <MAXMATCHES> [MISSPERCENT]\n",
            argv[0]);
+    printf("Use - as TEXTFILE to sample patterns from the FM-index alone.\n");
     return 1;
   }
 
   int count = atoi(argv[4]);
   int length = atoi(argv[5]);
+  // Percentage of patterns that should not occur in the text.
+  int miss_percent = (argc > 7) ? atoi(argv[7]) : 0;
 
-  char *s = ReadFile(argv[1]);
-  if (!s)
+  char *s = NULL;
+  if (strcmp(argv[1], "-") != 0 && !(s = ReadFile(argv[1])))
     return 1;
 
   fm_index *index = FMIndexReadFromFile(argv[2], 0);
@@ -25,8 +39,12 @@ int main(int argc, char **argv) {
     fprintf(stderr, "Error reading FM-index from file\n");
     return 1;
   }
+  if (!s && !index->isa_samples) {
+    fprintf(stderr, "FM-index has no samples to extract text from.\n");
+    return 1;
+  }
 
-  size_t sz = strlen(s);
+  size_t sz = index->bwt_sz - 1;
 
   unsigned long seed = time(NULL);
   fprintf(stderr, "Seed: %lu\n", seed);
@@ -35,7 +53,11 @@ int main(int argc, char **argv) {
   std::mt19937 generator(seed);
   std::uniform_int_distribution<unsigned long> distr(0, sz - length);
 
-  unsigned long indices[count];
+  char *tests = (char *)malloc(count * length);
+  if (!tests) {
+    fprintf(stderr, "Failed to allocate memory for tests.\n");
+    return 1;
+  }
   unsigned max_match_count = 1;
   char pattern[length + 1];
   pattern[length] = '\0';
@@ -44,7 +66,7 @@ int main(int argc, char **argv) {
   for (int i = 0; i < count; ++i) {
     // Find the average match count.
     unsigned long idx = distr(generator);
-    memcpy(pattern, &s[idx], length);
+    CopyText(s, index, idx, length, pattern);
     ranges_t start, end;
     FMIndexFindMatchRange(index, pattern, length, &start, &end);
     match_total += end - start;
@@ -52,8 +74,14 @@ int main(int argc, char **argv) {
 
   fprintf(stderr, "Average match count: %lu\n", match_total / count);
 
+  // Characters that may be substituted to create missing patterns.
+  std::uniform_int_distribution<int> pos_distr(0, length - 1);
+  std::uniform_int_distribution<int> char_distr(1, index->alphabet_sz - 1);
+  std::uniform_int_distribution<int> percent_distr(0, 99);
+
   unsigned max_allowed_matches = atoi(argv[6]);
   for (int i = 0; i < count; ++i) {
+    int miss = percent_distr(generator) < miss_percent;
     // Make sure the pattern does not contain newlines as it would
     //  mess with the formatting of the file.
     // Skews the distributivity a bit, but shouldn't matter really.
@@ -64,18 +92,32 @@ int main(int argc, char **argv) {
     do {
       idx = distr(generator);
       valid = 1;
+      CopyText(s, index, idx, length, pattern);
       for (int i = 0; i < length; ++i)
-        if (s[idx + i] == '\n')
+        if (pattern[i] == '\n')
           valid = 0;
       if (valid) {
-        memcpy(pattern, &s[idx], length);
         FMIndexFindMatchRange(index, pattern, length, &start, &end);
         if (end - start > max_allowed_matches)
           valid = 0;
       }
     } while (!valid);
 
-    indices[i] = idx;
+    // Mutate random positions of the sampled pattern until it no longer
+    //  occurs in the text.
+    int attempts = 0;
+    while (miss && end - start > 0) {
+      if (++attempts > 1000) {
+        fprintf(stderr, "Failed to create a pattern that does not occur.\n");
+        return 1;
+      }
+      char c = index->alphabet[char_distr(generator)];
+      if (c != '\n')
+        pattern[pos_distr(generator)] = c;
+      FMIndexFindMatchRange(index, pattern, length, &start, &end);
+    }
+
+    memcpy(&tests[i * length], pattern, length);
     if (end - start > max_match_count)
       max_match_count = end - start;
   }
@@ -90,9 +132,11 @@ int main(int argc, char **argv) {
   fprintf(f, "%i\n", count);
   fprintf(f, "%i\n", length);
   for (int i = 0; i < count; ++i) {
-    fprintf(f, "%.*s\n", length, &s[indices[i]]);
+    fprintf(f, "%.*s\n", length, &tests[i * length]);
   }
 
+  free(tests);
+  free(s);
   FMIndexFree(index);
 
   return 0;
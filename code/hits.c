@@ -0,0 +1,198 @@
+#include "hits.h"
+#include "locate.h"
+#include "trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Compact streams of located positions.
+ * A range is located chunk_sz rows at a time, and every chunk of positions
+ *  is sorted and written as the gaps between consecutive positions, with
+ *  the first relative to zero. Gaps are varints of 7 bits per byte, so the
+ *  dense hit lists of frequent patterns take one or two bytes per position
+ *  instead of the eight of an unsigned long.
+ * A chunk is its position count and payload size as varints followed by the
+ *  payload, and a stream ends with a chunk of zero positions. Positions are
+ *  sorted within each chunk, and a chunk size at least the number of hits
+ *  gives one globally sorted chunk.
+ */
+
+static size_t PutVarint(uint8_t *out, uint64_t v) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (v & 0x7f) | 0x80;
+    v >>= 7;
+  }
+  out[n++] = v;
+  return n;
+}
+
+// Read a varint from in[*pos, sz). Return 0 if it is truncated or too long.
+static int GetVarint(const uint8_t *in, size_t sz, size_t *pos, uint64_t *v) {
+  *v = 0;
+  for (unsigned shift = 0; shift < 64 && *pos < sz; shift += 7) {
+    uint8_t byte = in[(*pos)++];
+    *v |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return 1;
+  }
+  return 0;
+}
+
+static int ReadVarint(FILE *in, uint64_t *v) {
+  *v = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    int byte = getc(in);
+    if (byte == EOF)
+      return 0;
+    *v |= (uint64_t)(byte & 0x7f) << shift;
+    if (!(byte & 0x80))
+      return 1;
+  }
+  return 0;
+}
+
+// Largest encoded size of a chunk of count positions.
+size_t FMHitsEncodedBound(size_t count) { return 20 + 10 * count; }
+
+/* Encode the sorted positions as one chunk into out, which must hold
+ *  FMHitsEncodedBound(count) bytes. A count of zero writes the end of a
+ *  stream. Return the number of bytes written.
+ */
+size_t FMHitsEncode(const unsigned long *positions, size_t count,
+                    uint8_t *out) {
+  // The payload goes after room for the largest header, and is moved down
+  //  once its size is known.
+  uint8_t *payload = out + 20;
+  size_t payload_sz = 0;
+  unsigned long prev = 0;
+  for (size_t i = 0; i < count; ++i) {
+    payload_sz += PutVarint(payload + payload_sz, positions[i] - prev);
+    prev = positions[i];
+  }
+
+  size_t n = PutVarint(out, count);
+  if (!count)
+    return n;
+  n += PutVarint(out + n, payload_sz);
+  memmove(out + n, payload, payload_sz);
+  return n + payload_sz;
+}
+
+// Make room for count positions. Return 0 on memory allocation error.
+static int Reserve(unsigned long **positions, size_t *capacity, size_t count) {
+  if (count <= *capacity)
+    return 1;
+  unsigned long *p = realloc(*positions, count * sizeof(unsigned long));
+  if (!p)
+    return 0;
+  *positions = p;
+  *capacity = count;
+  return 1;
+}
+
+/* Decode the chunk at the start of in[0, sz) into *positions, which holds
+ *  *capacity entries and is grown as needed. *count is set to the number of
+ *  positions, 0 at the end of a stream.
+ * Return the number of bytes read, or 0 on a malformed chunk or memory
+ *  allocation error.
+ */
+size_t FMHitsDecode(const uint8_t *in, size_t sz, unsigned long **positions,
+                    size_t *count, size_t *capacity) {
+  size_t pos = 0;
+  uint64_t n, payload_sz;
+  *count = 0;
+  if (!GetVarint(in, sz, &pos, &n))
+    return 0;
+  if (!n)
+    return pos;
+  if (!GetVarint(in, sz, &pos, &payload_sz) || payload_sz > sz - pos ||
+      n > payload_sz || !Reserve(positions, capacity, n))
+    return 0;
+
+  size_t end = pos + payload_sz;
+  unsigned long prev = 0;
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t gap;
+    if (!GetVarint(in, end, &pos, &gap))
+      return 0;
+    (*positions)[i] = prev += gap;
+  }
+  if (pos != end)
+    return 0;
+  *count = n;
+  return pos;
+}
+
+/* Read the next chunk of a stream from a file, like FMHitsDecode.
+ * Return 1 if a chunk was read, 0 at the end of the stream and -1 on a
+ *  malformed chunk or memory allocation error.
+ */
+int FMHitsRead(FILE *in, unsigned long **positions, size_t *count,
+               size_t *capacity) {
+  uint64_t n, payload_sz;
+  *count = 0;
+  if (!ReadVarint(in, &n))
+    return -1;
+  if (!n)
+    return 0;
+  if (!ReadVarint(in, &payload_sz) || n > payload_sz)
+    return -1;
+
+  uint8_t *payload = malloc(payload_sz);
+  if (!payload || fread(payload, 1, payload_sz, in) != payload_sz ||
+      !Reserve(positions, capacity, n))
+    goto error;
+
+  size_t pos = 0;
+  unsigned long prev = 0;
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t gap;
+    if (!GetVarint(payload, payload_sz, &pos, &gap))
+      goto error;
+    (*positions)[i] = prev += gap;
+  }
+  free(payload);
+  if (pos != payload_sz)
+    return -1;
+  *count = n;
+  return 1;
+
+error:
+  free(payload);
+  return -1;
+}
+
+/* Locate the rows [start, end) chunk_sz at a time, and pass every chunk to
+ *  write as soon as it is encoded, followed by the end of the stream.
+ * Return 0 on memory allocation error or if write stopped the stream.
+ */
+int FMIndexLocateEncoded(fm_index *fm, ranges_t start, ranges_t end,
+                         size_t chunk_sz, fm_hits_writer write, void *arg) {
+  if (!chunk_sz)
+    chunk_sz = FM_HITS_CHUNK_SZ;
+  size_t max_chunk = (end - start < chunk_sz) ? end - start : chunk_sz;
+  unsigned long *positions = malloc((max_chunk + 1) * sizeof(unsigned long));
+  unsigned long *tmp = malloc((max_chunk + 1) * sizeof(unsigned long));
+  uint8_t *out = malloc(FMHitsEncodedBound(max_chunk));
+  int ok = positions && tmp && out;
+
+  for (ranges_t row = start; ok && row < end; row += max_chunk) {
+    ranges_t chunk_end = (end - row < max_chunk) ? end : row + max_chunk;
+    FMIndexFindRangeIndices(fm, row, chunk_end, &positions);
+    FM_TRACE_BEGIN(encode_span);
+    FMIndexSortPositions(fm, positions, tmp, chunk_end - row);
+    size_t sz = FMHitsEncode(positions, chunk_end - row, out);
+    FM_TRACE_END(encode_span, "encode", 0, chunk_end - row);
+    FM_TRACE_BEGIN(output_span);
+    ok = write(arg, out, sz);
+    FM_TRACE_END(output_span, "output", 0, chunk_end - row);
+  }
+  if (ok)
+    ok = write(arg, out, FMHitsEncode(positions, 0, out));
+
+  free(positions);
+  free(tmp);
+  free(out);
+  return ok;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Default number of positions located, sorted and encoded at a time.
+#define FM_HITS_CHUNK_SZ 65536
+
+/* Called with every encoded chunk of a located range, in order.
+ * Return 0 to stop locating.
+ */
+typedef int (*fm_hits_writer)(void *arg, const uint8_t *data, size_t sz);
+
+size_t FMHitsEncodedBound(size_t count);
+size_t FMHitsEncode(const unsigned long *positions, size_t count,
+                    uint8_t *out);
+size_t FMHitsDecode(const uint8_t *in, size_t sz, unsigned long **positions,
+                    size_t *count, size_t *capacity);
+int FMHitsRead(FILE *in, unsigned long **positions, size_t *count,
+               size_t *capacity);
+int FMIndexLocateEncoded(fm_index *fm, ranges_t start, ranges_t end,
+                         size_t chunk_sz, fm_hits_writer write, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
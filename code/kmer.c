@@ -0,0 +1,182 @@
+#include "kmer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* k-mer spectrum by traversal of the index.
+ * Every k-mer of the text is a path of k backward steps from the range of
+ *  the empty string, so a depth-first search that extends each range with
+ *  every character and drops empty ranges visits each distinct suffix of a
+ *  k-mer once. Counts only shrink when a range is extended, so ranges below
+ *  the minimum count are dropped as well. A range of a single row has only
+ *  one extension, which is followed with one LF step.
+ * The first levels are expanded breadth-first into subtrees, which the
+ *  threads of the pool then take one at a time.
+ */
+
+typedef struct kmer_task {
+  ranges_t start;
+  ranges_t end;
+} kmer_task;
+
+typedef struct kmer_job {
+  fm_index *fm;
+  size_t k;
+  ranges_t min_count;
+  fm_kmer_visitor visit;
+  void *arg;
+  kmer_task *tasks;
+  // The last task_depth characters of the k-mers of each task.
+  char *task_chars;
+  size_t task_count;
+  size_t task_depth;
+  size_t next_task;
+  int stop;
+} kmer_job;
+
+// Whether k-mers may contain the character with the given alphabet index.
+static int KmerCharacter(fm_index *fm, size_t c) {
+  return c != 0 && fm->alphabet[c] != FM_DOCUMENT_SEPARATOR;
+}
+
+/* Visit all k-mers ending in kmer[k - depth, k), whose range is
+ *  [start, end).
+ */
+static void Traverse(kmer_job *job, unsigned thread, char *kmer, size_t depth,
+                     ranges_t start, ranges_t end) {
+  fm_index *fm = job->fm;
+  size_t k = job->k;
+  if (__atomic_load_n(&job->stop, __ATOMIC_RELAXED))
+    return;
+
+  if (end - start == 1 && fm->bwt) {
+    // The preceding characters of a single occurrence are in the BWT.
+    ranges_t row = start;
+    for (; depth < k; ++depth) {
+      int c = fm->alphabet_map[(unsigned char)fm->bwt[row]];
+      if (!KmerCharacter(fm, c))
+        return;
+      kmer[k - 1 - depth] = fm->alphabet[c];
+      row = fm->ranges[2 * c] + FMIndexOcc(fm, c, row);
+    }
+    start = row;
+    end = row + 1;
+  }
+
+  if (depth == k) {
+    if (!job->visit(job->arg, thread, kmer, start, end))
+      __atomic_store_n(&job->stop, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  for (size_t c = 1; c < fm->alphabet_sz; ++c) {
+    if (!KmerCharacter(fm, c) ||
+        fm->ranges[2 * c + 1] - fm->ranges[2 * c] < job->min_count)
+      continue;
+    ranges_t new_start = fm->ranges[2 * c] + FMIndexOcc(fm, c, start);
+    ranges_t new_end = fm->ranges[2 * c] + FMIndexOcc(fm, c, end);
+    if (new_end - new_start < job->min_count)
+      continue;
+    kmer[k - 1 - depth] = fm->alphabet[c];
+    Traverse(job, thread, kmer, depth + 1, new_start, new_end);
+  }
+}
+
+static void TraverseTasks(void *arg, unsigned thread) {
+  kmer_job *job = arg;
+  char kmer[job->k];
+  size_t i;
+  while ((i = __atomic_fetch_add(&job->next_task, 1, __ATOMIC_RELAXED)) <
+         job->task_count) {
+    memcpy(&kmer[job->k - job->task_depth],
+           &job->task_chars[i * job->task_depth], job->task_depth);
+    Traverse(job, thread, kmer, job->task_depth, job->tasks[i].start,
+             job->tasks[i].end);
+  }
+}
+
+/* Expand the tasks by one level, keeping the ranges of at least min_count
+ *  rows. Return 0 on memory allocation error.
+ */
+static int ExpandTasks(kmer_job *job) {
+  fm_index *fm = job->fm;
+  size_t depth = job->task_depth;
+  size_t capacity = job->task_count * (fm->alphabet_sz - 1) + 1;
+  kmer_task *tasks = malloc(capacity * sizeof(kmer_task));
+  char *chars = malloc(capacity * (depth + 1));
+  if (!tasks || !chars) {
+    free(tasks);
+    free(chars);
+    return 0;
+  }
+
+  size_t count = 0;
+  for (size_t i = 0; i < job->task_count; ++i) {
+    kmer_task *task = &job->tasks[i];
+    for (size_t c = 1; c < fm->alphabet_sz; ++c) {
+      if (!KmerCharacter(fm, c))
+        continue;
+      ranges_t start = fm->ranges[2 * c] + FMIndexOcc(fm, c, task->start);
+      ranges_t end = fm->ranges[2 * c] + FMIndexOcc(fm, c, task->end);
+      if (end - start < job->min_count)
+        continue;
+      tasks[count] = (kmer_task){start, end};
+      chars[count * (depth + 1)] = fm->alphabet[c];
+      memcpy(&chars[count * (depth + 1) + 1], &job->task_chars[i * depth],
+             depth);
+      ++count;
+    }
+  }
+
+  free(job->tasks);
+  free(job->task_chars);
+  job->tasks = tasks;
+  job->task_chars = chars;
+  job->task_count = count;
+  job->task_depth = depth + 1;
+  return 1;
+}
+
+/* Call visit for every distinct k-mer of the text that occurs at least
+ *  min_count times, in no particular order. K-mers do not contain the
+ *  document separator. The traversal runs on all threads of the pool, or on
+ *  the calling thread if pool is NULL.
+ * Return 0 on memory allocation error or if visit stopped the traversal.
+ */
+int FMIndexKmerSpectrum(fm_index *fm, fm_locate_pool *pool, size_t k,
+                        ranges_t min_count, fm_kmer_visitor visit, void *arg) {
+  if (!k)
+    return 0;
+  kmer_job job = {0};
+  job.fm = fm;
+  job.k = k;
+  job.min_count = (min_count) ? min_count : 1;
+  job.visit = visit;
+  job.arg = arg;
+  job.tasks = malloc(sizeof(kmer_task));
+  job.task_chars = malloc(1);
+  if (!job.tasks || !job.task_chars)
+    goto error;
+  job.tasks[0] = (kmer_task){0, fm->bwt_sz};
+  job.task_count = 1;
+
+  unsigned threads = (pool) ? FMLocatePoolThreadCount(pool) : 1;
+  while (threads > 1 && job.task_depth < k && job.task_count &&
+         job.task_count < (size_t)threads * FM_KMER_TASKS_PER_THREAD)
+    if (!ExpandTasks(&job))
+      goto error;
+
+  if (threads > 1)
+    FMLocatePoolRun(pool, &TraverseTasks, &job);
+  else
+    TraverseTasks(&job, 0);
+
+  free(job.tasks);
+  free(job.task_chars);
+  return !job.stop;
+
+error:
+  free(job.tasks);
+  free(job.task_chars);
+  return 0;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+#include "locate.h"
+
+// Subtrees of the traversal handed out per thread, so that threads which
+//  finish early take over work from the others.
+#define FM_KMER_TASKS_PER_THREAD 64
+
+/* Called for every k-mer with its range in the F column, possibly from
+ *  several threads at once, each passing its own thread index. The k-mer is
+ *  not null-terminated. Return 0 to stop the traversal.
+ */
+typedef int (*fm_kmer_visitor)(void *arg, unsigned thread, const char *kmer,
+                               ranges_t start, ranges_t end);
+
+int FMIndexKmerSpectrum(fm_index *fm, fm_locate_pool *pool, size_t k,
+                        ranges_t min_count, fm_kmer_visitor visit, void *arg);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,192 @@
+#include "fmindex.h"
+#include "kmer.h"
+#include "locate.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Records are collected per thread in buffers of this many bytes.
+#define OUTPUT_BUFFER_SZ (1 << 20)
+
+typedef struct kmer_output {
+  FILE *out;
+  pthread_mutex_t lock;
+  size_t k;
+  int with_ranges;
+  int text;
+  size_t record_sz;
+  char **buffers;
+  size_t *used;
+  int failed;
+  // Per thread, to avoid sharing counters.
+  unsigned long *distinct;
+  unsigned long *occurrences;
+} kmer_output;
+
+static void Flush(kmer_output *o, unsigned thread) {
+  pthread_mutex_lock(&o->lock);
+  if (fwrite(o->buffers[thread], 1, o->used[thread], o->out) !=
+      o->used[thread])
+    o->failed = 1;
+  pthread_mutex_unlock(&o->lock);
+  o->used[thread] = 0;
+}
+
+static int WriteKmer(void *arg, unsigned thread, const char *kmer,
+                     ranges_t start, ranges_t end) {
+  kmer_output *o = arg;
+  ++o->distinct[thread];
+  o->occurrences[thread] += end - start;
+  if (o->used[thread] + o->record_sz > OUTPUT_BUFFER_SZ)
+    Flush(o, thread);
+
+  char *p = &o->buffers[thread][o->used[thread]];
+  ranges_t count = end - start;
+  if (o->text) {
+    memcpy(p, kmer, o->k);
+    int len = (o->with_ranges)
+                  ? sprintf(p + o->k, " %u %u %u\n", count, start, end)
+                  : sprintf(p + o->k, " %u\n", count);
+    o->used[thread] += o->k + len;
+  } else {
+    memcpy(p, kmer, o->k);
+    memcpy(p + o->k, &count, sizeof(ranges_t));
+    if (o->with_ranges) {
+      memcpy(p + o->k + sizeof(ranges_t), &start, sizeof(ranges_t));
+      memcpy(p + o->k + 2 * sizeof(ranges_t), &end, sizeof(ranges_t));
+    }
+    o->used[thread] += o->record_sz;
+  }
+  return !o->failed;
+}
+
+static void usage(char *name) {
+  printf("Usage: $ %s [-m MINCOUNT] [-t THREADS] [-r] [-T] <FMINDEXFILE> <K> "
+         "<OUTPUTFILE>\n",
+         name);
+  printf("Write every distinct k-mer of the indexed text with its number of "
+         "occurrences\nto OUTPUTFILE (- for standard output), in no "
+         "particular order.\n");
+  printf("  -m  Only write k-mers occurring at least this often (default "
+         "1).\n");
+  printf("  -t  Number of threads (default all processors).\n");
+  printf("  -r  Also write the range of each k-mer in the F column.\n");
+  printf("  -T  Write lines of text instead of binary records.\n");
+  printf("The binary output starts with K and a flag for -r as 32-bit "
+         "integers, followed\nby one record per k-mer: its K characters, the "
+         "count and with -r the start\nand end of its range, as native "
+         "32-bit integers.\n");
+}
+
+int main(int argc, char *argv[]) {
+  ranges_t min_count = 1;
+  unsigned threads = sysconf(_SC_NPROCESSORS_ONLN);
+  kmer_output o = {0};
+  int opt;
+  while ((opt = getopt(argc, argv, "m:t:rT")) != -1) {
+    switch (opt) {
+    case 'm':
+      min_count = strtoul(optarg, NULL, 10);
+      break;
+    case 't':
+      threads = atoi(optarg);
+      break;
+    case 'r':
+      o.with_ranges = 1;
+      break;
+    case 'T':
+      o.text = 1;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind != 3 || !threads || !(o.k = atol(argv[optind + 1]))) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  fm_index *fm = FMIndexReadFromFile(argv[optind], 0);
+  if (!fm) {
+    printf("Could not read FM-index from file.\n");
+    return 1;
+  }
+
+  char *output = argv[optind + 2];
+  o.out = (strcmp(output, "-") == 0) ? stdout : fopen(output, "wb");
+  if (!o.out) {
+    printf("Failed to open output file.\n");
+    return 1;
+  }
+  // Text records hold three numbers of at most 10 digits and sprintf adds a
+  //  null character.
+  o.record_sz = (o.text) ? o.k + 35
+                         : o.k + (o.with_ranges ? 3 : 1) * sizeof(ranges_t);
+  if (o.record_sz > OUTPUT_BUFFER_SZ) {
+    fprintf(stderr, "K is too large.\n");
+    return 1;
+  }
+  if (!o.text) {
+    uint32_t header[2] = {o.k, o.with_ranges};
+    fwrite(header, sizeof(uint32_t), 2, o.out);
+  }
+
+  pthread_mutex_init(&o.lock, NULL);
+  o.buffers = calloc(threads, sizeof(char *));
+  o.used = calloc(threads, sizeof(size_t));
+  o.distinct = calloc(threads, sizeof(unsigned long));
+  o.occurrences = calloc(threads, sizeof(unsigned long));
+  if (!o.buffers || !o.used || !o.distinct || !o.occurrences) {
+    fprintf(stderr, "Failed to allocate output buffers.\n");
+    return 1;
+  }
+  for (unsigned i = 0; i < threads; ++i)
+    if (!(o.buffers[i] = malloc(OUTPUT_BUFFER_SZ))) {
+      fprintf(stderr, "Failed to allocate output buffers.\n");
+      return 1;
+    }
+
+  fm_locate_pool *pool = (threads > 1) ? FMLocatePoolCreate(threads) : NULL;
+  if (threads > 1 && !pool) {
+    fprintf(stderr, "Failed to start threads.\n");
+    return 1;
+  }
+
+  struct timespec start_time, end_time;
+  clock_gettime(CLOCK_MONOTONIC, &start_time);
+  int ok = FMIndexKmerSpectrum(fm, pool, o.k, min_count, &WriteKmer, &o);
+  for (unsigned i = 0; i < threads; ++i)
+    Flush(&o, i);
+  clock_gettime(CLOCK_MONOTONIC, &end_time);
+
+  unsigned long distinct = 0, occurrences = 0;
+  for (unsigned i = 0; i < threads; ++i) {
+    distinct += o.distinct[i];
+    occurrences += o.occurrences[i];
+    free(o.buffers[i]);
+  }
+  double seconds = (end_time.tv_sec - start_time.tv_sec) +
+                   (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+  fprintf(stderr, "%lu distinct %lu-mers with %lu occurrences in %.3f s.\n",
+          distinct, o.k, occurrences, seconds);
+
+  if (pool)
+    FMLocatePoolFree(pool);
+  FMIndexFree(fm);
+  free(o.buffers);
+  free(o.used);
+  free(o.distinct);
+  free(o.occurrences);
+  pthread_mutex_destroy(&o.lock);
+  if (!ok || o.failed || (o.out != stdout && fclose(o.out) != 0)) {
+    fprintf(stderr, "Failed to write k-mers.\n");
+    return 1;
+  }
+  return 0;
+}
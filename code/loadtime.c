@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+
+#include "compress.h"
+#include "fmindex.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef enum load_method {
+  LOAD_READ,
+  LOAD_COMPRESSED,
+  LOAD_MMAP,
+} load_method;
+
+static const char *method_names[] = {"read", "compressed", "mmap"};
+
+static double Seconds(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Drop the cached pages of filename, so the next load reads from disk.
+//  Pages are only dropped once written back, which construct makes sure of.
+static int DropCache(char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  int ok = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) == 0;
+  close(fd);
+  return ok;
+}
+
+// Map filename and touch every page, which is the least a load through
+//  mmap costs before the first query. Return 0 on error.
+static int MapAndTouch(char *filename) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !st.st_size) {
+    close(fd);
+    return 0;
+  }
+  volatile char *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+    return 0;
+
+  long page_sz = sysconf(_SC_PAGESIZE);
+  char sum = 0;
+  for (off_t i = 0; i < st.st_size; i += page_sz)
+    sum += data[i];
+  munmap((void *)data, st.st_size);
+  return sum || 1;
+}
+
+// Return the seconds taken to load filename with the given method, or a
+//  negative number on error.
+static double Load(char *filename, load_method method, int cold) {
+  if (cold && !DropCache(filename))
+    return -1.;
+
+  double start = Seconds();
+  if (method == LOAD_MMAP) {
+    if (!MapAndTouch(filename))
+      return -1.;
+  } else {
+    fm_index *fm = FMIndexReadFromFile(filename, 0);
+    if (!fm)
+      return -1.;
+    double seconds = Seconds() - start;
+    FMIndexFree(fm);
+    return seconds;
+  }
+  return Seconds() - start;
+}
+
+// Store the fastest of repeats cold and warm loads in best. Return 0 on error.
+static int Measure(char *filename, load_method method, unsigned repeats,
+                   double best[2]) {
+  for (int warm = 0; warm < 2; ++warm) {
+    // Warm the cache before timing warm loads.
+    if (warm && Load(filename, method, 0) < 0.)
+      return 0;
+    best[warm] = -1.;
+    for (unsigned i = 0; i < repeats; ++i) {
+      double seconds = Load(filename, method, !warm);
+      if (seconds < 0.)
+        return 0;
+      if (best[warm] < 0. || seconds < best[warm])
+        best[warm] = seconds;
+    }
+  }
+  return 1;
+}
+
+static void usage(char *name) {
+  printf("Usage: $ %s [-t THREADS] [-n REPEATS] <RAWFM> <COMPRESSEDFM>\n",
+         name);
+  printf("Compare the time to load an index written by construct with and "
+         "without -z,\nby reading the raw file, decompressing the compressed "
+         "one and mapping the\nraw file, each with a cold and a warm page "
+         "cache.\n");
+  printf("  -t  Threads used for decompression (default all processors).\n");
+  printf("  -n  Number of loads per measurement; the fastest counts "
+         "(default 3).\n");
+}
+
+int main(int argc, char *argv[]) {
+  unsigned repeats = 3;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:n:")) != -1) {
+    switch (opt) {
+    case 't':
+      FMCompressSetThreads(atoi(optarg));
+      break;
+    case 'n':
+      repeats = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind != 2 || !repeats) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  char *files[] = {argv[optind], argv[optind + 1], argv[optind]};
+  printf("method\tfile_bytes\tcold_s\twarm_s\n");
+  for (load_method m = LOAD_READ; m <= LOAD_MMAP; ++m) {
+    struct stat st;
+    if (stat(files[m], &st) != 0) {
+      fprintf(stderr, "Failed to open %s.\n", files[m]);
+      return 1;
+    }
+
+    double best[2];
+    if (!Measure(files[m], m, repeats, best)) {
+      fprintf(stderr, "Failed to load %s.\n", files[m]);
+      return 1;
+    }
+    printf("%s\t%lu\t%.4f\t%.4f\n", method_names[m], (unsigned long)st.st_size,
+           best[0], best[1]);
+  }
+  return 0;
+}
@@ -0,0 +1,326 @@
+#include "locate.h"
+#include "packed.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Parallel locate.
+ * A pool of worker threads runs one function at a time on all threads,
+ *  with the calling thread acting as worker 0. Locating splits the
+ *  concatenated match ranges into one slice per thread. Sorting is an LSD
+ *  radix sort on 8-bit digits, where each pass counts digits per slice,
+ *  computes every slice's bucket offsets, and scatters the slices in
+ *  parallel, which keeps the sort stable.
+ */
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+
+struct fm_locate_pool {
+  pthread_t *threads;
+  unsigned thread_count; // Including the calling thread.
+  pthread_mutex_t lock;
+  pthread_cond_t start_cond;
+  pthread_cond_t done_cond;
+  unsigned long generation;
+  unsigned pending;
+  int stop;
+  void (*func)(void *, unsigned);
+  void *arg;
+};
+
+typedef struct pool_worker {
+  fm_locate_pool *pool;
+  unsigned id;
+} pool_worker;
+
+typedef struct locate_job {
+  fm_index *fm;
+  unsigned thread_count;
+  ranges_t *starts;
+  ranges_t *ends;
+  size_t range_count;
+  size_t *offsets; // Output offset of each range, plus the total.
+  unsigned long *out;
+  unsigned long *tmp;
+  size_t *counts; // RADIX_BUCKETS digit counts per thread.
+  unsigned shift;
+} locate_job;
+
+static void *PoolWorker(void *arg) {
+  pool_worker *worker = arg;
+  fm_locate_pool *pool = worker->pool;
+  unsigned long seen = 0;
+  FM_TRACE_THREAD("pool worker");
+
+  for (;;) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->generation == seen && !pool->stop)
+      pthread_cond_wait(&pool->start_cond, &pool->lock);
+    if (pool->stop) {
+      pthread_mutex_unlock(&pool->lock);
+      break;
+    }
+    seen = pool->generation;
+    void (*func)(void *, unsigned) = pool->func;
+    void *func_arg = pool->arg;
+    pthread_mutex_unlock(&pool->lock);
+
+    FM_TRACE_BEGIN(span);
+    func(func_arg, worker->id);
+    FM_TRACE_END(span, "pool task", 0, 0);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0)
+      pthread_cond_signal(&pool->done_cond);
+    pthread_mutex_unlock(&pool->lock);
+  }
+
+  free(worker);
+  return NULL;
+}
+
+/* Create a pool of thread_count threads including the calling thread.
+ * Return NULL on memory allocation or thread creation error.
+ */
+fm_locate_pool *FMLocatePoolCreate(unsigned thread_count) {
+  fm_locate_pool *pool = calloc(1, sizeof(fm_locate_pool));
+  if (!pool)
+    return NULL;
+  if (!thread_count)
+    thread_count = 1;
+
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start_cond, NULL);
+  pthread_cond_init(&pool->done_cond, NULL);
+  pool->thread_count = 1;
+  if (!(pool->threads = calloc(thread_count, sizeof(pthread_t))))
+    goto error;
+
+  for (unsigned i = 1; i < thread_count; ++i) {
+    pool_worker *worker = malloc(sizeof(pool_worker));
+    if (!worker)
+      goto error;
+    worker->pool = pool;
+    worker->id = i;
+    if (pthread_create(&pool->threads[i], NULL, &PoolWorker, worker) != 0) {
+      free(worker);
+      goto error;
+    }
+    ++pool->thread_count;
+  }
+
+  return pool;
+
+error:
+  FMLocatePoolFree(pool);
+  return NULL;
+}
+
+void FMLocatePoolFree(fm_locate_pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stop = 1;
+  pthread_cond_broadcast(&pool->start_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (unsigned i = 1; i < pool->thread_count; ++i)
+    pthread_join(pool->threads[i], NULL);
+
+  pthread_mutex_destroy(&pool->lock);
+  pthread_cond_destroy(&pool->start_cond);
+  pthread_cond_destroy(&pool->done_cond);
+  free(pool->threads);
+  free(pool);
+}
+
+unsigned FMLocatePoolThreadCount(fm_locate_pool *pool) {
+  return pool->thread_count;
+}
+
+// Run func(arg, id) on every thread of the pool and wait for all of them.
+void FMLocatePoolRun(fm_locate_pool *pool, void (*func)(void *, unsigned),
+                     void *arg) {
+  pthread_mutex_lock(&pool->lock);
+  pool->func = func;
+  pool->arg = arg;
+  pool->pending = pool->thread_count - 1;
+  ++pool->generation;
+  pthread_cond_broadcast(&pool->start_cond);
+  pthread_mutex_unlock(&pool->lock);
+
+  FM_TRACE_BEGIN(task_span);
+  func(arg, 0);
+  FM_TRACE_END(task_span, "pool task", 0, 0);
+
+  FM_TRACE_BEGIN(wait_span);
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending)
+    pthread_cond_wait(&pool->done_cond, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+  FM_TRACE_END(wait_span, "pool wait", 0, 0);
+}
+
+static void JobRun(locate_job *job, fm_locate_pool *pool,
+                   void (*func)(void *, unsigned)) {
+  if (job->thread_count > 1)
+    FMLocatePoolRun(pool, func, job);
+  else
+    func(job, 0);
+}
+
+// Return the first output position of slice id of the job.
+static size_t SliceBegin(locate_job *job, unsigned id) {
+  size_t total = job->offsets[job->range_count];
+  return total / job->thread_count * id +
+         (total % job->thread_count) * id / job->thread_count;
+}
+
+static void LocateSlice(void *arg, unsigned id) {
+  locate_job *job = arg;
+  if (id >= job->thread_count)
+    return;
+  size_t begin = SliceBegin(job, id), end = SliceBegin(job, id + 1);
+  if (begin == end)
+    return;
+
+  // Find the range holding the first output position of the slice.
+  size_t lo = 0, hi = job->range_count;
+  while (hi - lo > 1) {
+    size_t mid = (lo + hi) / 2;
+    if (job->offsets[mid] <= begin)
+      lo = mid;
+    else
+      hi = mid;
+  }
+
+  for (size_t r = lo; begin < end; ++r) {
+    if (job->offsets[r + 1] <= begin)
+      continue;
+    size_t skip = begin - job->offsets[r];
+    size_t take = job->offsets[r + 1] - begin;
+    if (take > end - begin)
+      take = end - begin;
+    unsigned long *out = job->out + begin;
+    FMIndexFindRangeIndices(job->fm, job->starts[r] + skip,
+                            job->starts[r] + skip + take, &out);
+    begin += take;
+  }
+}
+
+static void RadixCount(void *arg, unsigned id) {
+  locate_job *job = arg;
+  if (id >= job->thread_count)
+    return;
+  size_t *counts = job->counts + id * RADIX_BUCKETS;
+  memset(counts, 0, RADIX_BUCKETS * sizeof(size_t));
+  for (size_t i = SliceBegin(job, id); i < SliceBegin(job, id + 1); ++i)
+    ++counts[(job->out[i] >> job->shift) & (RADIX_BUCKETS - 1)];
+}
+
+static void RadixScatter(void *arg, unsigned id) {
+  locate_job *job = arg;
+  if (id >= job->thread_count)
+    return;
+  size_t *offsets = job->counts + id * RADIX_BUCKETS;
+  for (size_t i = SliceBegin(job, id); i < SliceBegin(job, id + 1); ++i)
+    job->tmp[offsets[(job->out[i] >> job->shift) & (RADIX_BUCKETS - 1)]++] =
+        job->out[i];
+}
+
+static void RadixSort(locate_job *job, fm_locate_pool *pool) {
+  FM_TRACE_BEGIN(span);
+  unsigned width = PackedWidth(job->fm->bwt_sz);
+  for (job->shift = 0; job->shift < width; job->shift += RADIX_BITS) {
+    JobRun(job, pool, RadixCount);
+
+    // Turn counts into output offsets, bucket-major and thread-minor.
+    size_t sum = 0;
+    for (unsigned b = 0; b < RADIX_BUCKETS; ++b) {
+      for (unsigned t = 0; t < job->thread_count; ++t) {
+        size_t count = job->counts[t * RADIX_BUCKETS + b];
+        job->counts[t * RADIX_BUCKETS + b] = sum;
+        sum += count;
+      }
+    }
+
+    JobRun(job, pool, RadixScatter);
+    unsigned long *swap = job->out;
+    job->out = job->tmp;
+    job->tmp = swap;
+  }
+  FM_TRACE_END(span, "sort", 0, job->offsets[job->range_count]);
+}
+
+/* Locate all matches of the ranges [starts[i], ends[i]) into a newly
+ *  allocated positions array. Large inputs are split over the threads of the
+ *  pool, which may be NULL to locate on the calling thread only.
+ * If sorted is non-zero the positions are returned in text order with
+ *  duplicates (from overlapping ranges) removed, otherwise in range order.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+int FMIndexLocate(fm_index *fm, fm_locate_pool *pool, ranges_t *starts,
+                  ranges_t *ends, size_t range_count, int sorted,
+                  unsigned long **positions, size_t *position_count) {
+  FM_TRACE_BEGIN(span);
+  locate_job job = {fm, 1, starts, ends, range_count, NULL, NULL, NULL, NULL, 0};
+  *positions = NULL;
+  *position_count = 0;
+
+  if (!(job.offsets = malloc((range_count + 1) * sizeof(size_t))))
+    return 0;
+  job.offsets[0] = 0;
+  for (size_t r = 0; r < range_count; ++r)
+    job.offsets[r + 1] = job.offsets[r] + (ends[r] - starts[r]);
+  size_t total = job.offsets[range_count];
+
+  if (pool && total >= FM_LOCATE_PARALLEL_MIN)
+    job.thread_count = pool->thread_count;
+
+  if (!(job.out = malloc((total ? total : 1) * sizeof(unsigned long))))
+    goto error;
+  JobRun(&job, pool, LocateSlice);
+
+  if (sorted && total > 1) {
+    if (!(job.tmp = malloc(total * sizeof(unsigned long))) ||
+        !(job.counts =
+              malloc(job.thread_count * RADIX_BUCKETS * sizeof(size_t))))
+      goto error;
+    RadixSort(&job, pool);
+
+    size_t unique = 1;
+    for (size_t i = 1; i < total; ++i)
+      if (job.out[i] != job.out[unique - 1])
+        job.out[unique++] = job.out[i];
+    total = unique;
+  }
+
+  free(job.offsets);
+  free(job.tmp);
+  free(job.counts);
+  *positions = job.out;
+  *position_count = total;
+  FM_TRACE_END(span, "parallel locate", 0, total);
+  return 1;
+
+error:
+  free(job.offsets);
+  free(job.out);
+  free(job.tmp);
+  free(job.counts);
+  return 0;
+}
+
+/* Sort count positions of the index in place on the calling thread, using
+ *  tmp of the same size.
+ */
+void FMIndexSortPositions(fm_index *fm, unsigned long *positions,
+                          unsigned long *tmp, size_t count) {
+  size_t offsets[2] = {0, count};
+  size_t counts[RADIX_BUCKETS];
+  locate_job job = {fm, 1, NULL, NULL, 1, offsets, positions, tmp, counts, 0};
+  RadixSort(&job, NULL);
+  if (job.out != positions)
+    memcpy(positions, job.out, count * sizeof(unsigned long));
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+
+// Ranges with fewer entries than this are located by the calling thread.
+#define FM_LOCATE_PARALLEL_MIN (1 << 14)
+
+typedef struct fm_locate_pool fm_locate_pool;
+
+fm_locate_pool *FMLocatePoolCreate(unsigned thread_count);
+void FMLocatePoolFree(fm_locate_pool *pool);
+unsigned FMLocatePoolThreadCount(fm_locate_pool *pool);
+void FMLocatePoolRun(fm_locate_pool *pool, void (*func)(void *, unsigned),
+                     void *arg);
+
+int FMIndexLocate(fm_index *fm, fm_locate_pool *pool, ranges_t *starts,
+                  ranges_t *ends, size_t range_count, int sorted,
+                  unsigned long **positions, size_t *position_count);
+void FMIndexSortPositions(fm_index *fm, unsigned long *positions,
+                          unsigned long *tmp, size_t count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,145 @@
+#include "matchstats.h"
+
+#include <stdlib.h>
+
+/* Matching statistics with backward search and range widening.
+ * The query is scanned once from right to left while keeping the range of
+ *  the longest prefix of the remaining query that occurs in the text. When
+ *  the next character cannot be prepended, the range is widened to its parent
+ *  interval in the LCP interval tree, which drops characters from the end of
+ *  the match. Every character is prepended once and every widening shortens
+ *  the match, so the total work is linear in the query length.
+ */
+
+typedef struct smem_output {
+  size_t min_length;
+  ranges_t min_occ;
+  ranges_t max_occ;
+  fm_mem *mems;
+  size_t count;
+  size_t capacity;
+} smem_output;
+
+/* Widen the range [*start, *end) to the smallest enclosing LCP interval,
+ *  returning the length of the prefix that its suffixes share.
+ */
+static size_t WidenToParent(fm_index *fm, ranges_t *start, ranges_t *end) {
+  size_t i = (fm->lcp[*start] >= fm->lcp[*end]) ? *start : *end;
+  *start = fm->lcp_psv[i];
+  *end = fm->lcp_nsv[i];
+  return fm->lcp[i];
+}
+
+static int AddSMEM(smem_output *out, size_t pos, size_t length,
+                   ranges_t start, ranges_t end) {
+  if (length < out->min_length || end - start < out->min_occ ||
+      end - start > out->max_occ)
+    return 1;
+
+  if (out->count == out->capacity) {
+    size_t capacity = (out->capacity) ? 2 * out->capacity : 16;
+    fm_mem *mems = realloc(out->mems, capacity * sizeof(fm_mem));
+    if (!mems)
+      return 0;
+    out->mems = mems;
+    out->capacity = capacity;
+  }
+
+  out->mems[out->count++] = (fm_mem){pos, length, start, end};
+  return 1;
+}
+
+/* Scan the query once, writing matching statistics to ms and collecting
+ *  super-maximal exact matches in out, either of which may be NULL.
+ * Return 0 on memory allocation error, 1 otherwise.
+ */
+static int MatchingStatisticsPass(fm_index *fm, char *query, size_t query_sz,
+                                  size_t *ms, smem_output *out) {
+  ranges_t start = 0, end = fm->bwt_sz;
+  size_t length = 0;
+  // The match found at the previous (right) position, reported once it is
+  //  known that it cannot be extended to the left.
+  size_t prev_length = 0;
+  ranges_t prev_start = 0, prev_end = 0;
+
+  for (size_t i = query_sz; i > 0; --i) {
+    int alphabet_idx = fm->alphabet_map[(unsigned char)query[i - 1]];
+
+    // The dollar sign never occurs in a query.
+    while (alphabet_idx > 0) {
+      ranges_t range_start = fm->ranges[2 * alphabet_idx];
+      ranges_t new_start = range_start + FMIndexOcc(fm, alphabet_idx, start);
+      ranges_t new_end = range_start + FMIndexOcc(fm, alphabet_idx, end);
+      if (new_start < new_end) {
+        start = new_start;
+        end = new_end;
+        ++length;
+        break;
+      }
+      if (!length)
+        break;
+      length = WidenToParent(fm, &start, &end);
+    }
+    if (alphabet_idx <= 0) {
+      start = 0;
+      end = fm->bwt_sz;
+      length = 0;
+    }
+
+    if (ms)
+      ms[i - 1] = length;
+
+    // The match at i is super-maximal unless the match at i - 1 ends at
+    //  the same position, as the end positions do not decrease.
+    if (out && i < query_sz && prev_length && length <= prev_length &&
+        !AddSMEM(out, i, prev_length, prev_start, prev_end))
+      return 0;
+    prev_length = length;
+    prev_start = start;
+    prev_end = end;
+  }
+
+  if (out && prev_length && !AddSMEM(out, 0, prev_length, prev_start, prev_end))
+    return 0;
+
+  return 1;
+}
+
+/* Compute the matching statistics of the query: ms[i] is the length of the
+ *  longest prefix of query[i, query_sz) that occurs in the text.
+ * The index must have an LCP array.
+ * Return 0 on memory allocation error or if the index has no LCP array.
+ */
+int FMIndexMatchingStatistics(fm_index *fm, char *query, size_t query_sz,
+                              size_t *ms) {
+  if (!fm->lcp)
+    return 0;
+  return MatchingStatisticsPass(fm, query, query_sz, ms, NULL);
+}
+
+/* Find the super-maximal exact matches of the query in the text: matches
+ *  that cannot be extended and are not contained in another match.
+ * Only matches of at least min_length characters with between min_occ and
+ *  max_occ occurrences are reported, in order of decreasing query position.
+ * On success *mems holds a newly allocated array of *mem_count matches.
+ * The index must have an LCP array.
+ * Return 0 on memory allocation error or if the index has no LCP array.
+ */
+int FMIndexFindSMEMs(fm_index *fm, char *query, size_t query_sz,
+                     size_t min_length, ranges_t min_occ, ranges_t max_occ,
+                     fm_mem **mems, size_t *mem_count) {
+  smem_output out = {min_length, min_occ, max_occ, NULL, 0, 0};
+  *mems = NULL;
+  *mem_count = 0;
+  if (!fm->lcp)
+    return 0;
+
+  if (!MatchingStatisticsPass(fm, query, query_sz, NULL, &out)) {
+    free(out.mems);
+    return 0;
+  }
+
+  *mems = out.mems;
+  *mem_count = out.count;
+  return 1;
+}
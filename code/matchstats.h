@@ -0,0 +1,24 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+
+typedef struct fm_mem {
+  size_t query_pos;
+  size_t length;
+  ranges_t start;
+  ranges_t end;
+} fm_mem;
+
+int FMIndexMatchingStatistics(fm_index *fm, char *query, size_t query_sz,
+                              size_t *ms);
+int FMIndexFindSMEMs(fm_index *fm, char *query, size_t query_sz,
+                     size_t min_length, ranges_t min_occ, ranges_t max_occ,
+                     fm_mem **mems, size_t *mem_count);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,453 @@
+#include "fmindex.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Micro-benchmarks of the construction stages and query primitives.
+ * Every stage runs in isolation on inputs prepared beforehand from a seeded
+ *  random text, once to warm up and then a number of timed repetitions, each
+ *  of which is the average time over enough runs to be measured reliably.
+ * The samples can be stored as a baseline, and a later run compared against
+ *  it with a one-sided Mann-Whitney U test, which does not assume normally
+ *  distributed times and is robust against the occasional slow outlier.
+ */
+
+#define MAX_STAGES 8
+
+// Fast stages are repeated within a sample until it takes at least this many
+//  seconds, so timer resolution and scheduling noise do not dominate.
+#define MIN_SAMPLE_TIME 0.01
+
+typedef struct bench_params {
+  size_t size;
+  unsigned alphabet_sz;
+  unsigned long seed;
+  unsigned pattern_count;
+  unsigned pattern_sz;
+} bench_params;
+
+typedef struct bench_inputs {
+  char *text;
+  size_t sz;
+  char *alphabet;
+  sa_t *sa;
+  char *bwt;
+  fm_index *fm;
+  char *patterns;
+  ranges_t *starts;
+  ranges_t *ends;
+  unsigned long *match_indices;
+  unsigned pattern_count;
+  unsigned pattern_sz;
+} bench_inputs;
+
+typedef struct bench_stage {
+  const char *name;
+  void (*run)(bench_inputs *in);
+} bench_stage;
+
+typedef struct stage_samples {
+  char name[64];
+  unsigned count;
+  double *samples;
+} stage_samples;
+
+static uint64_t SplitMix(uint64_t *state) {
+  uint64_t z = (*state += 0x9e3779b97f4a7c15UL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9UL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebUL;
+  return z ^ (z >> 31);
+}
+
+static void RunTextToAlphabet(bench_inputs *in) {
+  free(TextToAlphabet(in->text, in->sz));
+}
+
+static void RunSuffixArray(bench_inputs *in) {
+  free(ConstructSuffixArray(in->text, in->sz));
+}
+
+static void RunBWT(bench_inputs *in) {
+  free(ConstructBWT(in->text, in->sz, in->sa));
+}
+
+static void RunRankMatrix(bench_inputs *in) {
+  free(ConstructRankMatrix(in->bwt, in->sz + 1, in->alphabet));
+}
+
+static void RunCharacterRanges(bench_inputs *in) {
+  free(ConstructCharacterRanges(in->bwt, in->sz + 1, in->alphabet));
+}
+
+static void RunFindMatchRange(bench_inputs *in) {
+  for (unsigned i = 0; i < in->pattern_count; ++i)
+    FMIndexFindMatchRange(in->fm, &in->patterns[i * in->pattern_sz],
+                          in->pattern_sz, &in->starts[i], &in->ends[i]);
+}
+
+static void RunFindRangeIndices(bench_inputs *in) {
+  for (unsigned i = 0; i < in->pattern_count; ++i)
+    FMIndexFindRangeIndices(in->fm, in->starts[i], in->ends[i],
+                            &in->match_indices);
+}
+
+static const bench_stage stages[] = {
+    {"text_to_alphabet", &RunTextToAlphabet},
+    {"suffix_array", &RunSuffixArray},
+    {"bwt", &RunBWT},
+    {"rank_matrix", &RunRankMatrix},
+    {"character_ranges", &RunCharacterRanges},
+    {"find_match_range", &RunFindMatchRange},
+    {"find_range_indices", &RunFindRangeIndices},
+};
+#define STAGE_COUNT (sizeof(stages) / sizeof(stages[0]))
+
+/* Generate the text and the inputs of every stage.
+ * Return 0 on memory allocation error.
+ */
+static int PrepareInputs(bench_params *p, bench_inputs *in) {
+  uint64_t state = p->seed;
+  in->sz = p->size;
+  in->pattern_count = p->pattern_count;
+  in->pattern_sz = p->pattern_sz;
+  if (!(in->text = malloc(p->size + 1)))
+    return 0;
+  // Printable characters after the dollar sign.
+  for (size_t i = 0; i < p->size; ++i)
+    in->text[i] = '%' + SplitMix(&state) % p->alphabet_sz;
+  in->text[p->size] = '\0';
+
+  if (!(in->alphabet = TextToAlphabet(in->text, in->sz)) ||
+      !(in->sa = ConstructSuffixArray(in->text, in->sz)) ||
+      !(in->bwt = ConstructBWT(in->text, in->sz, in->sa)))
+    return 0;
+  char *copy = strdup(in->text);
+  if (!copy || !(in->fm = FMIndexConstruct(copy)))
+    return 0;
+  free(copy);
+
+  // Patterns are sampled from the text, so all of them occur.
+  in->patterns = malloc((size_t)p->pattern_count * p->pattern_sz);
+  in->starts = malloc(p->pattern_count * sizeof(ranges_t));
+  in->ends = malloc(p->pattern_count * sizeof(ranges_t));
+  if (!in->patterns || !in->starts || !in->ends)
+    return 0;
+  for (unsigned i = 0; i < p->pattern_count; ++i)
+    memcpy(&in->patterns[(size_t)i * p->pattern_sz],
+           &in->text[SplitMix(&state) % (p->size - p->pattern_sz + 1)],
+           p->pattern_sz);
+
+  RunFindMatchRange(in);
+  ranges_t max_matches = 0;
+  for (unsigned i = 0; i < p->pattern_count; ++i)
+    if (in->ends[i] - in->starts[i] > max_matches)
+      max_matches = in->ends[i] - in->starts[i];
+  return (in->match_indices = malloc(max_matches * sizeof(unsigned long))) !=
+         NULL;
+}
+
+static void FreeInputs(bench_inputs *in) {
+  free(in->text);
+  free(in->alphabet);
+  free(in->sa);
+  free(in->bwt);
+  if (in->fm)
+    FMIndexFree(in->fm);
+  free(in->patterns);
+  free(in->starts);
+  free(in->ends);
+  free(in->match_indices);
+}
+
+static double Now(void) {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static int CompareDouble(const void *a, const void *b) {
+  double x = *(const double *)a, y = *(const double *)b;
+  return (x > y) - (x < y);
+}
+
+// Return the median of the samples, which are sorted in place.
+static double Median(double *samples, unsigned count) {
+  qsort(samples, count, sizeof(double), &CompareDouble);
+  return (count % 2) ? samples[count / 2]
+                     : (samples[count / 2 - 1] + samples[count / 2]) / 2;
+}
+
+// Return the number of samples of both sets equal to x.
+static unsigned CountEqual(double x, const double *current, unsigned n1,
+                           const double *baseline, unsigned n2) {
+  unsigned count = 0;
+  for (unsigned i = 0; i < n1; ++i)
+    count += current[i] == x;
+  for (unsigned j = 0; j < n2; ++j)
+    count += baseline[j] == x;
+  return count;
+}
+
+/* Return the one-sided p-value of the Mann-Whitney U test that the current
+ *  samples tend to be larger than the baseline samples, using the normal
+ *  approximation with a continuity correction and a variance corrected for
+ *  ties.
+ */
+static double MannWhitneyP(const double *current, unsigned n1,
+                           const double *baseline, unsigned n2) {
+  double u = 0.;
+  for (unsigned i = 0; i < n1; ++i)
+    for (unsigned j = 0; j < n2; ++j)
+      u += (current[i] > baseline[j]) ? 1. : (current[i] == baseline[j]) * .5;
+
+  // Every sample of a group of t tied samples adds t^2 - 1, so the group
+  //  adds the t^3 - t of the tie correction.
+  double n = (double)n1 + n2, ties = 0.;
+  for (unsigned i = 0; i < n1 + n2; ++i) {
+    double x = (i < n1) ? current[i] : baseline[i - n1];
+    double t = CountEqual(x, current, n1, baseline, n2);
+    ties += t * t - 1;
+  }
+
+  double mean = (double)n1 * n2 / 2;
+  double variance =
+      (n < 2) ? 0. : (double)n1 * n2 / 12 * (n + 1 - ties / (n * (n - 1)));
+  double sd = (variance > 0.) ? sqrt(variance) : 0.;
+  if (sd == 0.)
+    return 1.;
+  double z = (u - mean - .5) / sd;
+  return .5 * erfc(z / sqrt(2.));
+}
+
+static void PrintStatistics(const char *name, double *samples,
+                            unsigned count) {
+  double mean = 0., var = 0.;
+  for (unsigned i = 0; i < count; ++i)
+    mean += samples[i];
+  mean /= count;
+  for (unsigned i = 0; i < count; ++i)
+    var += (samples[i] - mean) * (samples[i] - mean);
+  var = (count > 1) ? var / (count - 1) : 0.;
+  double median = Median(samples, count);
+  printf("%-20s %12.6f %12.6f %10.6f %12.6f %12.6f\n", name, median * 1e3,
+         mean * 1e3, sqrt(var) * 1e3, samples[0] * 1e3,
+         samples[count - 1] * 1e3);
+}
+
+/* Read a baseline file written with -o: a header line with the parameters,
+ *  then per stage its name, the number of samples and the samples.
+ * Return the number of stages read, or -1 on error or if the parameters
+ *  differ from the current ones.
+ */
+static int ReadBaseline(char *filename, bench_params *p,
+                        stage_samples *baseline) {
+  FILE *f = fopen(filename, "r");
+  if (!f)
+    return -1;
+
+  bench_params b;
+  int stage_count = 0;
+  if (fscanf(f, "# %lu %u %lu %u %u", &b.size, &b.alphabet_sz, &b.seed,
+             &b.pattern_count, &b.pattern_sz) != 5)
+    goto error;
+  if (b.size != p->size || b.alphabet_sz != p->alphabet_sz ||
+      b.seed != p->seed || b.pattern_count != p->pattern_count ||
+      b.pattern_sz != p->pattern_sz) {
+    fprintf(stderr, "The baseline was measured with other parameters.\n");
+    goto error;
+  }
+
+  stage_samples s;
+  while (stage_count < MAX_STAGES &&
+         fscanf(f, "%63s %u", s.name, &s.count) == 2) {
+    if (!s.count || !(s.samples = malloc(s.count * sizeof(double))))
+      goto error;
+    baseline[stage_count++] = s;
+    for (unsigned i = 0; i < s.count; ++i)
+      if (fscanf(f, "%la", &s.samples[i]) != 1)
+        goto error;
+  }
+  fclose(f);
+  return stage_count;
+
+error:
+  for (int i = 0; i < stage_count; ++i)
+    free(baseline[i].samples);
+  fclose(f);
+  return -1;
+}
+
+static void usage(char *name) {
+  printf("Usage: $ %s [-n SIZE] [-a ALPHABETSIZE] [-S SEED] [-c COUNT] "
+         "[-l LENGTH] [-r REPEATS]\n         [-o BASELINEFILE] [-b "
+         "BASELINEFILE] [-p PVALUE] [-t THRESHOLD] [STAGE]...\n",
+         name);
+  printf("Time construction stages and query primitives on a seeded random "
+         "text, in\nmilliseconds.\n");
+  printf("  -n  Text length (default 262144).\n");
+  printf("  -a  Number of distinct characters (default 4).\n");
+  printf("  -S  Random seed (default 1).\n");
+  printf("  -c  Number of patterns per query repetition (default 10000).\n");
+  printf("  -l  Pattern length (default 8).\n");
+  printf("  -r  Number of timed repetitions per stage (default 15).\n");
+  printf("  -o  Write the samples to this file to serve as a baseline.\n");
+  printf("  -b  Compare against the samples in this baseline file, and exit "
+         "with status 2\n      if any stage is significantly slower.\n");
+  printf("  -p  Significance level of the comparison (default 0.01).\n");
+  printf("  -t  Smallest relative slowdown of the median reported as a "
+         "regression\n      (default 0.05).\n");
+  printf("Stages: ");
+  for (size_t i = 0; i < STAGE_COUNT; ++i)
+    printf("%s%s", stages[i].name, (i + 1 < STAGE_COUNT) ? ", " : "\n");
+}
+
+int main(int argc, char *argv[]) {
+  bench_params p = {1 << 18, 4, 1, 10000, 8};
+  unsigned repeats = 15;
+  char *output = NULL, *baseline_file = NULL;
+  double alpha = 0.01, threshold = 0.05;
+  int opt;
+  while ((opt = getopt(argc, argv, "n:a:S:c:l:r:o:b:p:t:")) != -1) {
+    switch (opt) {
+    case 'n':
+      p.size = strtoul(optarg, NULL, 10);
+      break;
+    case 'a':
+      p.alphabet_sz = atoi(optarg);
+      break;
+    case 'S':
+      p.seed = strtoul(optarg, NULL, 10);
+      break;
+    case 'c':
+      p.pattern_count = atoi(optarg);
+      break;
+    case 'l':
+      p.pattern_sz = atoi(optarg);
+      break;
+    case 'r':
+      repeats = atoi(optarg);
+      break;
+    case 'o':
+      output = optarg;
+      break;
+    case 'b':
+      baseline_file = optarg;
+      break;
+    case 'p':
+      alpha = atof(optarg);
+      break;
+    case 't':
+      threshold = atof(optarg);
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (!p.size || !p.alphabet_sz || p.alphabet_sz > 90 || !p.pattern_count ||
+      !p.pattern_sz || p.pattern_sz > p.size || !repeats) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  // Run the stages given on the command line, or all of them.
+  int selected[STAGE_COUNT];
+  for (size_t i = 0; i < STAGE_COUNT; ++i)
+    selected[i] = (optind == argc);
+  for (int a = optind; a < argc; ++a) {
+    size_t i = 0;
+    while (i < STAGE_COUNT && strcmp(argv[a], stages[i].name) != 0)
+      ++i;
+    if (i == STAGE_COUNT) {
+      fprintf(stderr, "Unknown stage \"%s\".\n", argv[a]);
+      return 1;
+    }
+    selected[i] = 1;
+  }
+
+  stage_samples baseline[MAX_STAGES];
+  int baseline_count = 0;
+  if (baseline_file &&
+      (baseline_count = ReadBaseline(baseline_file, &p, baseline)) < 0) {
+    fprintf(stderr, "Could not read baseline file.\n");
+    return 1;
+  }
+
+  bench_inputs in = {0};
+  if (!PrepareInputs(&p, &in)) {
+    fprintf(stderr, "Failed to prepare inputs.\n");
+    return 1;
+  }
+
+  FILE *out = NULL;
+  if (output) {
+    if (!(out = fopen(output, "w"))) {
+      fprintf(stderr, "Failed to open output file.\n");
+      return 1;
+    }
+    fprintf(out, "# %lu %u %lu %u %u\n", p.size, p.alphabet_sz, p.seed,
+            p.pattern_count, p.pattern_sz);
+  }
+
+  printf("%-20s %12s %12s %10s %12s %12s\n", "stage", "median", "mean",
+         "stddev", "min", "max");
+  double samples[repeats], sorted[repeats];
+  int regressions = 0;
+  for (size_t s = 0; s < STAGE_COUNT; ++s) {
+    if (!selected[s])
+      continue;
+    double start = Now();
+    stages[s].run(&in);
+    double warmup = Now() - start;
+    unsigned runs = (warmup < MIN_SAMPLE_TIME)
+                        ? (unsigned)(MIN_SAMPLE_TIME / (warmup + 1e-9)) + 1
+                        : 1;
+    for (unsigned r = 0; r < repeats; ++r) {
+      start = Now();
+      for (unsigned i = 0; i < runs; ++i)
+        stages[s].run(&in);
+      samples[r] = (Now() - start) / runs;
+    }
+
+    if (out) {
+      fprintf(out, "%s %u", stages[s].name, repeats);
+      for (unsigned r = 0; r < repeats; ++r)
+        fprintf(out, " %a", samples[r]);
+      fprintf(out, "\n");
+    }
+    memcpy(sorted, samples, sizeof(samples));
+    PrintStatistics(stages[s].name, sorted, repeats);
+
+    for (int b = 0; b < baseline_count; ++b) {
+      stage_samples *base = &baseline[b];
+      if (strcmp(base->name, stages[s].name) != 0)
+        continue;
+      double ratio = Median(sorted, repeats) /
+                     Median(base->samples, base->count);
+      double pvalue =
+          MannWhitneyP(samples, repeats, base->samples, base->count);
+      int regression = pvalue < alpha && ratio > 1. + threshold;
+      printf("%-20s %+11.1f%% p=%.4f%s\n", "  vs baseline", (ratio - 1.) * 100,
+             pvalue, regression ? "  REGRESSION" : "");
+      regressions += regression;
+    }
+  }
+
+  for (int b = 0; b < baseline_count; ++b)
+    free(baseline[b].samples);
+  FreeInputs(&in);
+  if (out && fclose(out) != 0) {
+    fprintf(stderr, "Failed to write baseline file.\n");
+    return 1;
+  }
+  if (regressions) {
+    printf("%d stages regressed.\n", regressions);
+    return 2;
+  }
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include "occ.h"
+
+#include <string.h>
+
+// Return the width of the low parts of count positions below sz, which
+//  makes the Elias-Fano buckets hold about one position each.
+static unsigned LowWidth(size_t sz, size_t count) {
+  unsigned width = 0;
+  while (count && (count << (width + 1)) <= sz)
+    ++width;
+  return width;
+}
+
+// Number of buckets of positions below sz with low parts of the given width.
+static size_t BucketCount(size_t sz, unsigned low_width) {
+  return (sz) ? ((sz - 1) >> low_width) + 1 : 1;
+}
+
+// Return the bytes used by a bitvector and an Elias-Fano coding of count
+//  positions below sz.
+static size_t BitvectorBytes(size_t sz) {
+  return (sz / FM_OCC_BLOCK_BITS + 1) * 8 * sizeof(uint64_t);
+}
+
+static size_t EliasFanoBytes(size_t sz, size_t count) {
+  unsigned low_width = LowWidth(sz, count);
+  size_t high_sz = count + BucketCount(sz, low_width);
+  size_t bytes = (high_sz / 64 + 1) * sizeof(uint64_t) +
+                 ((high_sz - count) / 64 + 1) * sizeof(uint64_t);
+  if (low_width)
+    bytes += PackedVectorWords(count, low_width) * sizeof(uint64_t);
+  return bytes;
+}
+
+static int InitSymbol(fm_occ_symbol *s, size_t sz) {
+  if (s->kind == FM_OCC_BITVECTOR)
+    return (s->blocks = calloc((sz / FM_OCC_BLOCK_BITS + 1) * 8,
+                               sizeof(uint64_t))) != NULL;
+
+  s->low_width = LowWidth(sz, s->count);
+  s->high_sz = s->count + BucketCount(sz, s->low_width);
+  size_t zero_count = s->high_sz - s->count;
+  if (s->low_width && !PackedVectorInit(&s->low, s->count, s->low_width))
+    return 0;
+  return (s->high = calloc(s->high_sz / 64 + 1, sizeof(uint64_t))) &&
+         (s->zero_samples = malloc((zero_count / 64 + 1) * sizeof(uint64_t)));
+}
+
+/* Build the occurrence structure of the given BWT over the alphabet.
+ * Return NULL on memory allocation error.
+ */
+fm_occ *FMOccCreate(char *bwt, size_t sz, char *alphabet) {
+  fm_occ *occ = calloc(1, sizeof(fm_occ));
+  if (!occ)
+    return NULL;
+  occ->size = sz;
+  occ->symbol_count = strlen(alphabet);
+  if (!(occ->symbols = calloc(occ->symbol_count, sizeof(fm_occ_symbol))))
+    goto error;
+
+  short map[256];
+  for (unsigned i = 0; i < 256; ++i)
+    map[i] = -1;
+  for (size_t i = 0; i < occ->symbol_count; ++i)
+    map[(unsigned char)alphabet[i]] = i;
+  for (size_t i = 0; i < sz; ++i)
+    ++occ->symbols[map[(unsigned char)bwt[i]]].count;
+
+  for (size_t c = 0; c < occ->symbol_count; ++c) {
+    fm_occ_symbol *s = &occ->symbols[c];
+    s->kind = (s->count < sz / FM_OCC_RARE_DIVISOR &&
+               EliasFanoBytes(sz, s->count) < BitvectorBytes(sz))
+                  ? FM_OCC_ELIAS_FANO
+                  : FM_OCC_BITVECTOR;
+    if (!InitSymbol(s, sz))
+      goto error;
+    // Reused as the number of positions added so far.
+    s->count = 0;
+  }
+
+  for (size_t i = 0; i < sz; ++i) {
+    fm_occ_symbol *s = &occ->symbols[map[(unsigned char)bwt[i]]];
+    if (s->kind == FM_OCC_BITVECTOR) {
+      size_t bit = i % FM_OCC_BLOCK_BITS;
+      s->blocks[i / FM_OCC_BLOCK_BITS * 8 + 1 + bit / 64] |= 1UL << (bit % 64);
+    } else {
+      if (s->low_width)
+        PackedSet(&s->low, s->count, i & ((1UL << s->low_width) - 1));
+      size_t high = (i >> s->low_width) + s->count;
+      s->high[high / 64] |= 1UL << (high % 64);
+    }
+    ++s->count;
+  }
+
+  for (size_t c = 0; c < occ->symbol_count; ++c) {
+    fm_occ_symbol *s = &occ->symbols[c];
+    if (s->kind == FM_OCC_BITVECTOR) {
+      // Accumulate the counts before each block.
+      unsigned long acc = 0;
+      for (size_t b = 0; b <= sz / FM_OCC_BLOCK_BITS; ++b) {
+        s->blocks[b * 8] = acc;
+        for (unsigned w = 1; w < 8; ++w)
+          acc += __builtin_popcountll(s->blocks[b * 8 + w]);
+      }
+    } else {
+      size_t zeros = 0;
+      for (size_t i = 0; i < s->high_sz; ++i)
+        if (!(s->high[i / 64] >> (i % 64) & 1) && zeros++ % 64 == 0)
+          s->zero_samples[(zeros - 1) / 64] = i;
+    }
+  }
+
+  return occ;
+
+error:
+  FMOccFree(occ);
+  return NULL;
+}
+
+void FMOccFree(fm_occ *occ) {
+  for (size_t c = 0; occ->symbols && c < occ->symbol_count; ++c) {
+    fm_occ_symbol *s = &occ->symbols[c];
+    free(s->blocks);
+    PackedVectorFree(&s->low);
+    free(s->high);
+    free(s->zero_samples);
+  }
+  free(occ->symbols);
+  free(occ);
+}
+
+// Return the bytes used by the occurrences of the given character.
+size_t FMOccSymbolBytes(fm_occ *occ, size_t symbol) {
+  fm_occ_symbol *s = &occ->symbols[symbol];
+  return (s->kind == FM_OCC_BITVECTOR) ? BitvectorBytes(occ->size)
+                                       : EliasFanoBytes(occ->size, s->count);
+}
+
+// Return the number of bytes used by the occurrence structure.
+size_t FMOccSize(fm_occ *occ) {
+  size_t sz = sizeof(fm_occ) + occ->symbol_count * sizeof(fm_occ_symbol);
+  for (size_t c = 0; c < occ->symbol_count; ++c)
+    sz += FMOccSymbolBytes(occ, c);
+  return sz;
+}
+
+// Return the position of the zero with the given index in the high bitvector.
+static size_t SelectZero(const fm_occ_symbol *s, size_t zero) {
+  size_t pos = s->zero_samples[zero / 64];
+  unsigned left = zero % 64;
+  if (!left)
+    return pos;
+
+  // Find the left-th zero after the sample, a word at a time.
+  ++pos;
+  size_t word = pos / 64;
+  uint64_t zeros = ~s->high[word] & (~0UL << (pos % 64));
+  unsigned count;
+  while ((count = __builtin_popcountll(zeros)) < left) {
+    left -= count;
+    zeros = ~s->high[++word];
+  }
+  while (--left)
+    zeros &= zeros - 1;
+  return word * 64 + __builtin_ctzll(zeros);
+}
+
+/* Return the number of positions below pos of a character stored with
+ *  Elias-Fano coding. The bucket of pos starts after zero number high - 1,
+ *  and its positions are compared by their low parts.
+ */
+unsigned FMOccEliasFanoRank(const fm_occ_symbol *s, size_t pos) {
+  size_t high = pos >> s->low_width;
+  size_t rank = 0, bit = 0;
+  if (high >= s->high_sz - s->count)
+    return s->count;
+  if (high) {
+    size_t zero = SelectZero(s, high - 1);
+    rank = zero - (high - 1);
+    bit = zero + 1;
+  }
+
+  uint64_t low = pos & ((1UL << s->low_width) - 1);
+  while (bit < s->high_sz && (s->high[bit / 64] >> (bit % 64) & 1) &&
+         s->low_width && PackedGet(&s->low, rank) < low) {
+    ++rank;
+    ++bit;
+  }
+  return rank;
+}
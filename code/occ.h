@@ -0,0 +1,81 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "packed.h"
+
+// Characters making up less than this fraction of the BWT are rare.
+#define FM_OCC_RARE_DIVISOR 64
+
+// Positions covered by one 64-byte block of a bitvector, which holds the
+//  number of occurrences before the block followed by 7 words of bits.
+#define FM_OCC_BLOCK_BITS 448
+
+typedef enum fm_occ_kind {
+  FM_OCC_BITVECTOR,
+  FM_OCC_ELIAS_FANO,
+} fm_occ_kind;
+
+/* Occurrences of one character in the BWT.
+ * Frequent characters have a bitvector of their positions, in blocks of one
+ *  cache line, so a rank takes a single block and at most 7 popcounts.
+ * Rare characters store their sorted positions with Elias-Fano coding: the
+ *  low low_width bits of each position are packed, and the high bits are
+ *  stored in unary in the high bitvector. Every 64th zero of the high
+ *  bitvector is sampled to quickly find the bucket of a position, which
+ *  holds few positions on average.
+ */
+typedef struct fm_occ_symbol {
+  fm_occ_kind kind;
+  size_t count;
+  uint64_t *blocks;
+  packed_vector low;
+  unsigned low_width;
+  uint64_t *high;
+  size_t high_sz;
+  uint64_t *zero_samples;
+} fm_occ_symbol;
+
+/* Occurrence structure replacing the rank matrix, with a representation per
+ *  character chosen by its frequency. Elias-Fano coding takes fewer bits for
+ *  rare characters, but its ranks touch more memory, so frequent characters
+ *  use bitvectors even where those would be slightly larger.
+ */
+typedef struct fm_occ {
+  size_t size;
+  size_t symbol_count;
+  fm_occ_symbol *symbols;
+} fm_occ;
+
+fm_occ *FMOccCreate(char *bwt, size_t sz, char *alphabet);
+void FMOccFree(fm_occ *occ);
+size_t FMOccSymbolBytes(fm_occ *occ, size_t symbol);
+size_t FMOccSize(fm_occ *occ);
+unsigned FMOccEliasFanoRank(const fm_occ_symbol *s, size_t pos);
+
+// Return the number of occurrences of the character with the given alphabet
+//  index in bwt[0, pos).
+static inline unsigned FMOccRank(const fm_occ *occ, int symbol, size_t pos) {
+  const fm_occ_symbol *s = &occ->symbols[symbol];
+  if (s->kind == FM_OCC_ELIAS_FANO)
+    return FMOccEliasFanoRank(s, pos);
+
+  const uint64_t *block = &s->blocks[pos / FM_OCC_BLOCK_BITS * 8];
+  size_t bit = pos % FM_OCC_BLOCK_BITS;
+  unsigned rank = block[0];
+  size_t word = 1;
+  for (; word <= bit / 64; ++word)
+    rank += __builtin_popcountll(block[word]);
+  if (bit % 64)
+    rank += __builtin_popcountll(block[word] & ((1UL << (bit % 64)) - 1));
+  return rank;
+}
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,95 @@
+#include "packed.h"
+
+#ifdef __x86_64__
+#include <immintrin.h>
+#endif
+
+// Return the number of words used for size entries of width bits, including
+//  the padding word.
+size_t PackedVectorWords(size_t size, unsigned width) {
+  return (size * width + 63) / 64 + 1;
+}
+
+// Return the number of bits needed to store values up to max_value.
+unsigned PackedWidth(uint64_t max_value) {
+  unsigned width = 1;
+  while (width < 64 && (max_value >> width))
+    ++width;
+  return width;
+}
+
+/* Allocate a zeroed vector of size entries of width bits.
+ * Return 0 on memory allocation error or if width is too large for
+ *  single-load access.
+ */
+int PackedVectorInit(packed_vector *v, size_t size, unsigned width) {
+  if (!width || width > 57)
+    return 0;
+
+  v->size = size;
+  v->width = width;
+  return (v->words = calloc(PackedVectorWords(size, width),
+                            sizeof(uint64_t))) != NULL;
+}
+
+void PackedVectorFree(packed_vector *v) {
+  free(v->words);
+  v->words = NULL;
+}
+
+void PackedSet(packed_vector *v, size_t i, uint64_t value) {
+  size_t bit = i * v->width;
+  size_t word = bit / 64, offset = bit % 64;
+  uint64_t mask = (1UL << v->width) - 1;
+
+  v->words[word] = (v->words[word] & ~(mask << offset)) | (value << offset);
+  if (offset + v->width > 64) {
+    unsigned spill = offset + v->width - 64;
+    uint64_t high_mask = (1UL << spill) - 1;
+    v->words[word + 1] =
+        (v->words[word + 1] & ~high_mask) | (value >> (v->width - spill));
+  }
+}
+
+#ifdef __x86_64__
+/* Decode four entries per iteration: gather the 64-bit words holding them,
+ *  shift each by its own bit offset and mask.
+ */
+__attribute__((target("avx2"))) static size_t
+PackedDecodeAVX2(const packed_vector *v, size_t start, size_t count,
+                 unsigned long *out) {
+  const long long *base = (const long long *)v->words;
+  __m256i mask = _mm256_set1_epi64x((1LL << v->width) - 1);
+  __m256i seven = _mm256_set1_epi64x(7);
+  __m256i step = _mm256_set1_epi64x(4 * (long long)v->width);
+  __m256i bits = _mm256_set_epi64x((start + 3) * v->width,
+                                   (start + 2) * v->width,
+                                   (start + 1) * v->width, start * v->width);
+
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    __m256i bytes = _mm256_srli_epi64(bits, 3);
+    __m256i words = _mm256_i64gather_epi64((const long long *)base, bytes, 1);
+    __m256i values = _mm256_and_si256(
+        _mm256_srlv_epi64(words, _mm256_and_si256(bits, seven)), mask);
+    _mm256_storeu_si256((__m256i *)&out[i], values);
+    bits = _mm256_add_epi64(bits, step);
+  }
+
+  return i;
+}
+#endif
+
+/* Decode the entries [start, start + count) into out.
+ * Uses AVX2 gathers when the processor supports them.
+ */
+void PackedDecode(const packed_vector *v, size_t start, size_t count,
+                  unsigned long *out) {
+  size_t i = 0;
+#ifdef __x86_64__
+  if (__builtin_cpu_supports("avx2"))
+    i = PackedDecodeAVX2(v, start, count, out);
+#endif
+  for (; i < count; ++i)
+    out[i] = PackedGet(v, start + i);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Vector of unsigned integers stored with a fixed number of bits each.
+ * The words array is padded with one extra word, so any entry can be read
+ *  with a single unaligned 64-bit load.
+ */
+typedef struct packed_vector {
+  uint64_t *words;
+  size_t size;
+  unsigned width;
+} packed_vector;
+
+int PackedVectorInit(packed_vector *v, size_t size, unsigned width);
+void PackedVectorFree(packed_vector *v);
+size_t PackedVectorWords(size_t size, unsigned width);
+unsigned PackedWidth(uint64_t max_value);
+void PackedSet(packed_vector *v, size_t i, uint64_t value);
+void PackedDecode(const packed_vector *v, size_t start, size_t count,
+                  unsigned long *out);
+
+// Return entry i. Widths up to 57 bits fit in one load after shifting out
+//  the bit offset within the first byte.
+static inline uint64_t PackedGet(const packed_vector *v, size_t i) {
+  size_t bit = i * v->width;
+  uint64_t word;
+  memcpy(&word, (const char *)v->words + (bit >> 3), sizeof(word));
+  return (word >> (bit & 7)) & ((1UL << v->width) - 1);
+}
+
+#ifdef __cplusplus
+}
+#endif
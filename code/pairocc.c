@@ -0,0 +1,137 @@
+#include "pairocc.h"
+
+#include <string.h>
+
+#ifdef __SSE2__
+const unsigned char fm_pair_occ_prefix_mask[2 * FM_PAIR_OCC_BLOCK_ROWS] = {
+    [0 ... FM_PAIR_OCC_BLOCK_ROWS - 1] = 0xff};
+#endif
+
+/* Allocate the pair occurrences of a BWT of sz rows over the alphabet,
+ *  with the pair symbols set and the counts, codes and starts left to fill.
+ *  The dollar sign only ends the text, so it is not part of any pair.
+ * Return NULL on memory allocation error or if the alphabet has more than
+ *  FM_PAIR_OCC_MAX_SYMBOLS other characters.
+ */
+fm_pair_occ *FMPairOccAlloc(char *alphabet, size_t sz) {
+  fm_pair_occ *occ = calloc(1, sizeof(fm_pair_occ));
+  if (!occ)
+    return NULL;
+  memset(occ->symbols, -1, sizeof(occ->symbols));
+  for (size_t i = 0; alphabet[i]; ++i) {
+    if (alphabet[i] == '$')
+      continue;
+    if (occ->symbol_count == FM_PAIR_OCC_MAX_SYMBOLS)
+      goto error;
+    occ->symbols[(unsigned char)alphabet[i]] = occ->symbol_count++;
+  }
+
+  // Counts are padded to whole cache lines, so the codes are aligned.
+  size_t pairs = occ->symbol_count * occ->symbol_count;
+  occ->size = sz;
+  occ->block_sz = (pairs * sizeof(uint32_t) + 63) / 64 * 64 +
+                  FM_PAIR_OCC_BLOCK_ROWS;
+  // A rank at row sz reads the block after the last row.
+  occ->block_count = sz / FM_PAIR_OCC_BLOCK_ROWS + 1;
+  if (!(occ->starts = calloc(pairs ? pairs : 1, sizeof(unsigned))) ||
+      !(occ->blocks = aligned_alloc(64, occ->block_count * occ->block_sz)))
+    goto error;
+  memset(occ->blocks, 0, occ->block_count * occ->block_sz);
+  return occ;
+
+error:
+  FMPairOccFree(occ);
+  return NULL;
+}
+
+/* Create the pair occurrences of a BWT of sz rows, with the range of each
+ *  character of the alphabet in ranges, like those of an fm_index.
+ * One pass over the rows counts the characters before each row, which
+ *  gives LF of the row and so the character before that one, and the
+ *  counts at the start of each character's range, which give the range of
+ *  each pair.
+ * Return NULL on memory allocation error or if the alphabet is too large.
+ */
+fm_pair_occ *FMPairOccCreate(char *bwt, size_t sz, char *alphabet,
+                             unsigned *ranges) {
+  fm_pair_occ *occ = FMPairOccAlloc(alphabet, sz);
+  if (!occ)
+    return NULL;
+
+  size_t sigma = strlen(alphabet);
+  size_t pairs = occ->symbol_count * occ->symbol_count;
+  short alphabet_map[256];
+  for (unsigned c = 0; c < 256; ++c)
+    alphabet_map[c] = -1;
+  for (size_t i = 0; i < sigma; ++i)
+    alphabet_map[(unsigned char)alphabet[i]] = i;
+
+  // Occurrences of each character before the current row, and before the
+  //  first row of each character.
+  unsigned *counts = calloc(sigma, sizeof(unsigned));
+  unsigned *counts_at_start = calloc(sigma * sigma, sizeof(unsigned));
+  uint32_t *pair_counts = calloc(pairs ? pairs : 1, sizeof(uint32_t));
+  if (!counts || !counts_at_start || !pair_counts) {
+    FMPairOccFree(occ);
+    occ = NULL;
+    goto cleanup;
+  }
+
+  for (size_t i = 0; i < sz; ++i) {
+    unsigned char *block = &occ->blocks[i / FM_PAIR_OCC_BLOCK_ROWS *
+                                        occ->block_sz];
+    if (i % FM_PAIR_OCC_BLOCK_ROWS == 0)
+      memcpy(block, pair_counts, pairs * sizeof(uint32_t));
+    for (size_t c = 0; c < sigma; ++c)
+      if (ranges[2 * c] == i)
+        memcpy(&counts_at_start[c * sigma], counts, sigma * sizeof(unsigned));
+
+    int c = alphabet_map[(unsigned char)bwt[i]];
+    size_t lf = ranges[2 * c] + counts[c]++;
+    // The row of the whole text has no character before it, and the row
+    //  after it only the last one.
+    unsigned code = (bwt[i] == '$' || bwt[lf] == '$')
+                        ? FM_PAIR_OCC_NONE
+                        : FMPairOccCode(occ, bwt[lf], bwt[i]);
+    block[occ->block_sz - FM_PAIR_OCC_BLOCK_ROWS +
+          i % FM_PAIR_OCC_BLOCK_ROWS] = code;
+    if (code != FM_PAIR_OCC_NONE)
+      ++pair_counts[code];
+  }
+  if (sz % FM_PAIR_OCC_BLOCK_ROWS == 0)
+    memcpy(&occ->blocks[(occ->block_count - 1) * occ->block_sz], pair_counts,
+           pairs * sizeof(uint32_t));
+  // Rows past the end never match a pair.
+  for (size_t i = sz; i % FM_PAIR_OCC_BLOCK_ROWS; ++i)
+    occ->blocks[i / FM_PAIR_OCC_BLOCK_ROWS * occ->block_sz + occ->block_sz -
+                FM_PAIR_OCC_BLOCK_ROWS + i % FM_PAIR_OCC_BLOCK_ROWS] =
+        FM_PAIR_OCC_NONE;
+
+  // The range of ab starts where backward search for a in the range of b
+  //  does, at the occurrences of a before the first row of b.
+  for (size_t a = 0; a < sigma; ++a) {
+    for (size_t b = 0; b < sigma; ++b) {
+      unsigned code = FMPairOccCode(occ, alphabet[a], alphabet[b]);
+      if (code != FM_PAIR_OCC_NONE)
+        occ->starts[code] = ranges[2 * a] + counts_at_start[b * sigma + a];
+    }
+  }
+
+cleanup:
+  free(counts);
+  free(counts_at_start);
+  free(pair_counts);
+  return occ;
+}
+
+void FMPairOccFree(fm_pair_occ *occ) {
+  free(occ->starts);
+  free(occ->blocks);
+  free(occ);
+}
+
+size_t FMPairOccSize(fm_pair_occ *occ) {
+  return sizeof(fm_pair_occ) +
+         occ->symbol_count * occ->symbol_count * sizeof(unsigned) +
+         occ->block_count * occ->block_sz;
+}
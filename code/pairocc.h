@@ -0,0 +1,127 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Rows covered by one block, which holds the number of occurrences of every
+//  pair before the block followed by the pair code of each row.
+#define FM_PAIR_OCC_BLOCK_ROWS 64
+
+// Characters a pair may consist of, so codes of all pairs fit in a byte.
+#define FM_PAIR_OCC_MAX_SYMBOLS 15
+
+// Code of rows that are not preceded by two characters of the text, and of
+//  pairs with characters outside the alphabet.
+#define FM_PAIR_OCC_NONE 255
+
+/* Occurrences of character pairs in the BWT, for backward search that takes
+ *  two characters per rank.
+ * Row i is coded by the two characters preceding its suffix in the text,
+ *  bwt[LF(i)] and bwt[i]. The rows of a range [start, end) whose code is
+ *  the pair ab are those whose suffix extended by ab occurs, so the range
+ *  of ab followed by the range's string starts at starts[ab] plus the rank
+ *  of ab before start, and ends at starts[ab] plus the rank before end.
+ *  The single-character path needs two dependent ranks for the same step.
+ * A rank reads the block of the row, whose counts and codes are adjacent,
+ *  and compares its codes against the pair.
+ */
+typedef struct fm_pair_occ {
+  size_t size;
+  unsigned symbol_count;
+  // Pair symbol of each character, or -1 if it is not in the alphabet. The
+  //  code of the pair ab is symbols[a] * symbol_count + symbols[b].
+  signed char symbols[256];
+  // Row where the range of each pair starts.
+  unsigned *starts;
+  size_t block_sz;
+  size_t block_count;
+  unsigned char *blocks;
+} fm_pair_occ;
+
+fm_pair_occ *FMPairOccCreate(char *bwt, size_t sz, char *alphabet,
+                             unsigned *ranges);
+fm_pair_occ *FMPairOccAlloc(char *alphabet, size_t sz);
+void FMPairOccFree(fm_pair_occ *occ);
+size_t FMPairOccSize(fm_pair_occ *occ);
+
+// Return the code of the pair of characters a followed by b, or
+//  FM_PAIR_OCC_NONE if either has no pair symbol.
+static inline unsigned FMPairOccCode(const fm_pair_occ *occ, char a, char b) {
+  int x = occ->symbols[(unsigned char)a], y = occ->symbols[(unsigned char)b];
+  return (x < 0 || y < 0) ? FM_PAIR_OCC_NONE : x * occ->symbol_count + y;
+}
+
+#ifdef __SSE2__
+// FM_PAIR_OCC_BLOCK_ROWS bytes of ones followed by as many zeros, so the
+//  bytes at offset FM_PAIR_OCC_BLOCK_ROWS - row select the rows before row.
+extern const unsigned char fm_pair_occ_prefix_mask[2 * FM_PAIR_OCC_BLOCK_ROWS];
+
+/* Return the number of rows in [0, pos) with the given pair code.
+ * The 64 codes of the block are compared 16 at a time, and each comparison
+ *  masked to the rows before pos is subtracted from per-byte counters,
+ *  whose bytes a sum of absolute differences adds up. A rank has no
+ *  branches that depend on the row, and needs no popcount instruction,
+ *  which builds for generic x86-64 only have as a library call.
+ */
+static inline unsigned FMPairOccRank(const fm_pair_occ *occ, unsigned code,
+                                     size_t pos) {
+  const unsigned char *block =
+      &occ->blocks[pos / FM_PAIR_OCC_BLOCK_ROWS * occ->block_sz];
+  const __m128i *codes =
+      (const __m128i *)&block[occ->block_sz - FM_PAIR_OCC_BLOCK_ROWS];
+  const __m128i *masks =
+      (const __m128i *)&fm_pair_occ_prefix_mask[FM_PAIR_OCC_BLOCK_ROWS -
+                                                pos % FM_PAIR_OCC_BLOCK_ROWS];
+  __m128i repeated = _mm_set1_epi8((char)code);
+  __m128i counts = _mm_setzero_si128();
+  for (unsigned i = 0; i < FM_PAIR_OCC_BLOCK_ROWS / 16; ++i)
+    counts = _mm_sub_epi8(
+        counts, _mm_and_si128(_mm_cmpeq_epi8(codes[i], repeated),
+                              _mm_loadu_si128(&masks[i])));
+  __m128i sums = _mm_sad_epu8(counts, _mm_setzero_si128());
+  return ((const uint32_t *)block)[code] + _mm_cvtsi128_si32(sums) +
+         _mm_extract_epi16(sums, 4);
+}
+#else
+// Return 1 in each byte of x that is zero, and 0 in the others.
+static inline uint64_t FMPairOccZeroBytes(uint64_t x) {
+  const uint64_t low7 = 0x7f7f7f7f7f7f7f7fUL;
+  // The high bit of a byte is set if any bit of it is.
+  uint64_t nonzero = ((x & low7) + low7) | x;
+  return (~nonzero & ~low7) >> 7;
+}
+
+// Return the number of rows in [0, pos) with the given pair code. Matches
+//  are summed per byte over the words before the row, which leaves at most
+//  8 in a byte, and a multiplication adds up the bytes.
+static inline unsigned FMPairOccRank(const fm_pair_occ *occ, unsigned code,
+                                     size_t pos) {
+  const unsigned char *block =
+      &occ->blocks[pos / FM_PAIR_OCC_BLOCK_ROWS * occ->block_sz];
+  const uint64_t *codes =
+      (const uint64_t *)&block[occ->block_sz - FM_PAIR_OCC_BLOCK_ROWS];
+  uint64_t repeated = code * 0x0101010101010101UL;
+  size_t row = pos % FM_PAIR_OCC_BLOCK_ROWS;
+  uint64_t matches = 0;
+  size_t word = 0;
+  for (; word < row / 8; ++word)
+    matches += FMPairOccZeroBytes(codes[word] ^ repeated);
+  if (row % 8)
+    matches += FMPairOccZeroBytes(codes[word] ^ repeated) &
+               ((1UL << (row % 8 * 8)) - 1);
+  return ((const uint32_t *)block)[code] +
+         (unsigned)((matches * 0x0101010101010101UL) >> 56);
+}
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,49 @@
+import argparse
+import matplotlib as mpl
+mpl.use('TkAgg')
+import matplotlib.pyplot as plt
+
+
+def main(filename, save):
+    plt.style.use('seaborn')
+
+    hits, inline, parallel = parse_result(filename)
+    plt.scatter(hits, inline, s=4, label="Inline, suffix order")
+    plt.scatter(hits, parallel, s=4, label="Thread pool, text order")
+    plt.xscale("log")
+    plt.yscale("log")
+    plt.xlabel("Number of matches")
+    plt.ylabel("Locate latency (s)")
+    plt.legend()
+    plt.title("Locate latency against number of matches")
+
+    if save:
+        figure = plt.gcf()
+        figure.set_size_inches(7, 5)
+        plt.savefig("locate_cpu.png", format="png", dpi=100)
+    else:
+        plt.show()
+
+
+def parse_result(filename):
+    hits, inline, parallel = [], [], []
+    with open(filename, "r") as f:
+        for line in f.read().splitlines():
+            [count, inline_time, parallel_time] = line.split(" ")
+            # Patterns without matches cannot be shown on a log scale.
+            if int(count) == 0:
+                continue
+            hits.append(int(count))
+            inline.append(float.fromhex(inline_time))
+            parallel.append(float.fromhex(parallel_time))
+
+    return hits, inline, parallel
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("file", help="result file of ./benchmark in locate mode")
+    parser.add_argument("-o", "--save", help="save as PNG", action="store_true", required=False)
+    args = parser.parse_args()
+
+    main(args.file, args.save)
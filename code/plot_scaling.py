@@ -0,0 +1,60 @@
+import argparse
+from collections import defaultdict
+import matplotlib as mpl
+mpl.use('TkAgg')
+import matplotlib.pyplot as plt
+
+
+def main(filename, save):
+    plt.style.use('seaborn')
+
+    sizes, throughput, index_bytes, construct_rss, benchmark_rss = parse_result(filename)
+    _, (left, right) = plt.subplots(1, 2)
+    left.plot(sizes, throughput, marker="o")
+    left.set_xscale("log")
+    left.set_xlabel("Corpus size (characters)")
+    left.set_ylabel("Throughput (patterns/s)")
+    left.set_title("Query throughput against corpus size")
+
+    right.plot(sizes, index_bytes, marker="o", label="Index file")
+    right.plot(sizes, construct_rss, marker="o", label="Peak memory of construction")
+    right.plot(sizes, benchmark_rss, marker="o", label="Peak memory of benchmark")
+    right.set_xscale("log")
+    right.set_xlabel("Corpus size (characters)")
+    right.set_ylabel("Bytes per character")
+    right.set_title("Memory against corpus size")
+    right.legend()
+
+    if save:
+        figure = plt.gcf()
+        figure.set_size_inches(12, 5)
+        plt.savefig("scaling_cpu.png", format="png", dpi=100)
+    else:
+        plt.show()
+
+
+def parse_result(filename):
+    # Average the repeats of every size.
+    runs = defaultdict(list)
+    with open(filename, "r") as f:
+        for line in f.read().splitlines():
+            [size, index_sz, _, construct_rss, benchmark_rss, count, time, _, _] = line.split(" ")
+            runs[int(size)].append((int(index_sz), int(construct_rss), int(benchmark_rss),
+                                    int(count) / float.fromhex(time)))
+
+    sizes = sorted(runs)
+    throughput = [sum(r[3] for r in runs[n]) / len(runs[n]) for n in sizes]
+    index_bytes = [runs[n][0][0] / n for n in sizes]
+    # Peak memory is reported in KiB.
+    construct_rss = [max(r[1] for r in runs[n]) * 1024 / n for n in sizes]
+    benchmark_rss = [max(r[2] for r in runs[n]) * 1024 / n for n in sizes]
+    return sizes, throughput, index_bytes, construct_rss, benchmark_rss
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("file", help="result file of benchmark_scaling.py")
+    parser.add_argument("-o", "--save", help="save as PNG", action="store_true", required=False)
+    args = parser.parse_args()
+
+    main(args.file, args.save)
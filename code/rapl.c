@@ -40,6 +40,8 @@
 #include <linux/perf_event.h>
 #include <sys/syscall.h>
 
+#include "rapl.h"
+
 #define MAX_CPUS 1024
 #define MAX_PACKAGES 16
 
@@ -185,3 +187,87 @@ int rapl_sysfs(void (*func)(void), double *result) {
 
   return 0;
 }
+
+static int read_counter(const char *filename, long long *value) {
+  FILE *fff = fopen(filename, "r");
+  if (fff == NULL)
+    return 0;
+  int ok = fscanf(fff, "%lld", value) == 1;
+  fclose(fff);
+  return ok;
+}
+
+static int add_counter(rapl_counters *counters, const char *dir, int dram) {
+  if (counters->count == RAPL_MAX_COUNTERS)
+    return 0;
+  int k = counters->count;
+  char tempfile[300];
+  snprintf(counters->filenames[k], sizeof(counters->filenames[k]),
+           "%s/energy_uj", dir);
+  snprintf(tempfile, sizeof(tempfile), "%s/max_energy_range_uj", dir);
+  if (!read_counter(tempfile, &counters->range[k]))
+    counters->range[k] = 0;
+  if (!read_counter(counters->filenames[k], &counters->last[k]))
+    return 0;
+  counters->dram[k] = dram;
+  counters->joules[k] = 0.;
+  counters->count++;
+  return 1;
+}
+
+/* Find the package and DRAM energy counters of the sysfs powercap interface,
+ *  for sampling energy while running with rapl_read. Core and uncore
+ *  domains are left out, since the package domain covers them.
+ * Return 0 on success, -1 if no counters are readable.
+ */
+int rapl_open(rapl_counters *counters) {
+  char basename[256], subname[300], tempfile[320], name[256];
+  counters->count = 0;
+
+  for (int j = 0; j < MAX_PACKAGES; j++) {
+    sprintf(basename, "/sys/class/powercap/intel-rapl/intel-rapl:%d", j);
+    if (!add_counter(counters, basename, 0))
+      break;
+
+    for (int i = 0; i < NUM_RAPL_DOMAINS - 1; i++) {
+      snprintf(subname, sizeof(subname), "%s/intel-rapl:%d:%d", basename, j,
+               i);
+      snprintf(tempfile, sizeof(tempfile), "%s/name", subname);
+      FILE *fff = fopen(tempfile, "r");
+      if (fff == NULL)
+        continue;
+      int ok = fscanf(fff, "%255s", name) == 1;
+      fclose(fff);
+      if (ok && strcmp(name, "dram") == 0)
+        add_counter(counters, subname, 1);
+    }
+  }
+
+  return (counters->count) ? 0 : -1;
+}
+
+/* Set package_joules and dram_joules to the energy used since rapl_open.
+ * Counters wrap around after max_energy_range_uj, so rapl_read must be
+ *  called at least once per wrap, which takes minutes even at full power.
+ * Return 0 on success, -1 on a read error.
+ */
+int rapl_read(rapl_counters *counters, double *package_joules,
+              double *dram_joules) {
+  *package_joules = *dram_joules = 0.;
+  for (int k = 0; k < counters->count; k++) {
+    long long value;
+    if (!read_counter(counters->filenames[k], &value))
+      return -1;
+    long long delta = value - counters->last[k];
+    if (delta < 0)
+      delta += counters->range[k];
+    counters->last[k] = value;
+    counters->joules[k] += delta / 1e6;
+
+    if (counters->dram[k])
+      *dram_joules += counters->joules[k];
+    else
+      *package_joules += counters->joules[k];
+  }
+  return 0;
+}
@@ -1,3 +1,19 @@
 #pragma once
 
+// Energy counters sampled by rapl_read, at most one per package and DRAM
+//  domain.
+#define RAPL_MAX_COUNTERS 32
+
+typedef struct rapl_counters {
+  int count;
+  char filenames[RAPL_MAX_COUNTERS][256];
+  int dram[RAPL_MAX_COUNTERS];
+  long long range[RAPL_MAX_COUNTERS];
+  long long last[RAPL_MAX_COUNTERS];
+  double joules[RAPL_MAX_COUNTERS];
+} rapl_counters;
+
 int rapl_sysfs(void (*func)(void), double *result);
+int rapl_open(rapl_counters *counters);
+int rapl_read(rapl_counters *counters, double *package_joules,
+              double *dram_joules);
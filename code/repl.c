@@ -1,46 +1,128 @@
 #include "fmindex.h"
+#include "hits.h"
+#include "trace.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+// Append encoded hits to the hit file.
+static int WriteHits(void *arg, const uint8_t *data, size_t sz) {
+  return fwrite(data, 1, sz, arg) == sz;
+}
+
+static void usage(char *name) {
+  printf("Usage: $ %s [-o HITFILE] [-t TRACEFILE] <FMINDEXFILE>\n", name);
+  printf("  -o  Write the positions of each query to HITFILE as a compressed "
+         "stream\n      (see hits.h) instead of printing them.\n");
+  printf("  -t  Write a Chrome trace of the session to TRACEFILE, with the "
+         "queries\n      numbered from 0 (needs a build with make "
+         "TRACE=1).\n");
+}
+
 int main(int argc, char *argv[]) {
-  if (argc < 2) {
-    printf("Usage: $ %s <FMINDEXFILE>\n", argv[0]);
+  char *hit_filename = NULL, *trace_filename = NULL;
+  int opt;
+  while ((opt = getopt(argc, argv, "o:t:")) != -1) {
+    switch (opt) {
+    case 'o':
+      hit_filename = optarg;
+      break;
+    case 't':
+      trace_filename = optarg;
+      break;
+    default:
+      usage(argv[0]);
+      return 1;
+    }
+  }
+  if (argc - optind < 1) {
+    usage(argv[0]);
+    return 1;
+  }
+  FM_TRACE_THREAD("main");
+  if (trace_filename && !FMTraceStart()) {
+    printf("Tracing needs a build with make TRACE=1.\n");
     return 1;
   }
 
-  fm_index *index = FMIndexReadFromFile(argv[1], 0);
+  fm_index *index = FMIndexReadFromFile(argv[optind], 0);
   if (!index) {
     printf("Could not read FM-index from file.\n");
     return 1;
   }
+  FILE *hit_file = NULL;
+  if (hit_filename && !(hit_file = fopen(hit_filename, "wb"))) {
+    printf("Could not open hit file.\n");
+    return 1;
+  }
 
   int input_len = 256;
   char input[input_len];
-  do {
+  for (long query = 0;; ++query) {
     printf("Type your query: ");
-    fgets(input, input_len, stdin);
-    if (!strlen(input))
+    FM_TRACE_PATTERN(FM_TRACE_NO_PATTERN);
+    FM_TRACE_BEGIN(input_span);
+    if (!fgets(input, input_len, stdin) || !strlen(input))
       break;
+    FM_TRACE_END(input_span, "read query", 0, 0);
+    FM_TRACE_PATTERN(query);
     input[strlen(input) - 1] = '\0';
 
     ranges_t start, end;
     FMIndexFindMatchRange(index, input, strlen(input), &start, &end);
     unsigned long match_count = end - start;
-    unsigned long *match_indices = calloc(match_count, sizeof(unsigned long));
-    FMIndexFindRangeIndices(index, start, end, &match_indices);
+    if (hit_file) {
+      long before = ftell(hit_file);
+      if (!FMIndexLocateEncoded(index, start, end, FM_HITS_CHUNK_SZ,
+                                &WriteHits, hit_file) ||
+          fflush(hit_file) != 0) {
+        printf("Could not write hits.\n");
+        break;
+      }
+      long bytes = ftell(hit_file) - before;
+      printf("Wrote %ld bytes (%.2f per match).\n", bytes,
+             match_count ? (double)bytes / match_count : 0.);
+    } else {
+      unsigned long *match_indices =
+          calloc(match_count, sizeof(unsigned long));
+      FMIndexFindRangeIndices(index, start, end, &match_indices);
 
-    printf("Indices: ");
-    for (unsigned long i = 0; i < match_count; ++i) {
-      printf("%lu ", match_indices[i]);
+      FM_TRACE_BEGIN(output_span);
+      printf("Indices: ");
+      for (unsigned long i = 0; i < match_count; ++i) {
+        printf("%lu ", match_indices[i]);
+      }
+      printf("\n");
+      FM_TRACE_END(output_span, "output", 0, match_count);
+      free(match_indices);
     }
-    printf("\n");
     printf("Found %lu matches.\n", match_count);
-    free(match_indices);
-  } while (1);
 
+    fm_document *documents;
+    size_t document_count;
+    if (index->doc_starts &&
+        FMIndexListDocuments(index, start, end, &documents, &document_count)) {
+      printf("Documents: ");
+      for (size_t i = 0; i < document_count; ++i)
+        printf("%lu (%u) ", documents[i].document, documents[i].count);
+      printf("\n");
+      printf("Found %lu documents.\n", document_count);
+      free(documents);
+    }
+  }
+
+  if (hit_file)
+    fclose(hit_file);
   FMIndexFree(index);
+  if (trace_filename) {
+    FMTraceStop();
+    if (!FMTraceWrite(trace_filename)) {
+      printf("Could not write trace.\n");
+      return 1;
+    }
+    FMTraceFree();
+  }
   return 0;
 }
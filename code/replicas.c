@@ -0,0 +1,273 @@
+#define _GNU_SOURCE
+
+#include "replicas.h"
+#include "packed.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LIBNUMA
+#include <numa.h>
+#endif
+
+static int NumaAvailable(void) {
+#ifdef HAVE_LIBNUMA
+  return numa_available() >= 0;
+#else
+  return 0;
+#endif
+}
+
+// Return the number of NUMA nodes of the machine, or 1 without libnuma.
+unsigned FMReplicasNodeCount(void) {
+#ifdef HAVE_LIBNUMA
+  if (NumaAvailable())
+    return numa_num_configured_nodes();
+#endif
+  return 1;
+}
+
+// Allocate memory on the given node, or interleaved over all nodes if node
+//  is -1. Simulated nodes use plain malloc.
+static void *NodeAlloc(size_t sz, int node, int simulated) {
+#ifdef HAVE_LIBNUMA
+  if (!simulated)
+    return (node < 0) ? numa_alloc_interleaved(sz)
+                      : numa_alloc_onnode(sz, node);
+#else
+  (void)node;
+  (void)simulated;
+#endif
+  return malloc(sz);
+}
+
+static void NodeFree(void *mem, size_t sz, int simulated) {
+#ifdef HAVE_LIBNUMA
+  if (!simulated) {
+    if (mem)
+      numa_free(mem, sz);
+    return;
+  }
+#else
+  (void)sz;
+  (void)simulated;
+#endif
+  free(mem);
+}
+
+static void *NodeCopy(void *src, size_t sz, int node, int simulated) {
+  void *dst = NodeAlloc(sz, node, simulated);
+  if (dst)
+    memcpy(dst, src, sz);
+  return dst;
+}
+
+static size_t RanksBytes(fm_index *fm) {
+  if (fm->ranks)
+    return fm->bwt_sz * fm->alphabet_sz * sizeof(ranks_t);
+  return PackedVectorWords(fm->packed_ranks.size, fm->packed_ranks.width) *
+         sizeof(uint64_t);
+}
+
+static size_t SABytes(fm_index *fm) {
+  if (fm->sa)
+    return fm->bwt_sz * sizeof(sa_t);
+  return PackedVectorWords(fm->packed_sa.size, fm->packed_sa.width) *
+         sizeof(uint64_t);
+}
+
+static size_t PairStartsBytes(fm_pair_occ *pairs) {
+  size_t count = pairs->symbol_count * pairs->symbol_count;
+  return (count ? count : 1) * sizeof(unsigned);
+}
+
+static size_t PairBlocksBytes(fm_pair_occ *pairs) {
+  return pairs->block_count * pairs->block_sz;
+}
+
+// Free the arrays of a replica that are not shared with the original index.
+static void FreeReplica(fm_replicas *r, fm_index *replica) {
+  fm_index *index = r->index;
+  if (replica->pair_occ && replica->pair_occ != index->pair_occ) {
+    NodeFree(replica->pair_occ->starts, PairStartsBytes(index->pair_occ),
+             r->simulated);
+    NodeFree(replica->pair_occ->blocks, PairBlocksBytes(index->pair_occ),
+             r->simulated);
+    NodeFree(replica->pair_occ, sizeof(fm_pair_occ), r->simulated);
+  }
+  if (replica->ranks != index->ranks ||
+      replica->packed_ranks.words != index->packed_ranks.words)
+    NodeFree(replica->ranks ? (void *)replica->ranks
+                            : (void *)replica->packed_ranks.words,
+             RanksBytes(index), r->simulated);
+  if (replica->sa != index->sa ||
+      replica->packed_sa.words != index->packed_sa.words)
+    NodeFree(replica->sa ? (void *)replica->sa
+                         : (void *)replica->packed_sa.words,
+             SABytes(index), r->simulated);
+  if (replica->ranges != index->ranges)
+    NodeFree(replica->ranges, 2 * index->alphabet_sz * sizeof(ranges_t),
+             r->simulated);
+  if (replica->alphabet != index->alphabet)
+    NodeFree(replica->alphabet, index->alphabet_sz + 1, r->simulated);
+  free(replica);
+}
+
+/* Create a replica on the given node holding copies of the rank matrix,
+ *  pair occurrences, character ranges and alphabet. For node -1 the rank
+ *  matrix, pair occurrences and suffix array are copied into interleaved
+ *  memory instead.
+ * Return NULL on memory allocation error.
+ */
+static fm_index *CreateReplica(fm_replicas *r, int node) {
+  fm_index *index = r->index;
+  fm_index *replica = malloc(sizeof(fm_index));
+  if (!replica)
+    return NULL;
+  *replica = *index;
+
+  // Hybrid occurrence structures are shared.
+  void *copy;
+  if (!index->occ) {
+    void *ranks = index->ranks ? (void *)index->ranks
+                               : (void *)index->packed_ranks.words;
+    copy = NodeCopy(ranks, RanksBytes(index), node, r->simulated);
+    if (index->ranks)
+      replica->ranks = copy;
+    else
+      replica->packed_ranks.words = copy;
+    if (!copy)
+      goto error;
+  }
+
+  // Pair steps rank on the pair occurrences instead of the rank matrix.
+  if (index->pair_occ) {
+    fm_pair_occ *pairs = index->pair_occ;
+    if (!(replica->pair_occ =
+              NodeCopy(pairs, sizeof(fm_pair_occ), node, r->simulated)))
+      goto error;
+    replica->pair_occ->starts = NodeCopy(
+        pairs->starts, PairStartsBytes(pairs), node, r->simulated);
+    replica->pair_occ->blocks = NodeCopy(
+        pairs->blocks, PairBlocksBytes(pairs), node, r->simulated);
+    if (!replica->pair_occ->starts || !replica->pair_occ->blocks)
+      goto error;
+  }
+
+  if (node < 0) {
+    void *sa = index->sa ? (void *)index->sa : (void *)index->packed_sa.words;
+    copy = NodeCopy(sa, SABytes(index), node, r->simulated);
+    if (index->sa)
+      replica->sa = copy;
+    else
+      replica->packed_sa.words = copy;
+    if (!copy)
+      goto error;
+    return replica;
+  }
+
+  if (!(replica->ranges = NodeCopy(index->ranges,
+                                   2 * index->alphabet_sz * sizeof(ranges_t),
+                                   node, r->simulated)) ||
+      !(replica->alphabet = NodeCopy(index->alphabet, index->alphabet_sz + 1,
+                                     node, r->simulated)))
+    goto error;
+
+  return replica;
+
+error:
+  // Arrays that failed to copy are NULL, which NodeFree ignores.
+  FreeReplica(r, replica);
+  return NULL;
+}
+
+/* Create replicas of the index for node_count nodes. If a node has too
+ *  little memory for its replica, the index is interleaved instead.
+ * The index must outlive the replicas.
+ * Return NULL on memory allocation error.
+ */
+fm_replicas *FMReplicasCreate(fm_index *index, unsigned node_count,
+                              int interleave) {
+  fm_replicas *r = calloc(1, sizeof(fm_replicas));
+  if (!r)
+    return NULL;
+  if (!node_count)
+    node_count = 1;
+
+  r->index = index;
+  r->node_count = node_count;
+  r->simulated = !NumaAvailable() || node_count > FMReplicasNodeCount();
+  if (!(r->replicas = calloc(node_count, sizeof(fm_index *))))
+    goto error;
+
+  for (unsigned node = 0; node < node_count && !interleave; ++node) {
+    if (!(r->replicas[node] = CreateReplica(r, node))) {
+      for (unsigned i = 0; i < node; ++i)
+        FreeReplica(r, r->replicas[i]);
+      interleave = 1;
+    }
+  }
+
+  if (interleave) {
+    // Simulated nodes all share one memory, so there is nothing to spread.
+    fm_index *shared = r->simulated ? index : CreateReplica(r, -1);
+    if (!shared)
+      goto error;
+    for (unsigned node = 0; node < node_count; ++node)
+      r->replicas[node] = shared;
+  }
+  r->interleave = interleave;
+
+  return r;
+
+error:
+  free(r->replicas);
+  free(r);
+  return NULL;
+}
+
+void FMReplicasFree(fm_replicas *r) {
+  if (r->interleave) {
+    if (r->replicas[0] != r->index)
+      FreeReplica(r, r->replicas[0]);
+  } else {
+    for (unsigned node = 0; node < r->node_count; ++node)
+      FreeReplica(r, r->replicas[node]);
+  }
+  free(r->replicas);
+  free(r);
+}
+
+// Return the node of a thread when spreading thread_count threads evenly.
+unsigned FMReplicasNodeOf(fm_replicas *r, unsigned thread,
+                          unsigned thread_count) {
+  return (unsigned long)thread * r->node_count / thread_count;
+}
+
+/* Pin the calling thread to the CPUs of a node. Simulated node i gets the
+ *  i-th of node_count equal groups of CPUs.
+ * Return 0 if the affinity could not be set, 1 otherwise.
+ */
+int FMReplicasPinThread(fm_replicas *r, unsigned node) {
+#ifdef HAVE_LIBNUMA
+  if (!r->simulated)
+    return numa_run_on_node(node) == 0;
+#endif
+
+  long cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+  if (cpu_count < 1)
+    return 0;
+  long first = node * cpu_count / r->node_count;
+  long last = (node + 1) * cpu_count / r->node_count;
+  if (last == first)
+    last = first + 1; // More nodes than CPUs.
+
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (long cpu = first; cpu < last; ++cpu)
+    CPU_SET(cpu % cpu_count, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
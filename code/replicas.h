@@ -0,0 +1,37 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+
+/* Copies of an index for the nodes of a NUMA machine.
+ * Every replica is a shallow copy of the index whose rank matrix, pair
+ *  occurrences and small tables live on its own node, and which shares the
+ *  other arrays with the original index. With interleave set, there is a
+ *  single replica shared by all nodes instead, whose rank matrix, pair
+ *  occurrences and suffix array are interleaved over all nodes, which takes
+ *  less memory.
+ * Without libnuma, or when asking for more nodes than the machine has, the
+ *  nodes are simulated by splitting the CPUs into node_count equal groups.
+ */
+typedef struct fm_replicas {
+  fm_index *index;
+  fm_index **replicas;
+  unsigned node_count;
+  int interleave;
+  int simulated;
+} fm_replicas;
+
+fm_replicas *FMReplicasCreate(fm_index *index, unsigned node_count,
+                              int interleave);
+void FMReplicasFree(fm_replicas *r);
+unsigned FMReplicasNodeCount(void);
+unsigned FMReplicasNodeOf(fm_replicas *r, unsigned thread,
+                          unsigned thread_count);
+int FMReplicasPinThread(fm_replicas *r, unsigned node);
+
+#ifdef __cplusplus
+}
+#endif
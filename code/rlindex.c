@@ -0,0 +1,368 @@
+#include "rlindex.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Run-length compressed FM-index.
+ * Ranks are answered from the runs of the BWT: a binary search finds the run
+ *  holding a position, and a second one the number of runs of the queried
+ *  character before it. Locating follows the r-index: backward search keeps
+ *  track of the suffix array value at the last position of the range (the
+ *  toehold), using the samples at the run ends when the range shrinks. The
+ *  other values then follow from phi(SA[i]) = SA[i - 1], which only needs
+ *  samples at the run starts.
+ */
+
+// Return the run that holds the given BWT position.
+static size_t RunOf(rl_index *rl, ranges_t pos) {
+  size_t lo = 0, hi = rl->run_count;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (rl->run_starts[mid] <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Return the number of runs of the character with the given alphabet index
+//  up to and including the given run.
+static size_t CharRunsUpTo(rl_index *rl, int alphabet_idx, size_t run) {
+  size_t lo = rl->char_run_offsets[alphabet_idx];
+  size_t hi = rl->char_run_offsets[alphabet_idx + 1];
+  size_t first = lo;
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (rl->char_runs[mid] <= run)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo - first;
+}
+
+// Number of occurrences of the character with the given alphabet index in
+//  bwt[0, pos).
+static ranges_t Rank(rl_index *rl, int alphabet_idx, ranges_t pos) {
+  if (!pos)
+    return 0;
+
+  size_t run = RunOf(rl, pos - 1);
+  size_t j = CharRunsUpTo(rl, alphabet_idx, run);
+  if (!j)
+    return 0;
+
+  size_t idx = rl->char_run_offsets[alphabet_idx] + j - 1;
+  size_t c_run = rl->char_runs[idx];
+  if (c_run == run)
+    return rl->char_run_ranks[idx] + pos - rl->run_starts[run];
+  return rl->char_run_ranks[idx] + rl->run_starts[c_run + 1] -
+         rl->run_starts[c_run];
+}
+
+// Return SA[i - 1] given SA[i], for i > 0.
+static sa_t Phi(rl_index *rl, sa_t pos) {
+  size_t lo = 0, hi = rl->run_count - 1;
+  while (hi - lo > 1) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (rl->phi_keys[mid] <= pos)
+      lo = mid;
+    else
+      hi = mid;
+  }
+  return rl->phi_values[lo] + (pos - rl->phi_keys[lo]);
+}
+
+static int ComparePhiPair(const void *a, const void *b) {
+  sa_t i = *(sa_t *)a;
+  sa_t j = *(sa_t *)b;
+  return (i > j) - (i < j);
+}
+
+/* Build a run-length index from the BWT of bwt_sz characters (including the
+ *  dollar sign), its alphabet and the suffix array. The arrays are not
+ *  modified and can be freed afterwards.
+ * Return NULL on memory allocation error.
+ */
+rl_index *RLIndexFromArrays(char *bwt, size_t bwt_sz, char *alphabet,
+                            sa_t *sa) {
+  rl_index *index = calloc(1, sizeof(rl_index));
+  if (!index)
+    return NULL;
+
+  index->bwt_sz = bwt_sz;
+  index->alphabet_sz = strlen(alphabet);
+  if (!(index->alphabet = strdup(alphabet)))
+    goto error;
+  for (unsigned i = 0; i < 256; ++i)
+    index->alphabet_map[i] = -1;
+  for (size_t i = 0; i < index->alphabet_sz; ++i)
+    index->alphabet_map[(unsigned char)alphabet[i]] = i;
+  if (!(index->ranges = ConstructCharacterRanges(bwt, bwt_sz, alphabet)))
+    goto error;
+
+  size_t r = 0;
+  for (size_t i = 0; i < bwt_sz; ++i)
+    if (i == 0 || bwt[i] != bwt[i - 1])
+      ++r;
+  index->run_count = r;
+
+  index->run_starts = malloc((r + 1) * sizeof(ranges_t));
+  index->run_chars = malloc(r * sizeof(unsigned char));
+  index->char_run_offsets = calloc(index->alphabet_sz + 1, sizeof(ranges_t));
+  index->char_runs = malloc(r * sizeof(ranges_t));
+  index->char_run_ranks = malloc(r * sizeof(ranges_t));
+  index->run_end_samples = malloc(r * sizeof(sa_t));
+  index->phi_keys = malloc(r * sizeof(sa_t));
+  index->phi_values = malloc(r * sizeof(sa_t));
+  sa_t *phi_pairs = malloc(2 * r * sizeof(sa_t));
+  ranges_t *counts = calloc(index->alphabet_sz, sizeof(ranges_t));
+  ranges_t *fill = malloc(index->alphabet_sz * sizeof(ranges_t));
+  if (!index->run_starts || !index->run_chars || !index->char_run_offsets ||
+      !index->char_runs || !index->char_run_ranks || !index->run_end_samples ||
+      !index->phi_keys || !index->phi_values || !phi_pairs || !counts ||
+      !fill) {
+    free(phi_pairs);
+    free(counts);
+    free(fill);
+    goto error;
+  }
+
+  size_t run = 0;
+  for (size_t i = 0; i < bwt_sz; ++i)
+    if (i == 0 || bwt[i] != bwt[i - 1]) {
+      index->run_starts[run] = i;
+      index->run_chars[run] = index->alphabet_map[(unsigned char)bwt[i]];
+      ++index->char_run_offsets[index->run_chars[run] + 1];
+      ++run;
+    }
+  index->run_starts[r] = bwt_sz;
+
+  // Group the runs by character, in BWT order within each character.
+  for (size_t c = 0; c < index->alphabet_sz; ++c)
+    index->char_run_offsets[c + 1] += index->char_run_offsets[c];
+  memcpy(fill, index->char_run_offsets, index->alphabet_sz * sizeof(ranges_t));
+  for (size_t k = 0; k < r; ++k) {
+    unsigned char c = index->run_chars[k];
+    index->char_runs[fill[c]] = k;
+    index->char_run_ranks[fill[c]] = counts[c];
+    ++fill[c];
+    counts[c] += index->run_starts[k + 1] - index->run_starts[k];
+  }
+
+  // The first run has no position before it to pair with.
+  for (size_t k = 0; k < r; ++k) {
+    index->run_end_samples[k] = sa[index->run_starts[k + 1] - 1];
+    if (k) {
+      phi_pairs[2 * (k - 1)] = sa[index->run_starts[k]];
+      phi_pairs[2 * (k - 1) + 1] = sa[index->run_starts[k] - 1];
+    }
+  }
+  qsort(phi_pairs, r - 1, 2 * sizeof(sa_t), &ComparePhiPair);
+  for (size_t k = 0; k + 1 < r; ++k) {
+    index->phi_keys[k] = phi_pairs[2 * k];
+    index->phi_values[k] = phi_pairs[2 * k + 1];
+  }
+  index->sa_last = sa[bwt_sz - 1];
+
+  free(phi_pairs);
+  free(counts);
+  free(fill);
+  return index;
+
+error:
+  RLIndexFree(index);
+  return NULL;
+}
+
+/* Construct a run-length index of the given string.
+ * The suffix array and BWT are built as for FMIndexConstruct, but the rank
+ *  matrix is not.
+ * Return NULL on memory allocation error.
+ */
+rl_index *RLIndexConstruct(char *s) {
+  size_t sz = strlen(s);
+  rl_index *index = NULL;
+  char *alphabet = TextToAlphabet(s, sz);
+  sa_t *sa = (alphabet) ? ConstructSuffixArray(s, sz) : NULL;
+  char *bwt = (sa) ? ConstructBWT(s, sz, sa) : NULL;
+
+  if (bwt)
+    index = RLIndexFromArrays(bwt, sz + 1, alphabet, sa);
+
+  free(alphabet);
+  free(sa);
+  free(bwt);
+  return index;
+}
+
+void RLIndexFree(rl_index *index) {
+  free(index->alphabet);
+  free(index->ranges);
+  free(index->run_starts);
+  free(index->run_chars);
+  free(index->char_run_offsets);
+  free(index->char_runs);
+  free(index->char_run_ranks);
+  free(index->run_end_samples);
+  free(index->phi_keys);
+  free(index->phi_values);
+  free(index);
+}
+
+// Return the number of bytes used by the index.
+size_t RLIndexSize(rl_index *index) {
+  size_t r = index->run_count;
+  return sizeof(rl_index) + index->alphabet_sz +
+         2 * index->alphabet_sz * sizeof(ranges_t) +
+         (r + 1) * sizeof(ranges_t) + r * sizeof(unsigned char) +
+         (index->alphabet_sz + 1) * sizeof(ranges_t) +
+         2 * r * sizeof(ranges_t) + 3 * r * sizeof(sa_t);
+}
+
+int RLIndexDumpToFile(rl_index *index, char *filename) {
+  char *tmp_filename;
+  FILE *f = OpenReplacement(filename, &tmp_filename);
+  if (!f)
+    return 0;
+
+  size_t r = index->run_count;
+  fwrite(&index->bwt_sz, sizeof(index->bwt_sz), 1, f);
+  fwrite(&index->run_count, sizeof(index->run_count), 1, f);
+  fwrite(&index->alphabet_sz, sizeof(index->alphabet_sz), 1, f);
+  fwrite(index->alphabet, sizeof(char), index->alphabet_sz, f);
+  fwrite(index->ranges, sizeof(ranges_t), 2 * index->alphabet_sz, f);
+  fwrite(index->run_starts, sizeof(ranges_t), r + 1, f);
+  fwrite(index->run_chars, sizeof(unsigned char), r, f);
+  fwrite(index->char_run_offsets, sizeof(ranges_t), index->alphabet_sz + 1, f);
+  fwrite(index->char_runs, sizeof(ranges_t), r, f);
+  fwrite(index->char_run_ranks, sizeof(ranges_t), r, f);
+  fwrite(index->run_end_samples, sizeof(sa_t), r, f);
+  fwrite(index->phi_keys, sizeof(sa_t), r - 1, f);
+  fwrite(index->phi_values, sizeof(sa_t), r - 1, f);
+  fwrite(&index->sa_last, sizeof(sa_t), 1, f);
+
+  return CommitReplacement(f, tmp_filename, filename);
+}
+
+rl_index *RLIndexReadFromFile(char *filename) {
+  FILE *f = fopen(filename, "r");
+  if (!f)
+    return NULL;
+
+  rl_index *index = calloc(1, sizeof(rl_index));
+  if (!index)
+    goto error;
+
+  fread(&index->bwt_sz, sizeof(index->bwt_sz), 1, f);
+  fread(&index->run_count, sizeof(index->run_count), 1, f);
+  fread(&index->alphabet_sz, sizeof(index->alphabet_sz), 1, f);
+  size_t r = index->run_count, sigma = index->alphabet_sz;
+  if (!r || sigma > 256)
+    goto error;
+
+  if (!(index->alphabet = calloc(sigma + 1, sizeof(char))))
+    goto error;
+  fread(index->alphabet, sizeof(char), sigma, f);
+  for (unsigned i = 0; i < 256; ++i)
+    index->alphabet_map[i] = -1;
+  for (size_t i = 0; i < sigma; ++i)
+    index->alphabet_map[(unsigned char)index->alphabet[i]] = i;
+
+  index->ranges = malloc(2 * sigma * sizeof(ranges_t));
+  index->run_starts = malloc((r + 1) * sizeof(ranges_t));
+  index->run_chars = malloc(r * sizeof(unsigned char));
+  index->char_run_offsets = malloc((sigma + 1) * sizeof(ranges_t));
+  index->char_runs = malloc(r * sizeof(ranges_t));
+  index->char_run_ranks = malloc(r * sizeof(ranges_t));
+  index->run_end_samples = malloc(r * sizeof(sa_t));
+  index->phi_keys = malloc(r * sizeof(sa_t));
+  index->phi_values = malloc(r * sizeof(sa_t));
+  if (!index->ranges || !index->run_starts || !index->run_chars ||
+      !index->char_run_offsets || !index->char_runs || !index->char_run_ranks ||
+      !index->run_end_samples || !index->phi_keys || !index->phi_values)
+    goto error;
+
+  fread(index->ranges, sizeof(ranges_t), 2 * sigma, f);
+  fread(index->run_starts, sizeof(ranges_t), r + 1, f);
+  fread(index->run_chars, sizeof(unsigned char), r, f);
+  fread(index->char_run_offsets, sizeof(ranges_t), sigma + 1, f);
+  fread(index->char_runs, sizeof(ranges_t), r, f);
+  fread(index->char_run_ranks, sizeof(ranges_t), r, f);
+  fread(index->run_end_samples, sizeof(sa_t), r, f);
+  fread(index->phi_keys, sizeof(sa_t), r - 1, f);
+  fread(index->phi_values, sizeof(sa_t), r - 1, f);
+  if (fread(&index->sa_last, sizeof(sa_t), 1, f) != 1)
+    goto error;
+
+  fclose(f);
+  return index;
+
+error:
+  if (index)
+    RLIndexFree(index);
+  fclose(f);
+  return NULL;
+}
+
+/* Find the range of matches for the given pattern in the F column, as
+ *  FMIndexFindMatchRange does. toehold is set to the suffix array value at
+ *  the last position of the range, which is needed to locate the matches.
+ * Patterns that do not occur get an empty range.
+ */
+void RLIndexFindMatchRange(rl_index *rl, char *pattern, size_t pattern_sz,
+                           ranges_t *start, ranges_t *end, sa_t *toehold) {
+  *start = 0;
+  *end = rl->bwt_sz;
+  *toehold = rl->sa_last;
+
+  for (size_t i = pattern_sz; i > 0; --i) {
+    int alphabet_idx = rl->alphabet_map[(unsigned char)pattern[i - 1]];
+    if (alphabet_idx <= 0) {
+      *start = *end = 0;
+      return;
+    }
+
+    ranges_t range_start = rl->ranges[2 * alphabet_idx];
+    ranges_t new_start = range_start + Rank(rl, alphabet_idx, *start);
+    ranges_t new_end = range_start + Rank(rl, alphabet_idx, *end);
+    if (new_start >= new_end) {
+      *start = *end = 0;
+      return;
+    }
+
+    // If the last position does not hold the character, the new last
+    //  position comes from the end of the last run of it before.
+    size_t run = RunOf(rl, *end - 1);
+    if (rl->run_chars[run] == alphabet_idx) {
+      *toehold -= 1;
+    } else {
+      size_t j = CharRunsUpTo(rl, alphabet_idx, run);
+      size_t c_run = rl->char_runs[rl->char_run_offsets[alphabet_idx] + j - 1];
+      *toehold = rl->run_end_samples[c_run] - 1;
+    }
+
+    *start = new_start;
+    *end = new_end;
+  }
+}
+
+/* Find the matching indices in the original text for the given range and
+ *  toehold from RLIndexFindMatchRange, in the same order as
+ *  FMIndexFindRangeIndices.
+ */
+void RLIndexFindRangeIndices(rl_index *rl, ranges_t start, ranges_t end,
+                             sa_t toehold, unsigned long **match_indices) {
+  if (start >= end)
+    return;
+
+  sa_t pos = toehold;
+  (*match_indices)[end - 1 - start] = pos;
+  for (ranges_t i = end - 1; i > start; --i) {
+    pos = Phi(rl, pos);
+    (*match_indices)[i - 1 - start] = pos;
+  }
+}
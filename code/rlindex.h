@@ -0,0 +1,57 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+
+/* Run-length compressed FM-index, in the style of the r-index.
+ * All arrays hold one entry per run of equal characters in the BWT, so the
+ *  index takes space proportional to the number of runs instead of the text
+ *  length.
+ */
+typedef struct rl_index {
+  size_t bwt_sz;
+  size_t run_count;
+  char *alphabet;
+  size_t alphabet_sz;
+  short alphabet_map[256];
+  ranges_t *ranges;
+  // First BWT position of each run, followed by bwt_sz.
+  ranges_t *run_starts;
+  // Alphabet index of the character of each run.
+  unsigned char *run_chars;
+  // Runs grouped by character: the runs of character c are
+  //  char_runs[char_run_offsets[c], char_run_offsets[c + 1]), and
+  //  char_run_ranks holds the number of c's in the BWT before each of them.
+  ranges_t *char_run_offsets;
+  ranges_t *char_runs;
+  ranges_t *char_run_ranks;
+  // Suffix array value at the last position of each run.
+  sa_t *run_end_samples;
+  // Suffix array values at the first position of each run after the first,
+  //  sorted, together with the suffix array value at the position before.
+  sa_t *phi_keys;
+  sa_t *phi_values;
+  // Suffix array value at the last position of the BWT.
+  sa_t sa_last;
+} rl_index;
+
+rl_index *RLIndexConstruct(char *s);
+rl_index *RLIndexFromArrays(char *bwt, size_t bwt_sz, char *alphabet,
+                            sa_t *sa);
+void RLIndexFree(rl_index *index);
+
+rl_index *RLIndexReadFromFile(char *filename);
+int RLIndexDumpToFile(rl_index *index, char *filename);
+size_t RLIndexSize(rl_index *index);
+
+void RLIndexFindMatchRange(rl_index *rl, char *pattern, size_t pattern_sz,
+                           ranges_t *start, ranges_t *end, sa_t *toehold);
+void RLIndexFindRangeIndices(rl_index *rl, ranges_t start, ranges_t end,
+                             sa_t toehold, unsigned long **match_indices);
+
+#ifdef __cplusplus
+}
+#endif
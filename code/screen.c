@@ -0,0 +1,61 @@
+#include "fmindex.h"
+#include "matchstats.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char *argv[]) {
+  if (argc < 4) {
+    printf("Usage: $ %s <FMINDEXFILE> <DOCUMENT> <MINLENGTH> [MAXOCC]\n",
+           argv[0]);
+    return 1;
+  }
+
+  fm_index *index = FMIndexReadFromFile(argv[1], 0);
+  if (!index) {
+    printf("Could not read FM-index from file.\n");
+    return 1;
+  }
+  if (!index->lcp) {
+    printf("FM-index has no LCP array, construct it with -l.\n");
+    return 1;
+  }
+
+  char *document = ReadFile(argv[2]);
+  if (!document)
+    return 1;
+  size_t document_sz = strlen(document);
+  size_t min_length = atoi(argv[3]);
+  ranges_t max_occ = (argc > 4) ? (ranges_t)atoi(argv[4]) : (ranges_t)-1;
+
+  fm_mem *mems;
+  size_t mem_count;
+  if (!FMIndexFindSMEMs(index, document, document_sz, min_length, 1, max_occ,
+                        &mems, &mem_count)) {
+    printf("Failed to allocate memory for matches.\n");
+    return 1;
+  }
+
+  // Report the matches from left to right, along with the fraction of the
+  //  document that they cover.
+  size_t covered = 0, covered_end = 0;
+  for (size_t i = mem_count; i > 0; --i) {
+    fm_mem *mem = &mems[i - 1];
+    printf("%lu %lu %u\n", mem->query_pos, mem->length, mem->end - mem->start);
+
+    size_t mem_end = mem->query_pos + mem->length;
+    if (mem_end > covered_end) {
+      covered += mem_end - ((mem->query_pos > covered_end) ? mem->query_pos
+                                                            : covered_end);
+      covered_end = mem_end;
+    }
+  }
+  printf("Found %lu matches covering %.2f%% of the document.\n", mem_count,
+         (document_sz) ? 100. * covered / document_sz : 0.);
+
+  free(mems);
+  free(document);
+  FMIndexFree(index);
+  return 0;
+}
@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+typedef struct trace_span {
+  const char *name;
+  uint64_t start_ns;
+  uint64_t end_ns;
+  long pattern;
+  unsigned long lf_steps;
+  unsigned long hits;
+} trace_span;
+
+// Spans a buffer starts with.
+#define INITIAL_SPANS 256
+
+/* Spans of one thread. Only the owning thread writes to it, and buffers
+ *  stay registered after their thread exits, so FMTraceWrite sees the spans
+ *  of finished pool threads too. The spans array doubles as needed until it
+ *  holds FM_TRACE_RING_SZ spans, and then wraps around.
+ */
+typedef struct trace_buffer {
+  struct trace_buffer *next;
+  unsigned id;
+  const char *thread_name;
+  unsigned long generation;
+  unsigned long recorded;
+  size_t capacity;
+  trace_span *spans;
+} trace_buffer;
+
+int fm_trace_enabled;
+
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_buffer *buffers;
+static unsigned buffer_count;
+// Buffers recorded before the current trace started are emptied on first use.
+static unsigned long trace_generation;
+static uint64_t trace_start_ns;
+
+static __thread trace_buffer *local_buffer;
+static __thread const char *local_thread_name;
+static __thread long local_pattern = FM_TRACE_NO_PATTERN;
+
+uint64_t FMTraceNow(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000UL + ts.tv_nsec;
+}
+
+/* Start tracing, discarding spans of earlier traces and the pattern of the
+ *  calling thread.
+ * Return 0 if tracing is not compiled in, 1 otherwise.
+ */
+int FMTraceStart(void) {
+#ifdef FM_TRACE
+  pthread_mutex_lock(&trace_lock);
+  __atomic_store_n(&trace_generation, trace_generation + 1, __ATOMIC_RELAXED);
+  trace_start_ns = FMTraceNow();
+  pthread_mutex_unlock(&trace_lock);
+  local_pattern = FM_TRACE_NO_PATTERN;
+  __atomic_store_n(&fm_trace_enabled, 1, __ATOMIC_RELEASE);
+  return 1;
+#else
+  return 0;
+#endif
+}
+
+void FMTraceStop(void) {
+  __atomic_store_n(&fm_trace_enabled, 0, __ATOMIC_RELEASE);
+}
+
+// Return the buffer of the calling thread, or NULL on memory allocation
+//  error, in which case the spans of the thread are lost.
+static trace_buffer *LocalBuffer(void) {
+  trace_buffer *b = local_buffer;
+  if (!b) {
+    if (!(b = malloc(sizeof(trace_buffer))))
+      return NULL;
+    if (!(b->spans = malloc(INITIAL_SPANS * sizeof(trace_span)))) {
+      free(b);
+      return NULL;
+    }
+    b->capacity = INITIAL_SPANS;
+    pthread_mutex_lock(&trace_lock);
+    b->next = buffers;
+    b->id = buffer_count++;
+    b->generation = trace_generation;
+    b->recorded = 0;
+    buffers = b;
+    pthread_mutex_unlock(&trace_lock);
+    local_buffer = b;
+  }
+
+  unsigned long generation =
+      __atomic_load_n(&trace_generation, __ATOMIC_RELAXED);
+  if (b->generation != generation) {
+    b->generation = generation;
+    b->recorded = 0;
+  }
+  b->thread_name = local_thread_name;
+  return b;
+}
+
+// Record a span of the calling thread from start_ns until now.
+void FMTraceRecord(const char *name, uint64_t start_ns, unsigned long lf_steps,
+                   unsigned long hits) {
+  uint64_t end_ns = FMTraceNow();
+  trace_buffer *b = LocalBuffer();
+  if (!b)
+    return;
+  if (b->recorded == b->capacity && b->capacity < FM_TRACE_RING_SZ) {
+    trace_span *spans = realloc(b->spans, 2 * b->capacity * sizeof(trace_span));
+    if (spans) {
+      b->spans = spans;
+      b->capacity *= 2;
+    }
+  }
+  trace_span *s = &b->spans[b->recorded++ % b->capacity];
+  s->name = name;
+  s->start_ns = start_ns;
+  s->end_ns = end_ns;
+  s->pattern = local_pattern;
+  s->lf_steps = lf_steps;
+  s->hits = hits;
+}
+
+void FMTraceSetPattern(long pattern) { local_pattern = pattern; }
+
+void FMTraceSetThreadName(const char *name) { local_thread_name = name; }
+
+// Timestamps are in microseconds since the start of the trace.
+static double Microseconds(uint64_t ns) {
+  return (ns > trace_start_ns) ? (ns - trace_start_ns) / 1e3 : 0.;
+}
+
+/* Write the spans of the current trace to filename as Chrome trace event
+ *  JSON. Call it once the traced work is done, as spans recorded while
+ *  writing may be torn.
+ * Return 0 on error, 1 otherwise.
+ */
+int FMTraceWrite(const char *filename) {
+  FILE *f = fopen(filename, "w");
+  if (!f)
+    return 0;
+
+  pthread_mutex_lock(&trace_lock);
+  unsigned long dropped = 0;
+  int first = 1;
+  fprintf(f, "{\"traceEvents\":[");
+  for (trace_buffer *b = buffers; b; b = b->next) {
+    if (b->generation != trace_generation || !b->recorded)
+      continue;
+    fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+               "\"tid\":%u,\"args\":{\"name\":\"%s %u\"}}",
+            (first) ? "" : ",", b->id,
+            (b->thread_name) ? b->thread_name : "thread", b->id);
+    first = 0;
+
+    unsigned long kept = b->recorded;
+    if (kept > b->capacity) {
+      dropped += kept - b->capacity;
+      kept = b->capacity;
+    }
+    for (unsigned long i = b->recorded - kept; i < b->recorded; ++i) {
+      trace_span *s = &b->spans[i % b->capacity];
+      fprintf(f, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+                 "\"ts\":%.3f,\"dur\":%.3f,\"args\":{",
+              s->name, b->id, Microseconds(s->start_ns),
+              (s->end_ns - s->start_ns) / 1e3);
+      if (s->pattern != FM_TRACE_NO_PATTERN)
+        fprintf(f, "\"pattern\":%ld,", s->pattern);
+      fprintf(f, "\"lf_steps\":%lu,\"hits\":%lu}}", s->lf_steps, s->hits);
+    }
+  }
+  fprintf(f, "\n],\"displayTimeUnit\":\"ns\",\"otherData\":{"
+             "\"dropped_spans\":%lu}}\n",
+          dropped);
+  pthread_mutex_unlock(&trace_lock);
+
+  int ok = !ferror(f);
+  return (fclose(f) == 0) && ok;
+}
+
+/* Stop tracing and free all buffers. Threads other than the calling one
+ *  must have exited, since they keep pointers to their buffers.
+ */
+void FMTraceFree(void) {
+  FMTraceStop();
+  pthread_mutex_lock(&trace_lock);
+  while (buffers) {
+    trace_buffer *next = buffers->next;
+    free(buffers->spans);
+    free(buffers);
+    buffers = next;
+  }
+  buffer_count = 0;
+  pthread_mutex_unlock(&trace_lock);
+  local_buffer = NULL;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+/* Tracing of query timelines.
+ * When built with -DFM_TRACE (make TRACE=1), the FM_TRACE_* macros record
+ *  spans into a ring buffer per thread while tracing is started, and
+ *  FMTraceWrite exports them as Chrome trace event JSON, which
+ *  chrome://tracing and ui.perfetto.dev open. Each span carries the thread,
+ *  the pattern set with FM_TRACE_PATTERN on that thread, and a number of LF
+ *  steps and hits. Without FM_TRACE the macros compile to nothing, and with
+ *  it but tracing stopped each costs one well-predicted branch.
+ */
+
+// Spans kept per thread; older spans are overwritten and counted as dropped.
+//  Buffers start small and grow up to this size.
+#define FM_TRACE_RING_SZ (1 << 20)
+
+#define FM_TRACE_NO_PATTERN -1L
+
+extern int fm_trace_enabled;
+
+int FMTraceStart(void);
+void FMTraceStop(void);
+int FMTraceWrite(const char *filename);
+void FMTraceFree(void);
+uint64_t FMTraceNow(void);
+void FMTraceRecord(const char *name, uint64_t start_ns, unsigned long lf_steps,
+                   unsigned long hits);
+void FMTraceSetPattern(long pattern);
+void FMTraceSetThreadName(const char *name);
+
+static inline int FMTraceEnabled(void) {
+  return __builtin_expect(__atomic_load_n(&fm_trace_enabled, __ATOMIC_RELAXED),
+                          0);
+}
+
+#ifdef FM_TRACE
+// Start a span in a new variable named span.
+#define FM_TRACE_BEGIN(span)                                                   \
+  uint64_t span = (FMTraceEnabled()) ? FMTraceNow() : 0
+// End the span, with a static string as its name.
+#define FM_TRACE_END(span, name, lf_steps, hits)                               \
+  do {                                                                         \
+    if (FMTraceEnabled() && span)                                              \
+      FMTraceRecord(name, span, lf_steps, hits);                               \
+  } while (0)
+// Attribute the following spans of this thread to a pattern.
+#define FM_TRACE_PATTERN(pattern)                                              \
+  do {                                                                         \
+    if (FMTraceEnabled())                                                      \
+      FMTraceSetPattern(pattern);                                              \
+  } while (0)
+// Name this thread in exported traces, with a static string.
+#define FM_TRACE_THREAD(name) FMTraceSetThreadName(name)
+#else
+#define FM_TRACE_BEGIN(span)
+#define FM_TRACE_END(span, name, lf_steps, hits)                               \
+  ((void)(lf_steps), (void)(hits))
+#define FM_TRACE_PATTERN(pattern) ((void)(pattern))
+#define FM_TRACE_THREAD(name)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 // https://stackoverflow.com/questions/2029103/#2029227
 char *ReadFile(char *filename) {
@@ -96,3 +97,37 @@ int MaybeMallocAligned(void **mem, size_t sz, int aligned) {
   else
     return (*mem = malloc(sz)) != NULL;
 }
+
+/* Open a temporary file next to filename for writing a replacement of it,
+ *  whose newly allocated name is stored in *tmp_filename.
+ * Return NULL on error.
+ */
+FILE *OpenReplacement(char *filename, char **tmp_filename) {
+  size_t sz = strlen(filename) + sizeof(".tmp");
+  if (!(*tmp_filename = malloc(sz)))
+    return NULL;
+  snprintf(*tmp_filename, sz, "%s.tmp", filename);
+
+  FILE *f = fopen(*tmp_filename, "w");
+  if (!f) {
+    free(*tmp_filename);
+    *tmp_filename = NULL;
+  }
+  return f;
+}
+
+/* Flush the replacement opened by OpenReplacement to disk and rename it over
+ *  filename. The rename is atomic, so readers see either the old or the new
+ *  file and never a partially written one. The temporary file is removed and
+ *  its name freed either way.
+ * Return 0 on error, 1 otherwise.
+ */
+int CommitReplacement(FILE *f, char *tmp_filename, char *filename) {
+  int ok = fflush(f) == 0 && !ferror(f) && fsync(fileno(f)) == 0;
+  ok = (fclose(f) == 0) && ok;
+  ok = ok && rename(tmp_filename, filename) == 0;
+  if (!ok)
+    unlink(tmp_filename);
+  free(tmp_filename);
+  return ok;
+}
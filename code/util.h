@@ -4,6 +4,7 @@
 extern "C" {
 #endif
 
+#include <stdio.h>
 #include <stdlib.h>
 
 char *ReadFile(char *filename);
@@ -11,6 +12,8 @@ int randomrange(int min, int max);
 int LoadTestData(char *filename, char **tests, unsigned *pattern_count,
                  unsigned *pattern_sz, unsigned *max_match_count, int aligned);
 int MaybeMallocAligned(void **mem, size_t sz, int aligned);
+FILE *OpenReplacement(char *filename, char **tmp_filename);
+int CommitReplacement(FILE *f, char *tmp_filename, char *filename);
 
 #ifdef __cplusplus
 }
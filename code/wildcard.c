@@ -0,0 +1,198 @@
+#include "trace.h"
+#include "wildcard.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* Search for patterns with wildcards and character classes.
+ * A pattern is a sequence of positions, each of which is a literal
+ *  character, ? for any character, or a class like [KR], [a-z] or [^DE].
+ *  A backslash makes the next character literal, also within a class.
+ * The pattern is searched backward depth-first, branching at each position
+ *  only on the characters of its set whose extended range is non-empty.
+ *  Instantiations sharing a suffix share the search for that suffix, so the
+ *  work is bounded by the number of distinct suffixes that occur in the text
+ *  instead of the number of instantiations.
+ */
+
+static void AddCharacter(fm_index *fm, uint64_t *set, unsigned char c) {
+  int idx = fm->alphabet_map[c];
+  if (idx >= 0)
+    set[idx / 64] |= 1UL << (idx % 64);
+}
+
+// Wildcards and negated classes match neither the dollar sign nor the
+//  document separator, so matches never cross the end of a document.
+static void AddAll(fm_index *fm, uint64_t *set) {
+  for (unsigned c = 0; c < 256; ++c)
+    if (c != '$' && c != (unsigned char)FM_DOCUMENT_SEPARATOR)
+      AddCharacter(fm, set, c);
+}
+
+/* Parse the pattern syntax described above into character sets over the
+ *  alphabet of the index. Characters that do not occur in the text are
+ *  dropped from their sets, leaving positions that cannot match empty.
+ * Return 0 on a syntax error or memory allocation error.
+ */
+int FMPatternParse(fm_index *fm, char *s, fm_pattern *pattern) {
+  FM_TRACE_BEGIN(span);
+  size_t sz = strlen(s);
+  pattern->length = 0;
+  if (!(pattern->sets = calloc(sz + 1, sizeof(*pattern->sets))))
+    return 0;
+
+  for (size_t i = 0; i < sz; ++i) {
+    uint64_t *set = pattern->sets[pattern->length++];
+    if (s[i] == '?') {
+      AddAll(fm, set);
+      continue;
+    }
+    if (s[i] == '\\') {
+      if (++i == sz)
+        goto error;
+      AddCharacter(fm, set, s[i]);
+      continue;
+    }
+    if (s[i] != '[') {
+      AddCharacter(fm, set, s[i]);
+      continue;
+    }
+
+    // Character class, with ranges and optional negation.
+    uint64_t class[4] = {0};
+    int negate = (++i < sz && s[i] == '^');
+    i += negate;
+    size_t first = i;
+    for (; i < sz && (s[i] != ']' || i == first); ++i) {
+      if (s[i] == '\\' && ++i == sz)
+        goto error;
+      unsigned char lo = s[i], hi = s[i];
+      if (i + 2 < sz && s[i + 1] == '-' && s[i + 2] != ']') {
+        i += 2;
+        if (s[i] == '\\' && ++i == sz)
+          goto error;
+        hi = s[i];
+      }
+      for (unsigned c = lo; c <= hi; ++c)
+        AddCharacter(fm, class, c);
+    }
+    if (i == sz)
+      goto error;
+
+    if (negate) {
+      AddAll(fm, set);
+      for (unsigned w = 0; w < 4; ++w)
+        set[w] &= ~class[w];
+    } else
+      memcpy(set, class, sizeof(class));
+  }
+
+  if (!pattern->length)
+    goto error;
+  FM_TRACE_END(span, "parse", 0, 0);
+  return 1;
+
+error:
+  FMPatternFree(pattern);
+  return 0;
+}
+
+void FMPatternFree(fm_pattern *pattern) {
+  free(pattern->sets);
+  pattern->sets = NULL;
+  pattern->length = 0;
+}
+
+typedef struct pattern_search {
+  fm_index *fm;
+  fm_pattern *pattern;
+  size_t max_nodes;
+  size_t nodes;
+  fm_pattern_range *ranges;
+  size_t range_count;
+  size_t range_capacity;
+  int failed;
+} pattern_search;
+
+static void RecordRange(pattern_search *search, ranges_t start, ranges_t end) {
+  if (search->range_count == search->range_capacity) {
+    size_t capacity = (search->range_capacity) ? 2 * search->range_capacity
+                                               : 16;
+    fm_pattern_range *ranges =
+        realloc(search->ranges, capacity * sizeof(fm_pattern_range));
+    if (!ranges) {
+      search->failed = 1;
+      return;
+    }
+    search->ranges = ranges;
+    search->range_capacity = capacity;
+  }
+  search->ranges[search->range_count++] = (fm_pattern_range){start, end};
+}
+
+// Extend the match of pattern[pos + 1, length) in [start, end) with every
+//  character allowed at pos.
+static void SearchPosition(pattern_search *search, size_t pos, ranges_t start,
+                           ranges_t end) {
+  fm_index *fm = search->fm;
+  const uint64_t *set = search->pattern->sets[pos];
+  for (unsigned w = 0; w < 4; ++w) {
+    for (uint64_t bits = set[w]; bits; bits &= bits - 1) {
+      if (search->failed)
+        return;
+      int c = w * 64 + __builtin_ctzll(bits);
+      ranges_t new_start = fm->ranges[2 * c] + FMIndexOcc(fm, c, start);
+      ranges_t new_end = fm->ranges[2 * c] + FMIndexOcc(fm, c, end);
+      if (new_end == new_start)
+        continue;
+
+      if (search->max_nodes && search->nodes == search->max_nodes) {
+        search->failed = -1;
+        return;
+      }
+      ++search->nodes;
+      if (pos == 0)
+        RecordRange(search, new_start, new_end);
+      else
+        SearchPosition(search, pos - 1, new_start, new_end);
+    }
+  }
+}
+
+static int CompareRange(const void *a, const void *b) {
+  const fm_pattern_range *r = a, *s = b;
+  return (r->start > s->start) - (r->start < s->start);
+}
+
+/* Find the ranges in the F column of all instantiations of the pattern that
+ *  occur in the text. The ranges are disjoint and sorted.
+ * At most max_nodes non-empty ranges of pattern suffixes are explored, or any
+ *  number if max_nodes is 0. If nodes is not NULL, *nodes is set to the
+ *  number explored.
+ * Return 1 on success, -1 if the search was stopped after max_nodes nodes,
+ *  in which case the ranges found so far are returned, and 0 on memory
+ *  allocation error.
+ */
+int FMIndexPatternSearch(fm_index *fm, fm_pattern *pattern, size_t max_nodes,
+                         fm_pattern_range **ranges, size_t *range_count,
+                         size_t *nodes) {
+  FM_TRACE_BEGIN(span);
+  pattern_search search = {fm, pattern, max_nodes, 0, NULL, 0, 0, 0};
+  SearchPosition(&search, pattern->length - 1, 0, fm->bwt_sz);
+  if (nodes)
+    *nodes = search.nodes;
+  if (search.failed == 1) {
+    free(search.ranges);
+    *ranges = NULL;
+    *range_count = 0;
+    return 0;
+  }
+
+  if (search.range_count)
+    qsort(search.ranges, search.range_count, sizeof(fm_pattern_range),
+          &CompareRange);
+  *ranges = search.ranges;
+  *range_count = search.range_count;
+  FM_TRACE_END(span, "pattern search", search.nodes, search.range_count);
+  return (search.failed) ? -1 : 1;
+}
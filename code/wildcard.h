@@ -0,0 +1,37 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "fmindex.h"
+
+#include <stdint.h>
+
+/* A pattern of single-character positions, each matching a set of alphabet
+ *  indices. Sets are bitmaps over the (at most 256) alphabet indices.
+ */
+typedef struct fm_pattern {
+  size_t length;
+  uint64_t (*sets)[4];
+} fm_pattern;
+
+typedef struct fm_pattern_range {
+  ranges_t start;
+  ranges_t end;
+} fm_pattern_range;
+
+int FMPatternParse(fm_index *fm, char *s, fm_pattern *pattern);
+void FMPatternFree(fm_pattern *pattern);
+int FMIndexPatternSearch(fm_index *fm, fm_pattern *pattern, size_t max_nodes,
+                         fm_pattern_range **ranges, size_t *range_count,
+                         size_t *nodes);
+
+static inline int FMPatternHas(const fm_pattern *pattern, size_t pos,
+                               int alphabet_idx) {
+  return pattern->sets[pos][alphabet_idx / 64] >> (alphabet_idx % 64) & 1;
+}
+
+#ifdef __cplusplus
+}
+#endif